@@ -4,15 +4,43 @@ use strict;
 
 use Image::Magick;
 
+# usage: gray.pl [reflected|debruijn], as [base] code
+my $code = shift || 'reflected';
 my $bits = 6;
 my $perimeter = 37.7;
-my $height = 2;
+my $height = ($code eq 'debruijn') ? 0.5 : 2;
+
+die "unknown code $code\n"
+	unless(($code eq 'reflected') || ($code eq 'debruijn'));
 
 sub gray_code {
 	my $i = shift;
 	return $i ^ ($i >> 1);
 }
 
+# binary De Bruijn sequence as built by gray_code_new() in src/gray.c
+sub de_bruijn {
+	my $n = shift;
+	my @a = (0) x ($n + 1);
+	my @track;
+	my $db;
+	$db = sub {
+		my ($t, $p) = @_;
+		if($t > $n) {
+			push @track, @a[1 .. $p] if(($n % $p) == 0);
+			return;
+		}
+		$a[$t] = $a[$t - $p];
+		$db->($t + 1, $p);
+		if($a[$t - $p] == 0) {
+			$a[$t] = 1;
+			$db->($t + 1, $t);
+		}
+	};
+	$db->(1, 1);
+	return @track;
+}
+
 my $f = 300 / 2.54;
 my $w = $perimeter * $f;
 my $h = $height * $f;
@@ -26,21 +54,36 @@ my $n = 2 ** $bits;
 my $w1 = $w / $n;
 my $h1 = $h / $bits;
 
-for(my $i = 0; $i < $n; $i ++) {
-	my $gray = gray_code($i);
-	for(my $b = 0; $b < $bits; $b ++) {
-		if($gray & (1 << $b)) {
-			my $x1 = $w1 * $i;
-			my $x2 = $x1 + $w1;
-			my $y1 = $h1 * $b;
-			my $y2 = $y1 + $h1;
-			$image->Draw(
-				'stroke' => 'black',
-				'primitive' => 'rectangle',
-				'points' => "$x1,$y1,$x2,$y2");
+# single track: one row, the cells have to run left to right in the camera
+# image as the turntable angle grows
+if($code eq 'debruijn') {
+	my @track = de_bruijn($bits);
+	for(my $i = 0; $i < $n; $i ++) {
+		next unless($track[$i]);
+		my $x1 = $w1 * $i;
+		my $x2 = $x1 + $w1;
+		$image->Draw(
+			'stroke' => 'black',
+			'primitive' => 'rectangle',
+			'points' => "$x1,0,$x2,$h");
+	}
+} else {
+	for(my $i = 0; $i < $n; $i ++) {
+		my $gray = gray_code($i);
+		for(my $b = 0; $b < $bits; $b ++) {
+			if($gray & (1 << $b)) {
+				my $x1 = $w1 * $i;
+				my $x2 = $x1 + $w1;
+				my $y1 = $h1 * $b;
+				my $y2 = $y1 + $h1;
+				$image->Draw(
+					'stroke' => 'black',
+					'primitive' => 'rectangle',
+					'points' => "$x1,$y1,$x2,$y2");
+			}
 		}
+		#printf "%03d: %0*b\n", $i, $bits, $gray;
 	}
-	#printf "%03d: %0*b\n", $i, $bits, $gray;
 }
 
 my $x = $image->Write('gray.png');
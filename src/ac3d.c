@@ -1,17 +1,20 @@
 #include <stdio.h>
-#include <locale.h>
+#include <string.h>
 
 #include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 #include <g3d/types.h>
 #include <g3d/matrix.h>
 #include <g3d/vector.h>
 
+#include "ac3d.h"
+
 static inline guint32 ac3d_col16(guint8 r, guint8 g, guint8 b)
 {
 	return ((r / 8) << 11) + ((g / 4) << 5) + (b / 8);
 }
 
-static guint32 ac3d_median_color_4(guint8 *angle_colors, guint32 n_angles,
+static guint32 ac3d_median_color_4(guint8 **angle_colors, guint32 n_angles,
 	guint32 n_vert_y, guint32 *indices, GHashTable *colors)
 {
 	guint32 sum[3] = { 0, 0, 0 }, c[3], col16, colid;
@@ -19,7 +22,7 @@ static guint32 ac3d_median_color_4(guint8 *angle_colors, guint32 n_angles,
 
 	for(j = 0; j < 3; j ++) {
 		for(i = 0; i < 4; i ++)
-			sum[j] += angle_colors[indices[i] * 3 + j];
+			sum[j] += angle_colors[j][indices[i]];
 		c[j] = sum[j] / 4;
 	}
 	col16 = ac3d_col16(c[0], c[1], c[2]);
@@ -32,19 +35,19 @@ static guint32 ac3d_median_color_4(guint8 *angle_colors, guint32 n_angles,
 
 	/* unknown mixed color, just take 1st vertex */
 	col16 = ac3d_col16(
-		angle_colors[indices[0] * 3 + 0],
-		angle_colors[indices[0] * 3 + 1],
-		angle_colors[indices[0] * 3 + 2]);
+		angle_colors[0][indices[0]],
+		angle_colors[1][indices[0]],
+		angle_colors[2][indices[0]]);
 	return GPOINTER_TO_UINT(g_hash_table_lookup(colors,
 		GUINT_TO_POINTER(col16)));
 }
 
-static GHashTable *ac3d_init_colors(guint8 *angle_colors, guint32 n_angles,
+static GHashTable *ac3d_init_colors(guint8 **angle_colors, guint32 n_angles,
 	guint32 n_vert_y, FILE *f)
 {
 	GHashTable *hash;
-	guint8 *c;
-	gint32 i, j;
+	guint8 c[3];
+	gint32 i, j, k;
 	guint32 colid = 1, col16;
 
 	hash = g_hash_table_new(g_direct_hash, g_direct_equal);
@@ -54,7 +57,8 @@ static GHashTable *ac3d_init_colors(guint8 *angle_colors, guint32 n_angles,
 
 	for(i = 0; i < n_angles; i ++) {
 		for(j = 0; j < n_vert_y; j ++) {
-			c = angle_colors + (i * n_vert_y + j) * 3;
+			for(k = 0; k < 3; k ++)
+				c[k] = angle_colors[k][i * n_vert_y + j];
 			col16 = ac3d_col16(c[0], c[1], c[2]);
 			if(col16 == 0) /* black already done */
 				continue;
@@ -77,7 +81,8 @@ static GHashTable *ac3d_init_colors(guint8 *angle_colors, guint32 n_angles,
 }
 
 gboolean ac3d_write(const gchar *filename, gfloat *angle_verts,
-	guint8 *angle_colors, guint32 n_angles, guint32 n_vert_y, guint32 height)
+	guint8 **angle_colors, guint32 n_angles, guint32 n_vert_y, guint32 height,
+	Ac3dProgressFunc progress, gpointer user_data)
 {
 	FILE *f;
 	gint32 i, j, k;
@@ -85,9 +90,6 @@ gboolean ac3d_write(const gchar *filename, gfloat *angle_verts,
 	gfloat a_rad, x, y, z, matrix[16], sh;
 	GHashTable *colors;
 
-
-	setlocale(LC_NUMERIC, "C");
-
 	f = fopen(filename, "w");
 	if(f == NULL)
 		return FALSE;
@@ -114,6 +116,8 @@ gboolean ac3d_write(const gchar *filename, gfloat *angle_verts,
 			g3d_vector_transform(&x, &y, &z, matrix);
 			fprintf(f, "%f %f %f\n", x, y, z);
 		}
+		if(progress)
+			progress(0.5 * (i + 1) / n_angles, user_data);
 	}
 
 	fprintf(f, "numsurf %d\n", (n_vert_y - 1) * n_angles);
@@ -129,7 +133,199 @@ gboolean ac3d_write(const gchar *filename, gfloat *angle_verts,
 			for(k = 0; k < 4; k ++)
 				fprintf(f, "%d 0 0\n", ind[k]);
 		}
+		if(progress)
+			progress(0.5 + 0.5 * (i + 1) / n_angles, user_data);
+	}
+
+	fprintf(f, "kids 0\n");
+	fclose(f);
+	return TRUE;
+}
+
+/* the strips of all angles side by side, wrapped into rows of a power of
+ * two strips to keep the image about square; n_angles is a power of two
+ * as well, so all rows are full */
+static GdkPixbuf *ac3d_pack_texture(guint8 *texture, guint32 tex_band,
+	guint32 tex_rows, guint32 n_angles, guint32 *per_row)
+{
+	GdkPixbuf *pixbuf;
+	guint8 *pixels, *strip;
+	guint32 i, j, x0, y0, rs;
+
+	*per_row = 1;
+	while((*per_row < n_angles) &&
+		(*per_row * tex_band < (n_angles / *per_row) * tex_rows))
+		*per_row <<= 1;
+
+	pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8,
+		*per_row * tex_band, (n_angles / *per_row) * tex_rows);
+	if(pixbuf == NULL)
+		return NULL;
+	pixels = gdk_pixbuf_get_pixels(pixbuf);
+	rs = gdk_pixbuf_get_rowstride(pixbuf);
+
+	for(i = 0; i < n_angles; i ++) {
+		x0 = (i % *per_row) * tex_band;
+		y0 = (i / *per_row) * tex_rows;
+		strip = texture + i * tex_rows * tex_band * 3;
+		for(j = 0; j < tex_rows; j ++)
+			memcpy(pixels + (y0 + j) * rs + x0 * 3,
+				strip + j * tex_band * 3, tex_band * 3);
+	}
+	return pixbuf;
+}
+
+/* foo.ac gets foo.png next to it */
+static gchar *ac3d_texture_filename(const gchar *filename)
+{
+	gchar *base, *texname;
+
+	if(!g_str_has_suffix(filename, ".ac"))
+		return g_strdup_printf("%s.png", filename);
+	base = g_strndup(filename, strlen(filename) - 3);
+	texname = g_strdup_printf("%s.png", base);
+	g_free(base);
+	return texname;
+}
+
+/* same mesh as ac3d_write() with a single material; vertex (i, j) maps to
+ * the center column of strip i at the texture row of j, a face to the
+ * next strip uses the right half of its own strip if that one is not
+ * next to it in the image */
+gboolean ac3d_write_textured(const gchar *filename, gfloat *angle_verts,
+	guint8 *texture, guint32 tex_band, guint32 tex_rows, guint32 n_angles,
+	guint32 n_vert_y, guint32 height, Ac3dProgressFunc progress,
+	gpointer user_data)
+{
+	FILE *f;
+	GdkPixbuf *pixbuf;
+	GError *error = NULL;
+	gchar *texname, *basename;
+	gint32 i, j, k;
+	guint32 ind[4], per_row, tw, th, next;
+	gfloat a_rad, x, y, z, matrix[16], sh, u[4], v[4], u0, u1;
+
+	pixbuf = ac3d_pack_texture(texture, tex_band, tex_rows, n_angles,
+		&per_row);
+	if(pixbuf == NULL)
+		return FALSE;
+	tw = gdk_pixbuf_get_width(pixbuf);
+	th = gdk_pixbuf_get_height(pixbuf);
+	texname = ac3d_texture_filename(filename);
+	if(!gdk_pixbuf_save(pixbuf, texname, "png", &error, NULL)) {
+		g_warning("failed to save texture %s: %s", texname, error->message);
+		g_error_free(error);
+		gdk_pixbuf_unref(pixbuf);
+		g_free(texname);
+		return FALSE;
+	}
+	gdk_pixbuf_unref(pixbuf);
+
+	f = fopen(filename, "w");
+	if(f == NULL) {
+		g_free(texname);
+		return FALSE;
+	}
+
+	fprintf(f, "AC3Db\n");
+	fprintf(f, "MATERIAL \"default\" rgb 1 1 1 amb 0.2 0.2 0.2 "
+		"emis 0 0 0 spec 0.5 0.5 0.5 shi 5 trans 0\n");
+	fprintf(f, "OBJECT world\nkids 1\n");
+	fprintf(f, "OBJECT poly\nname\"scanned_object\"\n");
+	basename = g_path_get_basename(texname);
+	fprintf(f, "texture \"%s\"\n", basename);
+	g_free(basename);
+	g_free(texname);
+
+	sh = (gfloat)height / n_vert_y;
+
+	/* vertices */
+	fprintf(f, "numvert %d\n", n_angles * n_vert_y);
+	for(i = 0; i < n_angles; i ++) {
+		a_rad = G_PI * 2.0 * i / (gfloat)n_angles;
+		for(j = 0; j < n_vert_y; j ++) {
+			x = -(angle_verts[i * n_vert_y + j]);
+			y = height - sh * j - sh / 2;
+			z = 0;
+			g3d_matrix_identity(matrix);
+			g3d_matrix_rotate(a_rad, 0.0, 1.0, 0.0, matrix);
+			g3d_vector_transform(&x, &y, &z, matrix);
+			fprintf(f, "%f %f %f\n", x, y, z);
+		}
+		if(progress)
+			progress(0.5 * (i + 1) / n_angles, user_data);
+	}
+
+	fprintf(f, "numsurf %d\n", (n_vert_y - 1) * n_angles);
+	for(i = 0; i < n_angles; i ++) {
+		next = (i + 1) % n_angles;
+		u0 = ((i % per_row) * tex_band + tex_band / 2.0) / tw;
+		if((next % per_row) == ((i % per_row) + 1))
+			u1 = u0 + (gfloat)tex_band / tw;
+		else
+			u1 = ((i % per_row) + 1) * (gfloat)tex_band / tw;
+		for(j = 0; j < (n_vert_y - 1); j ++) {
+			ind[0] = i * n_vert_y + j;
+			ind[1] = next * n_vert_y + j;
+			ind[2] = next * n_vert_y + j + 1;
+			ind[3] = i * n_vert_y + j + 1;
+			u[0] = u[3] = u0;
+			u[1] = u[2] = u1;
+			/* strip rows run down from the top of the region, which is
+			 * the object's bottom (see scan_angle()) */
+			for(k = 0; k < 4; k ++) {
+				y = (height - sh * (j + (k / 2)) - sh / 2) / height;
+				v[k] = 1.0 - ((i / per_row) * tex_rows +
+					CLAMP(y, 0.0, 1.0) * tex_rows) / th;
+			}
+			fprintf(f, "SURF 0x00\nmat 0\nrefs 4\n");
+			for(k = 0; k < 4; k ++)
+				fprintf(f, "%d %f %f\n", ind[k], u[k], v[k]);
+		}
+		if(progress)
+			progress(0.5 + 0.5 * (i + 1) / n_angles, user_data);
+	}
+
+	fprintf(f, "kids 0\n");
+	fclose(f);
+	return TRUE;
+}
+
+/* plain triangle mesh in object space, e.g. from hull_save() */
+gboolean ac3d_write_mesh(const gchar *filename, gfloat *verts,
+	guint32 n_verts, guint32 *tris, guint32 n_tris,
+	Ac3dProgressFunc progress, gpointer user_data)
+{
+	FILE *f;
+	guint32 i;
+
+	f = fopen(filename, "w");
+	if(f == NULL)
+		return FALSE;
+
+	fprintf(f, "AC3Db\n");
+	fprintf(f, "MATERIAL \"default\" rgb 0.7 0.7 0.7 amb 0.2 0.2 0.2 "
+		"emis 0 0 0 spec 0.5 0.5 0.5 shi 5 trans 0\n");
+	fprintf(f, "OBJECT world\nkids 1\n");
+	fprintf(f, "OBJECT poly\nname\"scanned_object\"\n");
+
+	fprintf(f, "numvert %u\n", n_verts);
+	for(i = 0; i < n_verts; i ++) {
+		fprintf(f, "%f %f %f\n", verts[i * 3 + 0], verts[i * 3 + 1],
+			verts[i * 3 + 2]);
+		if(progress && ((i % 1024) == 1023))
+			progress(0.5 * (i + 1) / n_verts, user_data);
+	}
+
+	fprintf(f, "numsurf %u\n", n_tris);
+	for(i = 0; i < n_tris; i ++) {
+		fprintf(f, "SURF 0x10\nmat 0\nrefs 3\n%u 0 0\n%u 0 0\n%u 0 0\n",
+			tris[i * 3 + 0], tris[i * 3 + 1], tris[i * 3 + 2]);
+		if(progress && ((i % 1024) == 1023))
+			progress(0.5 + 0.5 * (i + 1) / n_tris, user_data);
 	}
+	if(progress)
+		progress(1.0, user_data);
 
 	fprintf(f, "kids 0\n");
 	fclose(f);
@@ -3,7 +3,20 @@
 
 #include <glib.h>
 
+typedef void (*Ac3dProgressFunc)(gfloat fraction, gpointer user_data);
+
+/* numbers are printed in the numeric locale of the process, which has to
+ * be "C" (see main()); the writers may run on any thread */
 gboolean ac3d_write(const gchar *filename, gfloat *angle_verts,
-	guint8 *angle_colors, guint32 n_angles, guint32 n_vert_y, guint32 height);
+	guint8 **angle_colors, guint32 n_angles, guint32 n_vert_y, guint32 height,
+	Ac3dProgressFunc progress, gpointer user_data);
+
+gboolean ac3d_write_textured(const gchar *filename, gfloat *angle_verts,
+	guint8 *texture, guint32 tex_band, guint32 tex_rows, guint32 n_angles,
+	guint32 n_vert_y, guint32 height, Ac3dProgressFunc progress,
+	gpointer user_data);
+gboolean ac3d_write_mesh(const gchar *filename, gfloat *verts,
+	guint32 n_verts, guint32 *tris, guint32 n_tris,
+	Ac3dProgressFunc progress, gpointer user_data);
 
 #endif
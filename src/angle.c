@@ -0,0 +1,76 @@
+#include <glib.h>
+
+#include "angle.h"
+
+AngleTracker *angle_tracker_new(guint32 n_bits, guint32 sub_bits)
+{
+	AngleTracker *tracker;
+
+	tracker = g_new0(AngleTracker, 1);
+	tracker->n_codes = (1 << n_bits);
+	tracker->sub_bits = sub_bits;
+	tracker->direction = 1;
+	return tracker;
+}
+
+void angle_tracker_free(AngleTracker *tracker)
+{
+	g_free(tracker);
+}
+
+/* a step to a neighbouring code is timed at the middle between the last
+ * frame of the old and the first frame of the new code, with up to
+ * ANGLE_MAX_GAP of invalid frames in between; anything else (longer gaps,
+ * misread codes) drops the timing until the next clean step. The result is an index into the finer grid of n_codes <<
+ * sub_bits angles. */
+gboolean angle_tracker_update(AngleTracker *tracker, guint64 stamp,
+	gboolean valid, guint32 code, guint32 *angle)
+{
+	guint32 step, n_sub, sub;
+	guint64 t;
+	gint32 direction;
+	gdouble f = 0.5;
+
+	if(tracker->locked && (stamp > tracker->prev_stamp + ANGLE_MAX_GAP))
+		tracker->locked = FALSE;
+	if(!valid || (code >= tracker->n_codes))
+		return FALSE;
+
+	if(code != tracker->code) {
+		step = (code + tracker->n_codes - tracker->code) % tracker->n_codes;
+		direction = (step == 1) ? 1 : ((step == tracker->n_codes - 1) ?
+			-1 : 0);
+		if(tracker->locked && (direction != 0) &&
+			(stamp > tracker->prev_stamp)) {
+			t = tracker->prev_stamp + (stamp - tracker->prev_stamp) / 2;
+			if(tracker->entered && (direction == tracker->direction) &&
+				(t > tracker->entered)) {
+				tracker->period = (tracker->period > 0.0) ?
+					(tracker->period * 0.75 + (t - tracker->entered) * 0.25) :
+					(gdouble)(t - tracker->entered);
+			} else if(direction != tracker->direction) {
+				tracker->period = 0.0;
+			}
+			tracker->direction = direction;
+			tracker->entered = t;
+		} else {
+			tracker->entered = 0;
+			tracker->period = 0.0;
+		}
+	}
+	tracker->code = code;
+	tracker->prev_stamp = stamp;
+	tracker->locked = TRUE;
+
+	if(tracker->entered && (tracker->period > 0.0) &&
+		(stamp >= tracker->entered)) {
+		f = CLAMP((stamp - tracker->entered) / tracker->period, 0.0, 1.0);
+		if(tracker->direction < 0)
+			f = 1.0 - f;
+	}
+
+	n_sub = (1 << tracker->sub_bits);
+	sub = MIN((guint32)(f * n_sub), n_sub - 1);
+	*angle = (code << tracker->sub_bits) + sub;
+	return TRUE;
+}
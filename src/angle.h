@@ -0,0 +1,32 @@
+#ifndef _ANGLE_H
+#define _ANGLE_H
+
+#include <glib.h>
+
+/* invalid frames (a code cell edge under a guard window, quality rejects)
+ * keep the timing for this long, in microseconds */
+#define ANGLE_MAX_GAP     250000
+
+/* fractional turntable angle between gray code transitions, interpolated
+ * from the capture time of each frame */
+typedef struct {
+	guint32 n_codes;
+	guint32 sub_bits;
+
+	gboolean locked;
+	guint32 code;
+	guint64 prev_stamp;
+
+	/* time the current code was entered (0: unknown) and smoothed time
+	 * per code step (0: unknown), both in microseconds */
+	guint64 entered;
+	gdouble period;
+	gint32 direction;
+} AngleTracker;
+
+AngleTracker *angle_tracker_new(guint32 n_bits, guint32 sub_bits);
+void angle_tracker_free(AngleTracker *tracker);
+gboolean angle_tracker_update(AngleTracker *tracker, guint64 stamp,
+	gboolean valid, guint32 code, guint32 *angle);
+
+#endif
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "synth.h"
+#include "model.h"
+#include "scan.h"
+#include "gray.h"
+#include "v4l2.h"
+
+typedef struct {
+	guint32 width;
+	guint32 height;
+	guint32 n_bits;
+	guint32 n_vert_y;
+} BenchConfig;
+
+static const BenchConfig bench_configs[] = {
+	{  320, 240,  6,  64 },
+	{  640, 480,  6,  64 },
+	{  960, 720,  6,  64 },
+	{ 1280, 960,  6,  64 },
+	{  960, 720,  8,  64 },
+	{  960, 720, 10,  64 },
+	{  960, 720,  6, 256 },
+	{  960, 720, 10, 256 },
+	{ 0, 0, 0, 0 }
+};
+
+static gint opt_frames = 16;
+static gint opt_rounds = 4;
+
+static GOptionEntry bench_options[] = {
+	{ "frames", 'n', 0, G_OPTION_ARG_INT, &opt_frames,
+		"number of distinct synthetic frames per configuration", "N" },
+	{ "rounds", 'r', 0, G_OPTION_ARG_INT, &opt_rounds,
+		"number of passes over the frames per stage", "N" },
+	{ NULL }
+};
+
+/* ns/pixel is always relative to the full frame so stages add up */
+static void bench_report(const gchar *stage, gdouble seconds, guint32 n_frames,
+	guint64 n_pixels)
+{
+	printf("  %-10s %10.1f frames/s %9.2f ns/pixel\n", stage,
+		n_frames / MAX(seconds, 1e-9), seconds * 1e9 / n_pixels);
+}
+
+static void bench_run(const BenchConfig *config)
+{
+	SynthScene *scene;
+	Model *model;
+	GdkPixbuf **pixbufs, **copies;
+	GTimer *timer;
+	guint8 **frames;
+	guint32 *gv, n_angles, n_valid = 0;
+	guint64 n_pixels;
+	gdouble t_convert = 0, t_bits = 0, t_binarize = 0, t_angle = 0,
+		t_colors = 0, t_export;
+	gchar *filename;
+	gint32 i, r, fd;
+
+	printf("%dx%d, %d bits, %d rows\n", config->width, config->height,
+		config->n_bits, config->n_vert_y);
+
+	scene = synth_new(config->width, config->height, config->n_bits);
+	model = model_new(config->n_bits, 0, config->n_vert_y);
+	synth_set_regions(scene, model);
+	n_angles = (1 << config->n_bits);
+
+	frames = g_new0(guint8 *, opt_frames);
+	pixbufs = g_new0(GdkPixbuf *, opt_frames);
+	copies = g_new0(GdkPixbuf *, opt_frames);
+	gv = g_new0(guint32, opt_frames);
+	for(i = 0; i < opt_frames; i ++)
+		frames[i] = synth_render_yuyv(scene,
+			G_PI * 2.0 * (i + 0.5) / opt_frames);
+
+	timer = g_timer_new();
+	for(r = 0; r < opt_rounds; r ++) {
+		for(i = 0; i < opt_frames; i ++)
+			if(pixbufs[i])
+				gdk_pixbuf_unref(pixbufs[i]);
+
+		g_timer_start(timer);
+		for(i = 0; i < opt_frames; i ++)
+			pixbufs[i] = v4l2_convert_yuyv(frames[i], scene->width,
+				scene->height);
+		t_convert += g_timer_elapsed(timer, NULL);
+
+		g_timer_start(timer);
+		for(i = 0; i < opt_frames; i ++) {
+			scan_update_bits(model, pixbufs[i]);
+			gv[i] = model->valid_dir ?
+				gray_code_decode(model->code, model->bits) : n_angles;
+		}
+		t_bits += g_timer_elapsed(timer, NULL);
+
+		g_timer_start(timer);
+		for(i = 0; i < opt_frames; i ++)
+			if(gv[i] < n_angles)
+				scan_colors(model, pixbufs[i],
+					(gv[i] + n_angles * 3 / 4) % n_angles);
+		t_colors += g_timer_elapsed(timer, NULL);
+
+		/* binarization works in place, keep the converted frames */
+		for(i = 0; i < opt_frames; i ++) {
+			if(copies[i])
+				gdk_pixbuf_unref(copies[i]);
+			copies[i] = gdk_pixbuf_copy(pixbufs[i]);
+		}
+		g_timer_start(timer);
+		for(i = 0; i < opt_frames; i ++)
+			scan_binarize_object_region(model, copies[i]);
+		t_binarize += g_timer_elapsed(timer, NULL);
+
+		g_timer_start(timer);
+		for(i = 0; i < opt_frames; i ++)
+			if(gv[i] < n_angles)
+				scan_angle(model, copies[i], gv[i]);
+		t_angle += g_timer_elapsed(timer, NULL);
+	}
+
+	for(i = 0; i < opt_frames; i ++)
+		if(gv[i] < n_angles)
+			n_valid ++;
+
+	n_pixels = (guint64)scene->width * scene->height * opt_frames * opt_rounds;
+	bench_report("convert", t_convert, opt_frames * opt_rounds, n_pixels);
+	bench_report("bits", t_bits, opt_frames * opt_rounds, n_pixels);
+	bench_report("colors", t_colors, opt_frames * opt_rounds, n_pixels);
+	bench_report("binarize", t_binarize, opt_frames * opt_rounds, n_pixels);
+	bench_report("angle", t_angle, opt_frames * opt_rounds, n_pixels);
+
+	fd = g_file_open_tmp("3dscan-bench-XXXXXX.ac", &filename, NULL);
+	if(fd >= 0) {
+		close(fd);
+		g_timer_start(timer);
+		model_save(model, filename, NULL, NULL);
+		t_export = g_timer_elapsed(timer, NULL);
+		printf("  %-10s %10.2f ms %16.2f ns/vertex\n", "ac3d", t_export * 1e3,
+			t_export * 1e9 / (n_angles * config->n_vert_y));
+		g_unlink(filename);
+		g_free(filename);
+	}
+	printf("  %d/%d frames decoded\n", n_valid, opt_frames);
+
+	g_timer_destroy(timer);
+	for(i = 0; i < opt_frames; i ++) {
+		gdk_pixbuf_unref(copies[i]);
+		gdk_pixbuf_unref(pixbufs[i]);
+		g_free(frames[i]);
+	}
+	g_free(gv);
+	g_free(copies);
+	g_free(pixbufs);
+	g_free(frames);
+	model_cleanup(model);
+	synth_free(scene);
+}
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	gint32 i;
+
+	context = g_option_context_new("");
+	g_option_context_add_main_entries(context, bench_options, NULL);
+	if(!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(context);
+
+	if((opt_frames < 1) || (opt_rounds < 1)) {
+		g_printerr("frames and rounds must be positive\n");
+		return EXIT_FAILURE;
+	}
+
+	g_type_init();
+
+	for(i = 0; bench_configs[i].width != 0; i ++)
+		bench_run(&bench_configs[i]);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,239 @@
+#include <string.h>
+
+#include <glib.h>
+
+#include "camera.h"
+#include "export.h"
+#include "model.h"
+#include "scan.h"
+#include "v4l2.h"
+
+AngleHistory *angle_history_new(guint32 size)
+{
+	AngleHistory *history;
+
+	history = g_new0(AngleHistory, 1);
+	history->mutex = g_mutex_new();
+	history->cond = g_cond_new();
+	history->size = size;
+	history->stamps = g_new0(guint64, size);
+	history->angles = g_new0(guint32, size);
+	history->valid = g_new0(gboolean, size);
+	return history;
+}
+
+void angle_history_free(AngleHistory *history)
+{
+	g_free(history->valid);
+	g_free(history->angles);
+	g_free(history->stamps);
+	g_cond_free(history->cond);
+	g_mutex_free(history->mutex);
+	g_free(history);
+}
+
+void angle_history_push(AngleHistory *history, guint64 stamp, gboolean valid,
+	guint32 angle)
+{
+	g_mutex_lock(history->mutex);
+	history->stamps[history->head] = stamp;
+	history->angles[history->head] = angle;
+	history->valid[history->head] = valid;
+	history->head = (history->head + 1) % history->size;
+	if(history->count < history->size)
+		history->count ++;
+	g_cond_broadcast(history->cond);
+	g_mutex_unlock(history->mutex);
+}
+
+/* find the angle decoded closest to stamp, waiting a little for the angle
+ * camera to catch up if stamp is newer than anything seen so far */
+gboolean angle_history_lookup(AngleHistory *history, guint64 stamp,
+	guint64 tolerance, guint32 *angle)
+{
+	GTimeVal until;
+	guint64 delta, best_delta = (guint64)-1;
+	guint32 i, newest, best = 0;
+	gboolean found = FALSE;
+
+	g_get_current_time(&until);
+	g_time_val_add(&until, 200000);
+
+	g_mutex_lock(history->mutex);
+	while(TRUE) {
+		newest = (history->head + history->size - 1) % history->size;
+		if((history->count > 0) && (history->stamps[newest] >= stamp))
+			break;
+		if(!g_cond_timed_wait(history->cond, history->mutex, &until))
+			break;
+	}
+
+	for(i = 0; i < history->count; i ++) {
+		delta = (history->stamps[i] > stamp) ?
+			(history->stamps[i] - stamp) : (stamp - history->stamps[i]);
+		if(delta < best_delta) {
+			best_delta = delta;
+			best = i;
+		}
+	}
+	if((history->count > 0) && (best_delta <= tolerance) &&
+		history->valid[best]) {
+		*angle = history->angles[best];
+		found = TRUE;
+	}
+	g_mutex_unlock(history->mutex);
+
+	return found;
+}
+
+/*****************************************************************************/
+
+/* angles which have all their scans */
+static gint camera_converged(Model *model)
+{
+	guint32 i;
+	gint n = 0;
+
+	for(i = 0; i < model->n_angles; i ++)
+		if(model->angle_scans[i] >= model->max_scans)
+			n ++;
+	return n;
+}
+
+static gpointer camera_thread(gpointer data)
+{
+	Camera *camera = data;
+	Model *model = camera->model;
+	GdkPixbuf *pixbuf;
+	QualityVerdict verdict;
+	guint64 stamp;
+	guint32 gv, n_angles = model->n_angles;
+	gboolean scanned;
+
+	while(g_atomic_int_get(&(camera->running))) {
+		pixbuf = v4l2_get_frame(camera->v4l2, &stamp);
+		if(pixbuf == NULL) {
+			g_usleep(10000);
+			continue;
+		}
+		g_atomic_int_inc(&(camera->n_frames));
+
+		if(!angle_history_lookup(camera->history, stamp, camera->tolerance,
+			&gv) || (gv >= n_angles)) {
+			g_atomic_int_inc(&(camera->n_unmatched));
+			gdk_pixbuf_unref(pixbuf);
+			continue;
+		}
+
+		/* the same gate as the frames of the angle camera */
+		g_mutex_lock(camera->mutex);
+		verdict = scan_check_frame(model, pixbuf);
+		scanned = (verdict == QUALITY_OK) && scan_frame(model, pixbuf, gv);
+		if(scanned)
+			g_atomic_int_set(&(camera->n_converged),
+				camera_converged(model));
+		g_mutex_unlock(camera->mutex);
+		if(verdict != QUALITY_OK)
+			g_atomic_int_inc(&(camera->n_rejected[verdict]));
+		if(scanned)
+			g_atomic_int_inc(&(camera->n_scanned));
+		gdk_pixbuf_unref(pixbuf);
+	}
+	return NULL;
+}
+
+Camera *camera_start(Config *config, const gchar *section,
+	AngleHistory *history, gboolean resume)
+{
+	Camera *camera;
+	GError *error = NULL;
+
+	camera = g_new0(Camera, 1);
+	camera->section = g_strdup(section);
+	camera->history = history;
+	camera->tolerance = config_get_int(config, section, "stamp_tolerance",
+		20000);
+
+	camera->v4l2 = v4l2_init_section(config, section);
+	if(camera->v4l2 == NULL) {
+		g_free(camera->section);
+		g_free(camera);
+		return NULL;
+	}
+	/* "v4l2.1" keeps its regions in "regions.1.*" */
+	camera->model = model_init_named(config,
+		strchr(section, '.') ? (strchr(section, '.') + 1) : section, resume);
+	camera->mutex = g_mutex_new();
+	camera->n_converged = camera_converged(camera->model);
+
+	camera->running = 1;
+	camera->thread = g_thread_create(camera_thread, camera, TRUE, &error);
+	if(camera->thread == NULL) {
+		g_warning("%s: failed to start capture thread: %s", section,
+			error->message);
+		g_error_free(error);
+		g_mutex_free(camera->mutex);
+		model_cleanup(camera->model);
+		v4l2_cleanup(camera->v4l2);
+		g_free(camera->section);
+		g_free(camera);
+		return NULL;
+	}
+	return camera;
+}
+
+void camera_stop(Camera *camera)
+{
+	if(camera->thread == NULL)
+		return;
+	g_atomic_int_set(&(camera->running), 0);
+	g_thread_join(camera->thread);
+	camera->thread = NULL;
+
+	g_debug("%s: %d frames, %d without angle, %d scanned", camera->section,
+		camera->n_frames, camera->n_unmatched, camera->n_scanned);
+}
+
+void camera_free(Camera *camera)
+{
+	camera_stop(camera);
+	g_mutex_free(camera->mutex);
+	model_cleanup(camera->model);
+	v4l2_cleanup(camera->v4l2);
+	g_free(camera->section);
+	g_free(camera);
+}
+
+/* starts a new scan, the capture thread keeps running */
+void camera_clear(Camera *camera)
+{
+	g_mutex_lock(camera->mutex);
+	model_clear(camera->model);
+	g_atomic_int_set(&(camera->n_converged), 0);
+	g_mutex_unlock(camera->mutex);
+}
+
+/* export_start() snapshots the model, so the lock is only held for the copy */
+gboolean camera_export(Camera *camera, const gchar *filename,
+	ExportProgressFunc progress, ExportDoneFunc done, gpointer user_data)
+{
+	gboolean retval;
+
+	g_mutex_lock(camera->mutex);
+	retval = export_start(camera->model, filename, progress, done,
+		user_data);
+	g_mutex_unlock(camera->mutex);
+	return retval;
+}
+
+/* "scan.ac" becomes "scan.1.ac" for the model of camera "v4l2.1" */
+gchar *camera_filename(const gchar *filename, const gchar *name)
+{
+	const gchar *ext;
+
+	ext = strrchr(filename, '.');
+	if((ext == NULL) || strchr(ext, G_DIR_SEPARATOR))
+		return g_strdup_printf("%s.%s", filename, name);
+	return g_strdup_printf("%.*s.%s%s", (gint)(ext - filename), filename,
+		name, ext);
+}
@@ -0,0 +1,62 @@
+#ifndef _CAMERA_H
+#define _CAMERA_H
+
+#include <glib.h>
+
+#include "config.h"
+#include "export.h"
+#include "model.h"
+#include "v4l2.h"
+
+/* decoded angles of the camera which sees the gray code, by capture time */
+typedef struct {
+	GMutex *mutex;
+	GCond *cond;
+	guint32 size;
+	guint32 head;
+	guint32 count;
+	guint64 *stamps;
+	guint32 *angles;
+	gboolean *valid;
+} AngleHistory;
+
+/* an additional camera, captured and scanned on its own thread */
+typedef struct {
+	gchar *section;
+	V4l2Data *v4l2;
+	Model *model;
+	AngleHistory *history;
+	guint64 tolerance;
+
+	GThread *thread;
+	volatile gint running;
+	/* held by the capture thread while it scans into the model, other
+	 * threads take it before touching the model while it runs */
+	GMutex *mutex;
+
+	/* progress for other threads, read with g_atomic_int_get() */
+	volatile gint n_frames;
+	volatile gint n_unmatched;
+	volatile gint n_scanned;
+	volatile gint n_converged;
+	/* frames failing the model's [quality] gate, by verdict */
+	volatile gint n_rejected[NUM_QUALITY_VERDICTS];
+} Camera;
+
+AngleHistory *angle_history_new(guint32 size);
+void angle_history_free(AngleHistory *history);
+void angle_history_push(AngleHistory *history, guint64 stamp, gboolean valid,
+	guint32 angle);
+gboolean angle_history_lookup(AngleHistory *history, guint64 stamp,
+	guint64 tolerance, guint32 *angle);
+
+Camera *camera_start(Config *config, const gchar *section,
+	AngleHistory *history, gboolean resume);
+void camera_stop(Camera *camera);
+void camera_free(Camera *camera);
+void camera_clear(Camera *camera);
+gboolean camera_export(Camera *camera, const gchar *filename,
+	ExportProgressFunc progress, ExportDoneFunc done, gpointer user_data);
+gchar *camera_filename(const gchar *filename, const gchar *name);
+
+#endif
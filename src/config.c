@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include <glib.h>
 #include <glib/gstdio.h>
 
@@ -81,3 +83,19 @@ gboolean config_set_string(Config *config, const gchar *section,
 	return TRUE;
 }
 
+
+/* names of all sections starting with prefix, sorted */
+GSList *config_get_sections(Config *config, const gchar *prefix)
+{
+	GSList *list = NULL;
+	gchar **groups;
+	gint32 i;
+
+	groups = g_key_file_get_groups(config->keyfile, NULL);
+	for(i = 0; groups[i] != NULL; i ++)
+		if(g_str_has_prefix(groups[i], prefix))
+			list = g_slist_insert_sorted(list, g_strdup(groups[i]),
+				(GCompareFunc)strcmp);
+	g_strfreev(groups);
+	return list;
+}
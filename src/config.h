@@ -17,5 +17,6 @@ gchar *config_get_string(Config *config, const gchar *section,
 	const gchar *option, const gchar *defval);
 gboolean config_set_string(Config *config, const gchar *section,
 	const gchar *option, const gchar *value);
+GSList *config_get_sections(Config *config, const gchar *prefix);
 
 #endif
@@ -0,0 +1,123 @@
+#include <glib.h>
+
+#include "export.h"
+#include "model.h"
+
+typedef struct {
+	Model *snapshot;
+	gchar *filename;
+	gboolean success;
+	volatile gint percent;
+	GThread *thread;
+
+	ExportProgressFunc progress;
+	ExportDoneFunc done;
+	gpointer user_data;
+} Export;
+
+/* exports whose done callback has not run yet, only touched from the main
+ * loop */
+static GSList *export_running = NULL;
+
+static void export_free(Export *export)
+{
+	export_running = g_slist_remove(export_running, export);
+	g_free(export->filename);
+	g_free(export);
+}
+
+/* these run in the main loop, all idles of an export have it as data */
+
+static gboolean export_progress_idle(gpointer data)
+{
+	Export *export = data;
+
+	export->progress(g_atomic_int_get(&(export->percent)) / 100.0,
+		export->user_data);
+	return FALSE;
+}
+
+static gboolean export_done_idle(gpointer data)
+{
+	Export *export = data;
+
+	/* the thread has nothing left to do but return */
+	g_thread_join(export->thread);
+	if(export->done)
+		export->done(export->filename, export->success, export->user_data);
+	export_free(export);
+	return FALSE;
+}
+
+/* these run in the export thread */
+
+static void export_progress_cb(gfloat fraction, gpointer user_data)
+{
+	Export *export = user_data;
+	gint32 percent = fraction * 100;
+
+	/* don't flood the main loop */
+	if((export->progress == NULL) ||
+		(percent <= g_atomic_int_get(&(export->percent))))
+		return;
+	g_atomic_int_set(&(export->percent), percent);
+	g_idle_add(export_progress_idle, export);
+}
+
+static gpointer export_thread(gpointer data)
+{
+	Export *export = data;
+
+	export->success = model_save(export->snapshot, export->filename,
+		export_progress_cb, export);
+	model_cleanup(export->snapshot);
+
+	/* queued after all progress updates, so it also runs after them */
+	g_idle_add(export_done_idle, export);
+	return NULL;
+}
+
+gboolean export_start(Model *model, const gchar *filename,
+	ExportProgressFunc progress, ExportDoneFunc done, gpointer user_data)
+{
+	Export *export;
+	GError *error = NULL;
+
+	export = g_new0(Export, 1);
+	export->snapshot = model_snapshot(model);
+	export->filename = g_strdup(filename);
+	export->percent = -1;
+	export->progress = progress;
+	export->done = done;
+	export->user_data = user_data;
+
+	export->thread = g_thread_create(export_thread, export, TRUE, &error);
+	if(export->thread == NULL) {
+		g_warning("failed to start export thread: %s", error->message);
+		g_error_free(error);
+		model_cleanup(export->snapshot);
+		g_free(export->filename);
+		g_free(export);
+		return FALSE;
+	}
+	export_running = g_slist_prepend(export_running, export);
+	return TRUE;
+}
+
+/* waits for all running exports before their user data goes away, their
+ * pending callbacks are dropped */
+void export_finish(void)
+{
+	Export *export;
+
+	while(export_running != NULL) {
+		export = export_running->data;
+		g_message("waiting for %s to be written", export->filename);
+		g_thread_join(export->thread);
+		while(g_idle_remove_by_data(export))
+			;
+		if(!export->success)
+			g_warning("failed to save model to %s", export->filename);
+		export_free(export);
+	}
+}
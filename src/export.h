@@ -0,0 +1,16 @@
+#ifndef _EXPORT_H
+#define _EXPORT_H
+
+#include <glib.h>
+
+#include "model.h"
+
+typedef void (*ExportProgressFunc)(gfloat fraction, gpointer user_data);
+typedef void (*ExportDoneFunc)(const gchar *filename, gboolean success,
+	gpointer user_data);
+
+gboolean export_start(Model *model, const gchar *filename,
+	ExportProgressFunc progress, ExportDoneFunc done, gpointer user_data);
+void export_finish(void);
+
+#endif
@@ -0,0 +1,267 @@
+#include <math.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "filter.h"
+#include "model.h"
+
+static gfloat filter_median(gfloat *values, guint32 n)
+{
+	gfloat v;
+	gint32 i, j;
+
+	/* a few values only, insertion sort */
+	for(i = 1; i < n; i ++) {
+		v = values[i];
+		for(j = i - 1; (j >= 0) && (values[j] > v); j --)
+			values[j + 1] = values[j];
+		values[j + 1] = v;
+	}
+	return (n & 1) ? values[n / 2] :
+		(values[n / 2 - 1] + values[n / 2]) / 2.0;
+}
+
+/* a radius further from the median of its neighbourhood than
+ * model->filter_outlier pixels and three standard deviations (estimated
+ * from the median absolute deviation) is a bad frame */
+static gboolean filter_outlier(Model *model, gfloat *row, gboolean *valid,
+	guint32 i)
+{
+	gfloat values[FILTER_MAX_WINDOW * 2 + 1], med, mad;
+	guint32 n = 0, k;
+	gint32 d, w = model->filter_window;
+
+	for(d = -w; d <= w; d ++) {
+		k = (i + model->n_angles + d) % model->n_angles;
+		if(valid[k])
+			values[n ++] = row[k];
+	}
+	if(n < 3)
+		return FALSE;
+
+	med = filter_median(values, n);
+	for(k = 0; k < n; k ++)
+		values[k] = fabs(values[k] - med);
+	mad = filter_median(values, n);
+	return (fabs(row[i] - med) >
+		MAX(model->filter_outlier, 3 * 1.4826 * mad));
+}
+
+/* kept state of angle i in the current row (-1 while not known yet):
+ * scanned and not an outlier */
+static gboolean filter_kept(Model *model, gfloat *row, gboolean *valid,
+	gint8 *kept, guint32 i)
+{
+	if(kept[i] < 0)
+		kept[i] = valid[i] && !((model->filter_window > 0) &&
+			(row[i] > 0.0) && filter_outlier(model, row, valid, i));
+	return kept[i];
+}
+
+/* filtered radius and confidence of angle i in row j from the nearest
+ * kept angles prev and next (-1 without any kept angle in the row) */
+static void filter_cell(Model *model, gfloat *row, gint8 *kept, guint32 i,
+	guint32 j, gint32 prev, gint32 next, gfloat *verts, guint8 *confidence)
+{
+	guint32 n_angles = model->n_angles, k = i * model->n_vert_y + j, dp, dn;
+	gfloat rp, rn;
+
+	if(kept[i]) {
+		verts[k] = row[i];
+		if(confidence)
+			confidence[k] = FILTER_MEASURED + (255 - FILTER_MEASURED) *
+				MIN(model->angle_scans[i], model->max_scans) /
+				model->max_scans;
+		return;
+	}
+	if((prev < 0) || (next < 0)) {
+		verts[k] = 0.0;
+		if(confidence)
+			confidence[k] = 0;
+		return;
+	}
+
+	dp = (i + n_angles - prev) % n_angles;
+	dn = (next + n_angles - i) % n_angles;
+	rp = row[prev];
+	rn = row[next];
+	/* never blend with angles which have no silhouette here */
+	if((rp == 0.0) || (rn == 0.0))
+		verts[k] = (dp <= dn) ? rp : rn;
+	else
+		verts[k] = (rp * dn + rn * dp) / (dp + dn);
+	if(confidence)
+		confidence[k] = 127 / MIN(dp, dn);
+}
+
+/* row j of the model with all kept states unknown */
+static void filter_row_load(Model *model, guint32 j, gfloat *row,
+	gboolean *valid, gint8 *kept)
+{
+	guint32 i;
+
+	/* a scanned angle with 0 has no silhouette in the row */
+	for(i = 0; i < model->n_angles; i ++) {
+		valid[i] = (model->angle_scans[i] > 0);
+		row[i] = valid[i] ? model_get_radius(model, i, j) : 0.0;
+		kept[i] = -1;
+	}
+}
+
+/* cells first .. first + n - 1 of row j around the ring; prev and next
+ * hold n entries. the first and the last cell must be kept unless the
+ * span is the whole ring */
+static void filter_span(Model *model, gfloat *row, gboolean *valid,
+	gint8 *kept, guint32 j, guint32 first, guint32 n, gint32 *prev,
+	gint32 *next, gfloat *verts, guint8 *confidence)
+{
+	guint32 n_angles = model->n_angles, i, k;
+	gint32 last;
+
+	/* the whole ring wraps around for the nearest kept angle */
+	last = -1;
+	if(n >= n_angles)
+		for(k = 0; k < n_angles; k ++)
+			if(filter_kept(model, row, valid, kept, k))
+				last = k;
+	for(k = 0; k < n; k ++) {
+		i = (first + k) % n_angles;
+		if(filter_kept(model, row, valid, kept, i))
+			last = i;
+		prev[k] = last;
+	}
+	if(n >= n_angles) {
+		last = -1;
+		for(k = n_angles; k > 0; k --)
+			if(kept[k - 1])
+				last = k - 1;
+	}
+	for(k = n; k > 0; k --) {
+		i = (first + k - 1) % n_angles;
+		if(kept[i])
+			last = i;
+		next[k - 1] = last;
+	}
+
+	for(k = 0; k < n; k ++)
+		filter_cell(model, row, kept, (first + k) % n_angles, j,
+			prev[k], next[k], verts, confidence);
+}
+
+/* radii of all angles with scan gaps and outliers interpolated
+ * periodically from the nearest kept angles, as the exporters and the
+ * preview want them (index: angle * n_vert_y + row); a row without any
+ * measured angle stays 0. confidence (may be NULL) is 0 without data,
+ * 127 / distance to the nearest kept angle for interpolated cells and from
+ * FILTER_MEASURED up to 255 with the scan count for measured ones */
+void filter_radii(Model *model, gfloat *verts, guint8 *confidence)
+{
+	gfloat *row;
+	gboolean *valid;
+	gint8 *kept;
+	gint32 *prev, *next;
+	guint32 n_angles = model->n_angles, j;
+
+	row = g_new(gfloat, n_angles);
+	valid = g_new(gboolean, n_angles);
+	kept = g_new(gint8, n_angles);
+	prev = g_new(gint32, n_angles);
+	next = g_new(gint32, n_angles);
+
+	for(j = 0; j < model->n_vert_y; j ++) {
+		filter_row_load(model, j, row, valid, kept);
+		filter_span(model, row, valid, kept, j, 0, n_angles, prev, next,
+			verts, confidence);
+	}
+
+	g_free(next);
+	g_free(prev);
+	g_free(kept);
+	g_free(valid);
+	g_free(row);
+}
+
+/* filter_radii() for the rows of the angles set in dirty only, with verts
+ * and confidence still holding the filtered model from before those
+ * angles changed. a changed angle moves the outlier test within the
+ * filter window around it and the interpolation up to the nearest kept
+ * angles beyond that, so only this span is filtered again in each row.
+ * on return dirty is set for every angle whose cells were rewritten */
+void filter_radii_dirty(Model *model, gfloat *verts, guint8 *confidence,
+	guint8 *dirty)
+{
+	gfloat *row;
+	gboolean *valid, *near;
+	gint8 *kept;
+	gint32 *prev, *next, w = model->filter_window, d;
+	guint32 n_angles = model->n_angles, i, j, k, a, n, back, ahead, s;
+
+	near = g_new0(gboolean, n_angles);
+	n = 0;
+	for(i = 0; i < n_angles; i ++)
+		if(dirty[i])
+			for(d = -w; d <= w; d ++) {
+				k = (i + n_angles * 2 + d) % n_angles;
+				if(!near[k])
+					n ++;
+				near[k] = TRUE;
+			}
+	if(n == 0) {
+		g_free(near);
+		return;
+	}
+	if(n == n_angles) {
+		g_free(near);
+		filter_radii(model, verts, confidence);
+		memset(dirty, 1, n_angles);
+		return;
+	}
+
+	row = g_new(gfloat, n_angles);
+	valid = g_new(gboolean, n_angles);
+	kept = g_new(gint8, n_angles);
+	prev = g_new(gint32, n_angles + 1);
+	next = g_new(gint32, n_angles + 1);
+
+	/* runs of near angles start after an angle which is not */
+	for(s = 0; near[s]; s ++);
+	for(j = 0; j < model->n_vert_y; j ++) {
+		filter_row_load(model, j, row, valid, kept);
+		for(k = 1; k <= n_angles; k ++) {
+			a = (s + k) % n_angles;
+			if(!near[a] || near[(a + n_angles - 1) % n_angles])
+				continue;
+			for(n = 0; near[(a + n) % n_angles]; n ++);
+
+			/* out to the nearest kept angles on either side */
+			for(back = 1; back <= n_angles - n; back ++)
+				if(filter_kept(model, row, valid, kept,
+					(a + n_angles - back) % n_angles))
+					break;
+			if(back > n_angles - n) {
+				/* nothing kept outside the run, the whole row changes */
+				filter_span(model, row, valid, kept, j, 0, n_angles,
+					prev, next, verts, confidence);
+				memset(dirty, 1, n_angles);
+				break;
+			}
+			for(ahead = 1; !filter_kept(model, row, valid, kept,
+				(a + n - 1 + ahead) % n_angles); ahead ++);
+
+			n = MIN(back + n + ahead, n_angles + 1);
+			a = (a + n_angles - back) % n_angles;
+			filter_span(model, row, valid, kept, j, a, n, prev, next,
+				verts, confidence);
+			for(i = 0; i < n; i ++)
+				dirty[(a + i) % n_angles] = 1;
+		}
+	}
+
+	g_free(next);
+	g_free(prev);
+	g_free(kept);
+	g_free(valid);
+	g_free(row);
+	g_free(near);
+}
@@ -0,0 +1,17 @@
+#ifndef _FILTER_H
+#define _FILTER_H
+
+#include <glib.h>
+
+#include "model.h"
+
+/* widest median window, in angles on each side */
+#define FILTER_MAX_WINDOW 8
+/* confidence of measured cells starts here, see filter_radii() */
+#define FILTER_MEASURED 128
+
+void filter_radii(Model *model, gfloat *verts, guint8 *confidence);
+void filter_radii_dirty(Model *model, gfloat *verts, guint8 *confidence,
+	guint8 *dirty);
+
+#endif
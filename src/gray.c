@@ -1,5 +1,15 @@
+#include <string.h>
+
 #include <glib.h>
 
+#include "gray.h"
+#include "region.h"
+
+static const gchar *gray_code_names[NUM_GRAY_CODES] = {
+	"reflected",
+	"debruijn"
+};
+
 guint32 gray_decode(guint8 *bits, guint32 n_bits)
 {
 	guint32 gray = 0, sh = 1, div, ans;
@@ -22,3 +32,177 @@ guint32 gray_decode(guint8 *bits, guint32 n_bits)
 	}
 }
 
+/*****************************************************************************/
+
+typedef struct {
+	guint32 n;
+	guint8 *a;
+	guint8 *track;
+	guint32 len;
+} GrayDeBruijn;
+
+/* Fredricksen-Kessler-Maiorana: concatenated Lyndon words of length
+ * dividing n in lexicographic order, the same as misc/gray.pl */
+static void gray_debruijn(GrayDeBruijn *db, guint32 t, guint32 p)
+{
+	if(t > db->n) {
+		if((db->n % p) == 0) {
+			memcpy(db->track + db->len, db->a + 1, p);
+			db->len += p;
+		}
+		return;
+	}
+	db->a[t] = db->a[t - p];
+	gray_debruijn(db, t + 1, p);
+	if(db->a[t - p] == 0) {
+		db->a[t] = 1;
+		gray_debruijn(db, t + 1, t);
+	}
+}
+
+GrayCode *gray_code_new(GrayCodeType type, guint32 n_bits)
+{
+	GrayCode *code;
+	GrayDeBruijn db;
+	guint32 i, k, w;
+
+	g_return_val_if_fail((n_bits > 0) && (n_bits < 32), NULL);
+
+	if((type == GRAY_CODE_DEBRUIJN) && (n_bits > GRAY_DEBRUIJN_MAX_BITS)) {
+		g_warning("%d bits are too many for a single track, using %s",
+			n_bits, gray_code_names[GRAY_CODE_REFLECTED]);
+		type = GRAY_CODE_REFLECTED;
+	}
+
+	code = g_new0(GrayCode, 1);
+	code->type = type;
+	code->n_bits = n_bits;
+	code->n_codes = (1 << n_bits);
+	if(type != GRAY_CODE_DEBRUIJN)
+		return code;
+
+	db.n = n_bits;
+	db.a = g_new0(guint8, n_bits + 1);
+	db.track = code->track = g_new0(guint8, code->n_codes);
+	db.len = 0;
+	gray_debruijn(&db, 1, 1);
+	g_free(db.a);
+
+	/* every window occurs exactly once around the ring */
+	code->steps = g_new0(guint32, code->n_codes);
+	for(i = 0; i < code->n_codes; i ++) {
+		w = 0;
+		for(k = 0; k < n_bits; k ++)
+			w = (w << 1) | code->track[(i + k) % code->n_codes];
+		code->steps[w] = i;
+	}
+	return code;
+}
+
+void gray_code_free(GrayCode *code)
+{
+	g_free(code->track);
+	g_free(code->steps);
+	g_free(code);
+}
+
+/* unknown names fall back to the reflected code */
+GrayCodeType gray_code_parse(const gchar *name)
+{
+	gint32 i;
+
+	for(i = 0; i < NUM_GRAY_CODES; i ++)
+		if(strcmp(name, gray_code_names[i]) == 0)
+			return i;
+	g_warning("unknown angle code '%s', using %s", name,
+		gray_code_names[GRAY_CODE_REFLECTED]);
+	return GRAY_CODE_REFLECTED;
+}
+
+const gchar *gray_code_name(GrayCodeType type)
+{
+	g_return_val_if_fail(type < NUM_GRAY_CODES, NULL);
+	return gray_code_names[type];
+}
+
+/*****************************************************************************/
+
+/* every cell has to keep the neighbours of its center point inside */
+gboolean gray_code_fits(GrayCode *code, GdkRectangle *rect)
+{
+	if(code->type == GRAY_CODE_DEBRUIJN)
+		return (rect->width >= code->n_bits * 3) && (rect->height >= 3);
+	return (rect->width >= 1) && (rect->height >= code->n_bits * 3);
+}
+
+/* center of the cell read for bits[bit]; the top row of the reflected
+ * code is the most significant bit */
+void gray_code_point(GrayCode *code, GdkRectangle *rect, guint32 bit,
+	guint32 *x, guint32 *y)
+{
+	gfloat s;
+	guint32 i;
+
+	if(code->type == GRAY_CODE_DEBRUIJN) {
+		s = (gfloat)rect->width / code->n_bits;
+		*x = rect->x + bit * s + s / 2;
+		*y = rect->y + rect->height / 2;
+		return;
+	}
+	s = (gfloat)rect->height / code->n_bits;
+	i = code->n_bits - bit - 1;
+	*x = rect->x + rect->width / 2;
+	*y = rect->y + i * s + s / 2;
+}
+
+void gray_code_cell(GrayCode *code, GdkRectangle *rect, guint32 bit,
+	GdkRectangle *cell)
+{
+	gfloat s;
+
+	*cell = *rect;
+	if(code->type == GRAY_CODE_DEBRUIJN) {
+		s = (gfloat)rect->width / code->n_bits;
+		cell->x = rect->x + bit * s;
+		cell->width = s;
+		return;
+	}
+	s = (gfloat)rect->height / code->n_bits;
+	cell->y = rect->y + (code->n_bits - bit - 1) * s;
+	cell->height = s;
+}
+
+/* distance left and right of a point which has to read the same; the
+ * single track changes several cells per step, which the points do not
+ * pass at exactly the same time, so reads close to a cell edge are
+ * dropped (0: no check, the reflected code changes one bit per step) */
+guint32 gray_code_guard(GrayCode *code, GdkRectangle *rect)
+{
+	if(code->type != GRAY_CODE_DEBRUIJN)
+		return 0;
+	return rect->width / (code->n_bits * 8);
+}
+
+/* code step under the center of the strip region; bits[] as read at
+ * gray_code_point() */
+guint32 gray_code_decode(GrayCode *code, guint8 *bits)
+{
+	guint32 k, w = 0;
+
+	if(code->type != GRAY_CODE_DEBRUIJN)
+		return gray_decode(bits, code->n_bits);
+
+	for(k = 0; k < code->n_bits; k ++)
+		w = (w << 1) | (bits[k] ? 1 : 0);
+	return (code->steps[w] + code->n_bits / 2) % code->n_codes;
+}
+
+/* TRUE if the printed cell of a code step is black; bit is the row of
+ * the reflected code and ignored for the single track */
+gboolean gray_code_black(GrayCode *code, guint32 step, guint32 bit)
+{
+	step %= code->n_codes;
+	if(code->type == GRAY_CODE_DEBRUIJN)
+		return code->track[step] ? TRUE : FALSE;
+	return ((step ^ (step >> 1)) & (1 << bit)) ? TRUE : FALSE;
+}
@@ -3,6 +3,46 @@
 
 #include <glib.h>
 
+#include "region.h"
+
+/* longest single track, its window table takes 4 bytes per code step */
+#define GRAY_DEBRUIJN_MAX_BITS 20
+
+/* how the code steps are printed on the ring strip (see misc/gray.pl) */
+typedef enum {
+	/* reflected binary gray code: n_bits rows, read in one column */
+	GRAY_CODE_REFLECTED,
+	/* binary De Bruijn sequence: a single track, read at n_bits
+	 * neighbouring cells of one row, the cells running left to right in
+	 * the image as the code steps grow */
+	GRAY_CODE_DEBRUIJN,
+	NUM_GRAY_CODES
+} GrayCodeType;
+
+typedef struct {
+	GrayCodeType type;
+	guint32 n_bits;
+	guint32 n_codes;
+	/* De Bruijn only: the track, one cell per code step, and the step of
+	 * the leftmost cell for each window of n_bits cells */
+	guint8 *track;
+	guint32 *steps;
+} GrayCode;
+
 guint32 gray_decode(guint8 *bits, guint32 n_bits);
 
+GrayCode *gray_code_new(GrayCodeType type, guint32 n_bits);
+void gray_code_free(GrayCode *code);
+GrayCodeType gray_code_parse(const gchar *name);
+const gchar *gray_code_name(GrayCodeType type);
+
+gboolean gray_code_fits(GrayCode *code, GdkRectangle *rect);
+void gray_code_point(GrayCode *code, GdkRectangle *rect, guint32 bit,
+	guint32 *x, guint32 *y);
+void gray_code_cell(GrayCode *code, GdkRectangle *rect, guint32 bit,
+	GdkRectangle *cell);
+guint32 gray_code_guard(GrayCode *code, GdkRectangle *rect);
+guint32 gray_code_decode(GrayCode *code, guint8 *bits);
+gboolean gray_code_black(GrayCode *code, guint32 step, guint32 bit);
+
 #endif
@@ -1,28 +1,80 @@
+#include <math.h>
+#include <string.h>
+
 #include <gtk/gtk.h>
 
 #include "gui.h"
 #include "region.h"
+#include "preview.h"
+#include "export.h"
+#include "camera.h"
+
+/* a selection narrower or lower than this (image pixels) is a stray click,
+ * not a region */
+#define GUI_MIN_SELECTION 4
 
 struct _GuiData {
 	Config *config;
 	Model *model;
 	GtkWindow *window;
 	GtkWidget *image;
+	GtkWidget *preview_area;
+	Preview *preview;
+	gdouble drag_x;
+	gdouble drag_y;
 	GtkWidget *l_angle;
-	GtkWidget **angle_pbars;
+	GtkWidget *coverage;
+	guint8 *coverage_rgb;
+	gsize coverage_size;
+	gboolean coverage_pending;
+	GtkWidget *export_pbar;
+	GtkToolItem *btn_save;
+	/* exports of one save which have not reported back yet */
+	guint32 n_exports;
 	RegionType region_selector;
+	gdouble select_x;
+	gdouble select_y;
+
+	/* camera image, repainted from a timer at the preview rate */
+	GdkPixbuf *frame;
+	GdkPixbuf *display;
+	gfloat scale;
+	gboolean frame_pending;
+	guint32 n_refresh;
+	guint32 refresh_rate;
+	guint refresh_id;
+	guint32 n_ticks;
+
+	/* the additional cameras (Camera *), scanning on their own threads */
+	GSList *cameras;
+	GtkWidget *l_cameras;
 };
 
 static gboolean gui_image_btn_press_cb(GtkWidget *widget, GdkEventButton *eb,
 	gpointer user_data);
 static gboolean gui_image_btn_release_cb(GtkWidget *widget, GdkEventButton *eb,
 	gpointer user_data);
+static gboolean gui_preview_expose_cb(GtkWidget *widget, GdkEventExpose *ee,
+	gpointer user_data);
+static gboolean gui_preview_btn_press_cb(GtkWidget *widget, GdkEventButton *eb,
+	gpointer user_data);
+static gboolean gui_preview_motion_cb(GtkWidget *widget, GdkEventMotion *em,
+	gpointer user_data);
+static gboolean gui_image_expose_cb(GtkWidget *widget, GdkEventExpose *ee,
+	gpointer user_data);
+static gboolean gui_refresh_cb(gpointer user_data);
+static gboolean gui_coverage_expose_cb(GtkWidget *widget, GdkEventExpose *ee,
+	gpointer user_data);
 static gboolean gui_region_toggled_cb(GtkToggleToolButton *toggle_tool_button,
 	gpointer user_data);
 
 static gboolean gui_btn_new_cb(GtkToolButton *toolbutton, gpointer user_data);
 static gboolean gui_btn_save_cb(GtkToolButton *toolbutton, gpointer user_data);
-static gboolean gui_btn_view_cb(GtkToolButton *toolbutton, gpointer user_data);
+static gboolean gui_btn_view_cb(GtkToggleToolButton *toggle_tool_button,
+	gpointer user_data);
+static void gui_export_progress_cb(gfloat fraction, gpointer user_data);
+static void gui_export_done_cb(const gchar *filename, gboolean success,
+	gpointer user_data);
 
 static void gui_create_toolbar(GuiData *gui, GtkBox *box);
 static void gui_create_angle_view(GuiData *gui, GtkBox *box);
@@ -31,13 +83,18 @@ GuiData *gui_init(Config *config, Model *model)
 {
 	GuiData *data;
 	GtkWidget *vbox, *hbox;
+	guint32 ps;
 
 	data = g_new0(GuiData, 1);
 	data->config = config;
 	data->model = model;
 	data->region_selector = REGION_OBJECT;
+	data->scale = 1.0;
 
 	data->window = GTK_WINDOW(gtk_window_new(GTK_WINDOW_TOPLEVEL));
+	gtk_window_set_default_size(data->window,
+		config_get_int(config, "gui", "window_width", 1300),
+		config_get_int(config, "gui", "window_height", 820));
 
 	vbox = gtk_vbox_new(FALSE, 0);
 	gtk_container_add(GTK_CONTAINER(data->window), vbox);
@@ -48,15 +105,38 @@ GuiData *gui_init(Config *config, Model *model)
 	gtk_box_pack_start(GTK_BOX(vbox), hbox, TRUE, TRUE, 0);
 
 	data->image = gtk_drawing_area_new();
+	gtk_widget_set_size_request(data->image, 320, 240);
 	gtk_box_pack_start(GTK_BOX(hbox), data->image, TRUE, TRUE, 0);
+	g_signal_connect(G_OBJECT(data->image), "expose-event",
+		G_CALLBACK(gui_image_expose_cb), data);
 	g_signal_connect(G_OBJECT(data->image), "button-press-event",
 		G_CALLBACK(gui_image_btn_press_cb), data);
 	g_signal_connect(G_OBJECT(data->image), "button-release-event",
 		G_CALLBACK(gui_image_btn_release_cb), data);
 	gtk_widget_add_events(data->image,
 		GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK);
+
+	ps = config_get_int(config, "gui", "preview_size", 320);
+	data->preview = preview_new(ps, ps);
+	data->preview_area = gtk_drawing_area_new();
+	gtk_widget_set_size_request(data->preview_area, ps, ps);
+	gtk_box_pack_start(GTK_BOX(hbox), data->preview_area, FALSE, FALSE, 0);
+	g_signal_connect(G_OBJECT(data->preview_area), "expose-event",
+		G_CALLBACK(gui_preview_expose_cb), data);
+	g_signal_connect(G_OBJECT(data->preview_area), "button-press-event",
+		G_CALLBACK(gui_preview_btn_press_cb), data);
+	g_signal_connect(G_OBJECT(data->preview_area), "motion-notify-event",
+		G_CALLBACK(gui_preview_motion_cb), data);
+	gtk_widget_add_events(data->preview_area,
+		GDK_BUTTON_PRESS_MASK | GDK_BUTTON1_MOTION_MASK);
+
 	gui_create_angle_view(data, GTK_BOX(vbox));
 
+	data->refresh_rate = MAX(1,
+		config_get_int(config, "gui", "refresh_rate", 15));
+	data->refresh_id = g_timeout_add(1000 / data->refresh_rate,
+		gui_refresh_cb, data);
+
 	return data;
 }
 
@@ -79,6 +159,7 @@ static void gui_create_toolbar(GuiData *gui, GtkBox *box)
 		G_CALLBACK(gui_btn_new_cb), gui);
 
 	titem = gtk_tool_button_new_from_stock("gtk-save");
+	gui->btn_save = titem;
 	gtk_toolbar_insert(GTK_TOOLBAR(tbar), titem, -1);
 	g_signal_connect(G_OBJECT(titem), "clicked",
 		G_CALLBACK(gui_btn_save_cb), gui);
@@ -86,10 +167,11 @@ static void gui_create_toolbar(GuiData *gui, GtkBox *box)
 	titem = gtk_separator_tool_item_new();
 	gtk_toolbar_insert(GTK_TOOLBAR(tbar), titem, -1);
 
-	titem = gtk_tool_button_new_from_stock("gtk-zoom-fit");
+	titem = gtk_toggle_tool_button_new_from_stock("gtk-zoom-fit");
 	gtk_tool_item_set_tooltip_text(titem, "preview model");
+	gtk_toggle_tool_button_set_active(GTK_TOGGLE_TOOL_BUTTON(titem), TRUE);
 	gtk_toolbar_insert(GTK_TOOLBAR(tbar), titem, -1);
-	g_signal_connect(G_OBJECT(titem), "clicked",
+	g_signal_connect(G_OBJECT(titem), "toggled",
 		G_CALLBACK(gui_btn_view_cb), gui);
 
 	titem = gtk_separator_tool_item_new();
@@ -117,51 +199,42 @@ static void gui_create_toolbar(GuiData *gui, GtkBox *box)
 
 static void gui_create_angle_view(GuiData *gui, GtkBox *box)
 {
-	GtkWidget *abox, *label;
-	gchar *s;
-	gint32 i;
-	guint32 n, h, w;
+	GtkWidget *abox;
 
 	abox = gtk_hbox_new(FALSE, 0);
 	gtk_box_pack_start(box, abox, FALSE, FALSE, 0);
-	n = (1 << config_get_int(gui->config, "base", "n_bits", 0));
-	h = config_get_int(gui->config, "gui", "angle_bar_height", 32);
-	w = config_get_int(gui->config, "gui", "angle_bar_width", 8);
-	gui->angle_pbars = g_new0(GtkWidget *, n);
-	for(i = 0; i < n; i ++) {
-		if((i % (n / 4)) == 0) {
-			s = g_strdup_printf(" %.2f°: ", (gdouble)i * 360 / n);
-			label = gtk_label_new(s);
-			g_free(s);
-			gtk_box_pack_start(GTK_BOX(abox), label, FALSE, TRUE, 0);
-		}
-		gui->angle_pbars[i] = gtk_progress_bar_new();
-		gtk_progress_bar_set_orientation(
-			GTK_PROGRESS_BAR(gui->angle_pbars[i]),
-			GTK_PROGRESS_BOTTOM_TO_TOP);
-		gtk_widget_set_size_request(gui->angle_pbars[i], w, h);
-		gtk_box_pack_start(GTK_BOX(abox), gui->angle_pbars[i],
-			FALSE, TRUE, 0);
-	}
+	/* scan counts of the additional cameras, whose models are not shown */
+	gui->l_cameras = gtk_label_new("");
+	gtk_widget_set_no_show_all(gui->l_cameras, TRUE);
+	gtk_box_pack_end(box, gui->l_cameras, FALSE, FALSE, 0);
+	/* one strip for all angles, painted from the scan counts of the model
+	 * (so a resumed session shows up right away) */
+	gui->coverage = gtk_drawing_area_new();
+	gtk_widget_set_size_request(gui->coverage, 256,
+		config_get_int(gui->config, "gui", "angle_bar_height", 32));
+	gtk_box_pack_start(GTK_BOX(abox), gui->coverage, TRUE, TRUE, 0);
+	g_signal_connect(G_OBJECT(gui->coverage), "expose-event",
+		G_CALLBACK(gui_coverage_expose_cb), gui);
 	gui->l_angle = gtk_label_new("");
 	gtk_box_pack_end(GTK_BOX(abox), gui->l_angle, FALSE, FALSE, 5);
+	/* only shown while an export is running */
+	gui->export_pbar = gtk_progress_bar_new();
+	gtk_widget_set_no_show_all(gui->export_pbar, TRUE);
+	gtk_box_pack_end(GTK_BOX(abox), gui->export_pbar, FALSE, FALSE, 5);
 }
 
-static void gui_clear_scan_progress(GuiData *gui)
+static void gui_reset_scan_progress(GuiData *gui)
 {
-	gint32 i;
-
-	for(i = 0; i < (1 << gui->model->n_bits); i ++)
-		gtk_progress_bar_set_fraction(
-			GTK_PROGRESS_BAR(gui->angle_pbars[i]), 0.0);
+	gtk_widget_queue_draw(gui->coverage);
 }
 
 /*****************************************************************************/
 
+/* the strip reads the counts from the model, so this only marks it for the
+ * next refresh */
 void gui_set_scan_progress(GuiData *data, guint32 angle, guint32 n_scans)
 {
-	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(data->angle_pbars[angle]),
-		(gfloat)n_scans / 10.0);
+	data->coverage_pending = TRUE;
 }
 
 void gui_set_quit_handler(GuiData *data, GCallback quit, gpointer user_data)
@@ -171,43 +244,20 @@ void gui_set_quit_handler(GuiData *data, GCallback quit, gpointer user_data)
 
 void gui_set_image(GuiData *data, GdkPixbuf *pixbuf)
 {
-	guint32 w, h;
-	gint32 i, nb;
-	gfloat sh;
-	Region *region;
-
-	w = gdk_pixbuf_get_width(pixbuf);
-	h = gdk_pixbuf_get_height(pixbuf);
-	nb = config_get_int(data->config, "base", "n_bits", 1);
-
-	gtk_widget_set_size_request(data->image, w, h);
-	gdk_draw_pixbuf(data->image->window,
-		data->image->style->fg_gc[GTK_WIDGET_STATE(data->image)],
-		pixbuf, 0, 0, 0, 0, w, h, GDK_RGB_DITHER_NONE, 0, 0);
-
-	region = g_slist_nth_data(data->model->regions, REGION_GRAYCODE);
-	if((region != NULL) &&
-		(region->rect.width > 0) &&
-		(region->rect.height > nb * 3)) {
-		sh = (gfloat)region->rect.height / nb;
-		for(i = 0; i < nb; i ++) {
-			gdk_draw_rectangle(data->image->window,
-				data->image->style->fg_gc[GTK_WIDGET_STATE(data->image)],
-				FALSE,
-				region->rect.x, region->rect.y + i * sh,
-				region->rect.width, sh);
-		}
-	}
+	/* just keep the latest frame, gui_refresh_cb() paints it */
+	gdk_pixbuf_ref(pixbuf);
+	if(data->frame)
+		gdk_pixbuf_unref(data->frame);
+	data->frame = pixbuf;
+	data->frame_pending = TRUE;
+}
 
-	region = g_slist_nth_data(data->model->regions, REGION_OBJECT);
-	if((region != NULL) &&
-		(region->rect.width > 0) && (region->rect.height > 0)) {
-		gdk_draw_rectangle(data->image->window,
-			data->image->style->fg_gc[GTK_WIDGET_STATE(data->image)],
-			FALSE,
-			region->rect.x, region->rect.y,
-			region->rect.width, region->rect.height);
-	}
+void gui_update_preview(GuiData *data)
+{
+	if(!GTK_WIDGET_VISIBLE(data->preview_area))
+		return;
+	if(preview_render(data->preview, data->model))
+		gtk_widget_queue_draw(data->preview_area);
 }
 
 void gui_set_angle(GuiData *data, const gchar *s)
@@ -215,6 +265,17 @@ void gui_set_angle(GuiData *data, const gchar *s)
 	gtk_label_set_text(GTK_LABEL(data->l_angle), s);
 }
 
+/* new and save go through the models of these too, the list must stay
+ * valid until it is replaced or gui_cleanup() */
+void gui_set_cameras(GuiData *data, GSList *cameras)
+{
+	data->cameras = cameras;
+	if(cameras)
+		gtk_widget_show(data->l_cameras);
+	else
+		gtk_widget_hide(data->l_cameras);
+}
+
 void gui_show(GuiData *data)
 {
 	gtk_widget_show_all(GTK_WIDGET(data->window));
@@ -228,64 +289,299 @@ void gui_update(GuiData *data)
 
 void gui_cleanup(GuiData *data)
 {
+	g_source_remove(data->refresh_id);
+	if(data->frame)
+		gdk_pixbuf_unref(data->frame);
+	if(data->display)
+		gdk_pixbuf_unref(data->display);
+	preview_free(data->preview);
+	g_free(data->coverage_rgb);
 	g_free(data);
 }
 
 /*****************************************************************************/
 
-static gboolean gui_image_btn_press_cb(GtkWidget *widget, GdkEventButton *eb,
+static void gui_update_cameras(GuiData *data)
+{
+	Camera *camera;
+	GString *s;
+	GSList *item;
+	gint32 i, n_rejected;
+
+	s = g_string_new("");
+	for(item = data->cameras; item != NULL; item = item->next) {
+		camera = item->data;
+		n_rejected = 0;
+		for(i = 0; i < NUM_QUALITY_VERDICTS; i ++)
+			n_rejected += g_atomic_int_get(&(camera->n_rejected[i]));
+		g_string_append_printf(s,
+			"%s%s: %d scanned, %d/%d angles, %d rejected",
+			s->len ? "    " : "", camera->section,
+			g_atomic_int_get(&(camera->n_scanned)),
+			g_atomic_int_get(&(camera->n_converged)),
+			camera->model->n_angles, n_rejected);
+	}
+	gtk_label_set_text(GTK_LABEL(data->l_cameras), s->str);
+	g_string_free(s, TRUE);
+}
+
+static void gui_scale_rect(GdkRectangle *rect, gfloat scale)
+{
+	gint32 x2, y2;
+
+	x2 = ceil((rect->x + rect->width) * scale);
+	y2 = ceil((rect->y + rect->height) * scale);
+	rect->x = floor(rect->x * scale);
+	rect->y = floor(rect->y * scale);
+	rect->width = x2 - rect->x;
+	rect->height = y2 - rect->y;
+}
+
+/* the part of the frame which changes between two refreshes: the region
+ * overlays, including the binarized object mask */
+static gboolean gui_dirty_rect(GuiData *data, GdkRectangle *dirty)
+{
+	GdkRectangle rect;
+	Region *region;
+	gboolean empty = TRUE;
+	gint32 i;
+
+	for(i = 0; i < NUM_REGIONS; i ++) {
+		region = g_slist_nth_data(data->model->regions, i);
+		if((region == NULL) ||
+			(region->rect.width <= 0) || (region->rect.height <= 0))
+			continue;
+		/* outline is drawn on the rectangle's right and bottom edge */
+		rect = region->rect;
+		rect.width ++;
+		rect.height ++;
+		if(empty)
+			*dirty = rect;
+		else
+			gdk_rectangle_union(dirty, &rect, dirty);
+		empty = FALSE;
+	}
+	return !empty;
+}
+
+static gboolean gui_refresh_cb(gpointer user_data)
+{
+	GuiData *data = user_data;
+	GdkRectangle frame_rect, dirty;
+	gboolean full = FALSE;
+	gfloat scale;
+	gint32 w, h;
+
+	if(data->coverage_pending) {
+		data->coverage_pending = FALSE;
+		gtk_widget_queue_draw(data->coverage);
+	}
+	if(data->cameras && ((data->n_ticks ++ % data->refresh_rate) == 0))
+		gui_update_cameras(data);
+
+	if(!data->frame_pending || !GTK_WIDGET_DRAWABLE(data->image))
+		return TRUE;
+	data->frame_pending = FALSE;
+
+	frame_rect.x = frame_rect.y = 0;
+	frame_rect.width = gdk_pixbuf_get_width(data->frame);
+	frame_rect.height = gdk_pixbuf_get_height(data->frame);
+
+	/* downscale to the widget, never enlarge */
+	scale = MIN(1.0, MIN(
+		(gfloat)data->image->allocation.width / frame_rect.width,
+		(gfloat)data->image->allocation.height / frame_rect.height));
+	w = MAX(1, frame_rect.width * scale);
+	h = MAX(1, frame_rect.height * scale);
+	if(scale != data->scale) {
+		data->scale = scale;
+		full = TRUE;
+	}
+	if(scale < 1.0) {
+		if((data->display == NULL) ||
+			(gdk_pixbuf_get_width(data->display) != w) ||
+			(gdk_pixbuf_get_height(data->display) != h)) {
+			if(data->display)
+				gdk_pixbuf_unref(data->display);
+			data->display = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, w, h);
+			full = TRUE;
+		}
+	} else if(data->display) {
+		gdk_pixbuf_unref(data->display);
+		data->display = NULL;
+	}
+
+	/* the background outside the regions is refreshed once a second */
+	if((data->n_refresh ++ % data->refresh_rate) == 0)
+		full = TRUE;
+
+	if(full || !gui_dirty_rect(data, &dirty))
+		dirty = frame_rect;
+	if(!gdk_rectangle_intersect(&dirty, &frame_rect, &dirty))
+		return TRUE;
+	gui_scale_rect(&dirty, scale);
+	dirty.width = MIN(dirty.width, w - dirty.x);
+	dirty.height = MIN(dirty.height, h - dirty.y);
+
+	if(data->display)
+		gdk_pixbuf_scale(data->frame, data->display,
+			dirty.x, dirty.y, dirty.width, dirty.height,
+			0.0, 0.0, scale, scale, GDK_INTERP_BILINEAR);
+	gtk_widget_queue_draw_area(data->image,
+		dirty.x, dirty.y, dirty.width, dirty.height);
+
+	return TRUE;
+}
+
+static gboolean gui_image_expose_cb(GtkWidget *widget, GdkEventExpose *ee,
 	gpointer user_data)
 {
 	GuiData *data = user_data;
+	GdkPixbuf *pixbuf;
+	GdkGC *gc;
+	GdkRectangle area, rect;
 	Region *region;
+	gint32 i;
 
 	g_return_val_if_fail(data != NULL, FALSE);
+	if(data->frame == NULL)
+		return TRUE;
 
-	region = g_slist_nth_data(data->model->regions, data->region_selector);
-	if(region == NULL)
-		return FALSE;
+	pixbuf = data->display ? data->display : data->frame;
+	gc = widget->style->fg_gc[GTK_WIDGET_STATE(widget)];
 
-	region->rect.x = eb->x;
-	region->rect.y = eb->y;
-	region->rect.width = 0;
-	region->rect.height = 0;
+	area.x = area.y = 0;
+	area.width = gdk_pixbuf_get_width(pixbuf);
+	area.height = gdk_pixbuf_get_height(pixbuf);
+	if(gdk_rectangle_intersect(&(ee->area), &area, &area))
+		gdk_draw_pixbuf(widget->window, gc, pixbuf,
+			area.x, area.y, area.x, area.y, area.width, area.height,
+			GDK_RGB_DITHER_NONE, 0, 0);
 
-	g_debug("button pressed @ %.0f, %.0f", eb->x, eb->y);
+	region = g_slist_nth_data(data->model->regions, REGION_GRAYCODE);
+	if((region != NULL) &&
+		gray_code_fits(data->model->code, &(region->rect))) {
+		for(i = 0; i < data->model->n_bits; i ++) {
+			gray_code_cell(data->model->code, &(region->rect), i, &rect);
+			gui_scale_rect(&rect, data->scale);
+			gdk_draw_rectangle(widget->window, gc, FALSE,
+				rect.x, rect.y, rect.width, rect.height);
+		}
+	}
+
+	region = g_slist_nth_data(data->model->regions, REGION_OBJECT);
+	if((region != NULL) &&
+		(region->rect.width > 0) && (region->rect.height > 0)) {
+		rect = region->rect;
+		gui_scale_rect(&rect, data->scale);
+		gdk_draw_rectangle(widget->window, gc, FALSE,
+			rect.x, rect.y, rect.width, rect.height);
+	}
 
 	return TRUE;
 }
 
-static gboolean gui_image_btn_release_cb(GtkWidget *widget, GdkEventButton *eb,
+/* each column shows the least scanned angle it covers, so gaps stay
+ * visible when there are more angles than pixels */
+static gboolean gui_coverage_expose_cb(GtkWidget *widget, GdkEventExpose *ee,
+	gpointer user_data)
+{
+	GuiData *gui = user_data;
+	PangoLayout *layout;
+	static const guint8 c_fill[3] = { 0x4A, 0x90, 0xD9 };
+	static const guint8 c_done[3] = { 0x4E, 0x9A, 0x06 };
+	const guint8 *col;
+	guint8 *pix, min;
+	guint32 n, a, a0, a1, fill;
+	gint32 x, y, w, h, i;
+	gchar *s;
+
+	g_return_val_if_fail(gui != NULL, FALSE);
+
+	w = widget->allocation.width;
+	h = widget->allocation.height;
+	if((w < 1) || (h < 1))
+		return TRUE;
+	if(gui->coverage_size != (gsize)w * h * 3) {
+		gui->coverage_size = (gsize)w * h * 3;
+		g_free(gui->coverage_rgb);
+		gui->coverage_rgb = g_new(guint8, gui->coverage_size);
+	}
+
+	n = gui->model->n_angles;
+	for(x = 0; x < w; x ++) {
+		a0 = (guint64)x * n / w;
+		a1 = MAX(a0 + 1, (guint64)(x + 1) * n / w);
+		min = 0xFF;
+		for(a = a0; a < a1; a ++)
+			min = MIN(min, gui->model->angle_scans[a]);
+		fill = h * MIN(min, gui->model->max_scans) / gui->model->max_scans;
+		col = (min >= gui->model->max_scans) ? c_done : c_fill;
+		for(y = 0; y < h; y ++) {
+			pix = gui->coverage_rgb + (y * w + x) * 3;
+			if((h - y) <= fill)
+				memcpy(pix, col, 3);
+			else if((x % MAX(1, w / 4)) == 0)
+				memset(pix, 0x80, 3);
+			else
+				memset(pix, 0x30, 3);
+		}
+	}
+	gdk_draw_rgb_image(widget->window,
+		widget->style->fg_gc[GTK_WIDGET_STATE(widget)],
+		0, 0, w, h, GDK_RGB_DITHER_NONE, gui->coverage_rgb, w * 3);
+
+	for(i = 0; i < 4; i ++) {
+		s = g_strdup_printf("%d°", i * 90);
+		layout = gtk_widget_create_pango_layout(widget, s);
+		gdk_draw_layout(widget->window, widget->style->white_gc,
+			i * w / 4 + 2, 0, layout);
+		g_object_unref(layout);
+		g_free(s);
+	}
+
+	return TRUE;
+}
+
+static gboolean gui_image_btn_press_cb(GtkWidget *widget, GdkEventButton *eb,
 	gpointer user_data)
 {
 	GuiData *data = user_data;
-	Region *region;
-	guint32 x, y;
 
 	g_return_val_if_fail(data != NULL, FALSE);
 
-	region = g_slist_nth_data(data->model->regions, data->region_selector);
-	if(region == NULL)
-		return FALSE;
+	/* the region itself is only touched once the selection is done */
+	data->select_x = eb->x / data->scale;
+	data->select_y = eb->y / data->scale;
 
-	x = region->rect.x;
-	y = region->rect.y;
+	g_debug("button pressed @ %.0f, %.0f", eb->x, eb->y);
 
-	if(x > eb->x) {
-		region->rect.x = eb->x;
-		region->rect.width = x - eb->x;
-	} else {
-		region->rect.width = eb->x - x;
-	}
-	if(y > eb->y) {
-		region->rect.y = eb->y;
-		region->rect.height = y - eb->y;
-	} else {
-		region->rect.height = eb->y - y;
-	}
+	return TRUE;
+}
+
+static gboolean gui_image_btn_release_cb(GtkWidget *widget, GdkEventButton *eb,
+	gpointer user_data)
+{
+	GuiData *data = user_data;
+	GdkRectangle rect;
+	gdouble x, y;
 
-	model_rebuild_storage(data->model);
-	gui_clear_scan_progress(data);
+	g_return_val_if_fail(data != NULL, FALSE);
+
+	x = eb->x / data->scale;
+	y = eb->y / data->scale;
+	rect.x = MIN(data->select_x, x);
+	rect.y = MIN(data->select_y, y);
+	rect.width = fabs(x - data->select_x);
+	rect.height = fabs(y - data->select_y);
+	/* would clear the scan through model_set_region() */
+	if((rect.width < GUI_MIN_SELECTION) || (rect.height < GUI_MIN_SELECTION))
+		return TRUE;
+
+	model_set_region(data->model, data->region_selector, &rect);
+	gui_reset_scan_progress(data);
+	/* repaint where the old region outline was */
+	gtk_widget_queue_draw(data->image);
 
 	return TRUE;
 }
@@ -310,10 +606,13 @@ static gboolean gui_region_toggled_cb(GtkToggleToolButton *toggle_tool_button,
 static gboolean gui_btn_new_cb(GtkToolButton *toolbutton, gpointer user_data)
 {
 	GuiData *gui = user_data;
+	GSList *item;
 
 	g_return_val_if_fail(gui != NULL, FALSE);
-	model_rebuild_storage(gui->model);
-	gui_clear_scan_progress(gui);
+	model_clear(gui->model);
+	for(item = gui->cameras; item != NULL; item = item->next)
+		camera_clear(item->data);
+	gui_reset_scan_progress(gui);
 	return TRUE;
 }
 
@@ -321,9 +620,10 @@ static gboolean gui_btn_save_cb(GtkToolButton *toolbutton, gpointer user_data)
 {
 	GuiData *gui = user_data;
 	GtkWidget *dialog;
+	Camera *camera;
+	GSList *item;
 	gint result;
-	gboolean retval;
-	gchar *filename;
+	gchar *filename, *cfilename, *s;
 
 	g_return_val_if_fail(gui != NULL, FALSE);
 
@@ -335,38 +635,105 @@ static gboolean gui_btn_save_cb(GtkToolButton *toolbutton, gpointer user_data)
 	result = gtk_dialog_run(GTK_DIALOG(dialog));
 	if(result == GTK_RESPONSE_ACCEPT) {
 		filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
-		retval = model_save(gui->model, filename);
+		if(export_start(gui->model, filename, gui_export_progress_cb,
+			gui_export_done_cb, gui)) {
+			/* "scan.ac" also writes "scan.1.ac" for camera "v4l2.1", the
+			 * bar follows the main model */
+			gui->n_exports = 1;
+			for(item = gui->cameras; item != NULL; item = item->next) {
+				camera = item->data;
+				cfilename = camera_filename(filename, camera->model->name);
+				if(camera_export(camera, cfilename, NULL,
+					gui_export_done_cb, gui))
+					gui->n_exports ++;
+				g_free(cfilename);
+			}
+			gtk_widget_set_sensitive(GTK_WIDGET(gui->btn_save), FALSE);
+			s = g_path_get_basename(filename);
+			gtk_progress_bar_set_text(GTK_PROGRESS_BAR(gui->export_pbar), s);
+			g_free(s);
+			gtk_progress_bar_set_fraction(
+				GTK_PROGRESS_BAR(gui->export_pbar), 0.0);
+			gtk_widget_show(gui->export_pbar);
+		}
 		g_free(filename);
 	}
 	gtk_widget_destroy(dialog);
 	return TRUE;
 }
 
-static gboolean gui_btn_view_cb(GtkToolButton *toolbutton, gpointer user_data)
+static void gui_export_progress_cb(gfloat fraction, gpointer user_data)
+{
+	GuiData *gui = user_data;
+
+	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(gui->export_pbar),
+		fraction);
+}
+
+static void gui_export_done_cb(const gchar *filename, gboolean success,
+	gpointer user_data)
+{
+	GuiData *gui = user_data;
+
+	if(!success)
+		g_warning("failed to save model to %s", filename);
+	gui->n_exports --;
+	if(gui->n_exports > 0)
+		return;
+	gtk_widget_hide(gui->export_pbar);
+	gtk_widget_set_sensitive(GTK_WIDGET(gui->btn_save), TRUE);
+}
+
+static gboolean gui_btn_view_cb(GtkToggleToolButton *toggle_tool_button,
+	gpointer user_data)
 {
 	GuiData *gui = user_data;
-	gchar *argv[3] = { NULL, NULL, NULL };
-	GError *error = NULL;
-	GPid pid = 0;
 
 	g_return_val_if_fail(gui != NULL, FALSE);
-	argv[0] = config_get_string(gui->config, "base", "preview_program",
-		"g3dviewer");
-	argv[1] = g_strdup_printf("%s%c3dscan_preview.%d.ac", g_get_tmp_dir(),
-		G_DIR_SEPARATOR, g_random_int());
-	if(model_save(gui->model, argv[1])) {
-		g_spawn_async(g_get_tmp_dir(), /* working directory */
-			argv, NULL, /* argv, envp */
-			G_SPAWN_SEARCH_PATH, /* flags */
-			NULL, NULL, /* child_setup, user_data */
-			&pid, &error);
-		if(error != NULL) {
-			g_debug("failed to spawn '%s' '%s': %s",
-				argv[0], argv[1], error->message);
-			g_error_free(error);
-		}
+	if(gtk_toggle_tool_button_get_active(toggle_tool_button)) {
+		gtk_widget_show(gui->preview_area);
+		gui_update_preview(gui);
+	} else {
+		gtk_widget_hide(gui->preview_area);
 	}
-	g_free(argv[0]);
-	g_free(argv[1]);
+	return TRUE;
+}
+
+static gboolean gui_preview_expose_cb(GtkWidget *widget, GdkEventExpose *ee,
+	gpointer user_data)
+{
+	GuiData *gui = user_data;
+
+	g_return_val_if_fail(gui != NULL, FALSE);
+	gdk_draw_rgb_image(widget->window,
+		widget->style->fg_gc[GTK_WIDGET_STATE(widget)],
+		0, 0, gui->preview->width, gui->preview->height,
+		GDK_RGB_DITHER_NONE, gui->preview->rgb, gui->preview->width * 3);
+	return TRUE;
+}
+
+static gboolean gui_preview_btn_press_cb(GtkWidget *widget, GdkEventButton *eb,
+	gpointer user_data)
+{
+	GuiData *gui = user_data;
+
+	g_return_val_if_fail(gui != NULL, FALSE);
+	gui->drag_x = eb->x;
+	gui->drag_y = eb->y;
+	return TRUE;
+}
+
+static gboolean gui_preview_motion_cb(GtkWidget *widget, GdkEventMotion *em,
+	gpointer user_data)
+{
+	GuiData *gui = user_data;
+
+	g_return_val_if_fail(gui != NULL, FALSE);
+	preview_set_view(gui->preview,
+		gui->preview->yaw + (em->x - gui->drag_x) * 0.01,
+		gui->preview->pitch + (em->y - gui->drag_y) * 0.01);
+	gui->drag_x = em->x;
+	gui->drag_y = em->y;
+	gui_update_preview(gui);
 	return TRUE;
 }
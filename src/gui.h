@@ -15,7 +15,9 @@ void gui_update(GuiData *data);
 void gui_set_scan_progress(GuiData *data, guint32 angle, guint32 n_scans);
 void gui_set_quit_handler(GuiData *data, GCallback quit, gpointer user_data);
 void gui_set_image(GuiData *data, GdkPixbuf *pixbuf);
+void gui_update_preview(GuiData *data);
 void gui_set_angle(GuiData *data, const gchar *s);
+void gui_set_cameras(GuiData *data, GSList *cameras);
 void gui_cleanup(GuiData *data);
 
 #endif
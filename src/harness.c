@@ -0,0 +1,422 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "synth.h"
+#include "model.h"
+#include "session.h"
+#include "region.h"
+#include "scan.h"
+#include "gray.h"
+#include "v4l2.h"
+#include "angle.h"
+#include "filter.h"
+
+/* frames come either from the synthetic scene or from a raw YUYV stream
+ * recorded at a known size ([v4l2] record), checked against a reference
+ * session */
+typedef struct {
+	SynthScene *scene;
+	guint32 seed;
+	FILE *input;
+	guint32 width;
+	guint32 height;
+	guint32 n_bits;
+	guint32 sub_bits;
+	guint32 n_vert_y;
+	GrayCodeType code;
+	guint32 frame;
+	guint64 stamp;
+	guint8 *buffer;
+
+	Session *reference;
+	gfloat *truth;
+} HarnessSource;
+
+typedef struct {
+	gint32 tolerance;
+	gint32 offset;
+	gint32 max_scans;
+	gint32 dual_edge;
+
+	gdouble seconds;
+	guint32 n_frames;
+	guint32 n_rejected;
+	gdouble rms;
+	gdouble coverage;
+	/* error of the gap filled and outlier filtered grid over all rows */
+	gdouble filled;
+	/* sub-code positions (of 1 << sub_bits) with any scan; stuck at one
+	 * while the angle tracker loses its timing at every code step */
+	guint32 n_subs;
+} HarnessResult;
+
+static gchar *opt_size = "640x480";
+static gint opt_bits = 6;
+static gint opt_rows = 64;
+static gint opt_turns = 4;
+static gint opt_steps = 3;
+static gint opt_sub_bits = 0;
+static gint opt_fps = 30;
+static gchar *opt_tolerance = "40,80,120";
+static gchar *opt_offset = "16,32,64";
+static gchar *opt_max_scans = "1,3,10";
+static gchar *opt_dual_edge = "0,1";
+static gchar *opt_input = NULL;
+static gchar *opt_reference = NULL;
+static gchar *opt_code = "reflected";
+
+static GOptionEntry harness_options[] = {
+	{ "size", 's', 0, G_OPTION_ARG_STRING, &opt_size,
+		"frame size of the synthetic or recorded sequence", "WxH" },
+	{ "bits", 'n', 0, G_OPTION_ARG_INT, &opt_bits,
+		"gray code bits of the synthetic scene", "N" },
+	{ "code", 0, 0, G_OPTION_ARG_STRING, &opt_code,
+		"angle code on the ring: reflected or debruijn", "NAME" },
+	{ "rows", 'y', 0, G_OPTION_ARG_INT, &opt_rows,
+		"sampled rows of the synthetic scene", "N" },
+	{ "turns", 0, 0, G_OPTION_ARG_INT, &opt_turns,
+		"synthetic turntable rotations", "N" },
+	{ "steps", 0, 0, G_OPTION_ARG_INT, &opt_steps,
+		"synthetic frames per angle and rotation", "N" },
+	{ "sub-bits", 0, 0, G_OPTION_ARG_INT, &opt_sub_bits,
+		"interpolated angles per code step (as bits) of the synthetic scene",
+		"N" },
+	{ "fps", 0, 0, G_OPTION_ARG_INT, &opt_fps,
+		"frame rate assumed for angle interpolation", "N" },
+	{ "tolerance", 0, 0, G_OPTION_ARG_STRING, &opt_tolerance,
+		"color ratio tolerances to try, in percent", "LIST" },
+	{ "offset", 0, 0, G_OPTION_ARG_STRING, &opt_offset,
+		"gray value offsets to try", "LIST" },
+	{ "max-scans", 0, 0, G_OPTION_ARG_STRING, &opt_max_scans,
+		"scans per angle to try", "LIST" },
+	{ "dual-edge", 0, 0, G_OPTION_ARG_STRING, &opt_dual_edge,
+		"single (0) or dual (1) edge sampling to try", "LIST" },
+	{ "input", 'i', 0, G_OPTION_ARG_FILENAME, &opt_input,
+		"raw YUYV frames recorded with [v4l2] record instead of the "
+		"synthetic scene", "FILE" },
+	{ "reference", 'r', 0, G_OPTION_ARG_FILENAME, &opt_reference,
+		"session holding regions and ground truth for --input", "SESSION" },
+	{ NULL }
+};
+
+static GArray *harness_parse_list(const gchar *list)
+{
+	GArray *array;
+	gchar **items;
+	gint32 i, value;
+
+	array = g_array_new(FALSE, FALSE, sizeof(gint32));
+	items = g_strsplit(list, ",", 0);
+	for(i = 0; items[i] != NULL; i ++) {
+		value = atoi(items[i]);
+		g_array_append_val(array, value);
+	}
+	g_strfreev(items);
+	return array;
+}
+
+/*****************************************************************************/
+
+static gboolean harness_source_init(HarnessSource *source)
+{
+	ModelLayout layout;
+	guint8 *arena;
+	gfloat sh, y, left, right;
+	guint32 n_angles, a;
+	gint32 i;
+
+	if(sscanf(opt_size, "%ux%u", &(source->width), &(source->height)) != 2) {
+		g_printerr("invalid size: %s\n", opt_size);
+		return FALSE;
+	}
+	source->code = gray_code_parse(opt_code);
+
+	if(opt_input) {
+		if(opt_reference == NULL) {
+			g_printerr("--input needs a --reference session\n");
+			return FALSE;
+		}
+		source->input = fopen(opt_input, "rb");
+		if(source->input == NULL) {
+			g_printerr("failed to open %s\n", opt_input);
+			return FALSE;
+		}
+		source->reference = session_open_readonly(opt_reference);
+		if(source->reference == NULL)
+			return FALSE;
+		source->n_bits = source->reference->header->n_bits;
+		source->sub_bits = source->reference->header->sub_bits;
+		source->n_vert_y = source->reference->header->n_vert_y;
+		source->buffer = g_new(guint8, source->width * source->height * 2);
+
+		/* only angles scanned in the reference count as ground truth */
+		n_angles = (1 << (source->n_bits + source->sub_bits));
+		model_layout(&layout, n_angles, source->n_vert_y, 0);
+		arena = session_get_arena(source->reference);
+		source->truth = g_new0(gfloat, n_angles * source->n_vert_y);
+		for(a = 0; a < n_angles; a ++)
+			if(arena[layout.scans + a])
+				memcpy(source->truth + a * source->n_vert_y,
+					arena + layout.verts +
+						a * source->n_vert_y * sizeof(gfloat),
+					source->n_vert_y * sizeof(gfloat));
+		return TRUE;
+	}
+
+	source->n_bits = opt_bits;
+	source->sub_bits = CLAMP(opt_sub_bits, 0, 4);
+	source->n_vert_y = opt_rows;
+	source->scene = synth_new(source->width, source->height, opt_bits);
+	synth_set_code(source->scene, source->code);
+	source->seed = source->scene->seed;
+	source->width = source->scene->width;
+
+	/* sample the exact silhouette in the middle of each angle */
+	n_angles = (1 << (source->n_bits + source->sub_bits));
+	source->truth = g_new0(gfloat, n_angles * source->n_vert_y);
+	sh = (gfloat)source->scene->object.height / source->n_vert_y;
+	for(a = 0; a < n_angles; a ++) {
+		for(i = 0; i < source->n_vert_y; i ++) {
+			y = (guint32)((source->scene->object.y +
+				source->scene->object.height - 1) - i * sh - sh / 2);
+			synth_extent(source->scene, G_PI * 2.0 * (a + 0.5) / n_angles,
+				y + 0.5, &left, &right);
+			source->truth[a * source->n_vert_y + i] = left;
+		}
+	}
+	return TRUE;
+}
+
+static void harness_source_cleanup(HarnessSource *source)
+{
+	if(source->input)
+		fclose(source->input);
+	if(source->reference)
+		session_close(source->reference);
+	if(source->scene)
+		synth_free(source->scene);
+	g_free(source->buffer);
+	g_free(source->truth);
+}
+
+static void harness_source_rewind(HarnessSource *source, Model *model)
+{
+	source->frame = 0;
+	if(source->input) {
+		rewind(source->input);
+		session_get_regions(source->reference, model->regions);
+	} else {
+		/* same noise for every configuration */
+		source->scene->seed = source->seed;
+		synth_set_regions(source->scene, model);
+	}
+}
+
+/* returned frame is valid until the next call */
+static guint8 *harness_source_next(HarnessSource *source)
+{
+	guint32 n_steps;
+	gfloat angle;
+
+	/* neither source has capture times, assume a steady frame rate */
+	source->stamp = (guint64)source->frame * G_USEC_PER_SEC / MAX(opt_fps, 1);
+
+	if(source->input) {
+		if(fread(source->buffer, source->width * source->height * 2, 1,
+			source->input) != 1)
+			return NULL;
+		source->frame ++;
+		return source->buffer;
+	}
+
+	n_steps = (1 << source->n_bits) * opt_steps;
+	if(source->frame >= (n_steps * opt_turns))
+		return NULL;
+	/* slightly off the frame grid, so every rotation hits the angles at a
+	 * different phase */
+	angle = G_PI * 2.0 * source->frame / (n_steps - 0.381966);
+	g_free(source->buffer);
+	source->buffer = synth_render_yuyv(source->scene, angle);
+	source->frame ++;
+	return source->buffer;
+}
+
+/*****************************************************************************/
+
+/* same order as scanner_process_frame() */
+static void harness_run(HarnessSource *source, HarnessResult *result)
+{
+	Model *model;
+	AngleTracker *tracker;
+	GdkPixbuf *pixbuf;
+	GTimer *timer;
+	guint8 *frame;
+	guint32 n_angles, a, gv, angle;
+	gboolean valid, ok;
+	gint32 i;
+	gfloat truth, v, *filtered;
+	gdouble sum = 0.0, sum_filled = 0.0;
+	guint32 n_truth = 0, n_covered = 0, subs = 0;
+
+	model = model_new(source->n_bits, source->sub_bits, source->n_vert_y);
+	model_set_code(model, source->code);
+	tracker = angle_tracker_new(source->n_bits, source->sub_bits);
+	model->bg_tolerance = result->tolerance / 100.0;
+	model->bg_offset = result->offset;
+	model->max_scans = CLAMP(result->max_scans, 1, 255);
+	model->dual_edge = result->dual_edge ? TRUE : FALSE;
+	harness_source_rewind(source, model);
+
+	timer = g_timer_new();
+	result->seconds = 0.0;
+	result->n_frames = 0;
+	result->n_rejected = 0;
+	while((frame = harness_source_next(source)) != NULL) {
+		g_timer_start(timer);
+		pixbuf = v4l2_convert_yuyv(frame, source->width, source->height);
+		ok = (scan_check_frame(model, pixbuf) == QUALITY_OK);
+		if(ok)
+			scan_update_bits(model, pixbuf);
+		else
+			result->n_rejected ++;
+		gv = (ok && model->valid_dir) ?
+			gray_code_decode(model->code, model->bits) : 0;
+		valid = angle_tracker_update(tracker, source->stamp,
+			ok && model->valid_dir, gv, &angle);
+		if(ok)
+			scan_frame(model, pixbuf, valid ? (gint32)angle : -1);
+		gdk_pixbuf_unref(pixbuf);
+		result->seconds += g_timer_elapsed(timer, NULL);
+		result->n_frames ++;
+	}
+	g_timer_destroy(timer);
+	angle_tracker_free(tracker);
+
+	/* rows without object in the ground truth do not count */
+	n_angles = model->n_angles;
+	filtered = g_new(gfloat, n_angles * model->n_vert_y);
+	filter_radii(model, filtered, NULL);
+	for(a = 0; a < n_angles; a ++) {
+		if(model->angle_scans[a])
+			subs |= 1 << (a & ((1 << model->sub_bits) - 1));
+		for(i = 0; i < model->n_vert_y; i ++) {
+			truth = source->truth[a * model->n_vert_y + i];
+			if(truth <= 0.0)
+				continue;
+			n_truth ++;
+			v = filtered[a * model->n_vert_y + i];
+			sum_filled += (v - truth) * (v - truth);
+			v = model_get_radius(model, a, i);
+			if((model->angle_scans[a] == 0) || (v <= 0.0))
+				continue;
+			n_covered ++;
+			sum += (v - truth) * (v - truth);
+		}
+	}
+	result->rms = n_covered ? sqrt(sum / n_covered) : 0.0;
+	result->coverage = n_truth ? (gdouble)n_covered / n_truth : 0.0;
+	result->filled = n_truth ? sqrt(sum_filled / n_truth) : 0.0;
+	for(result->n_subs = 0; subs; subs >>= 1)
+		result->n_subs += subs & 1;
+
+	g_free(filtered);
+	model_cleanup(model);
+}
+
+static gboolean harness_dominated(HarnessResult *results, guint32 n,
+	guint32 k)
+{
+	HarnessResult *r = results + k, *o;
+	guint32 i;
+
+	for(i = 0; i < n; i ++) {
+		o = results + i;
+		if((i == k) || (o->rms > r->rms) || (o->coverage < r->coverage) ||
+			(o->seconds > r->seconds))
+			continue;
+		if((o->rms < r->rms) || (o->coverage > r->coverage) ||
+			(o->seconds < r->seconds))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+int main(int argc, char *argv[])
+{
+	HarnessSource source;
+	HarnessResult *results, *r;
+	GOptionContext *context;
+	GError *error = NULL;
+	GArray *tolerances, *offsets, *max_scans, *dual_edges;
+	guint32 n, i, j, k, e;
+
+	context = g_option_context_new("");
+	g_option_context_add_main_entries(context, harness_options, NULL);
+	if(!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(context);
+
+	g_type_init();
+
+	memset(&source, 0, sizeof(HarnessSource));
+	if(!harness_source_init(&source)) {
+		harness_source_cleanup(&source);
+		return EXIT_FAILURE;
+	}
+
+	tolerances = harness_parse_list(opt_tolerance);
+	offsets = harness_parse_list(opt_offset);
+	max_scans = harness_parse_list(opt_max_scans);
+	dual_edges = harness_parse_list(opt_dual_edge);
+	results = g_new0(HarnessResult, tolerances->len * offsets->len *
+		max_scans->len * dual_edges->len);
+
+	n = 0;
+	for(i = 0; i < tolerances->len; i ++)
+		for(j = 0; j < offsets->len; j ++)
+			for(k = 0; k < max_scans->len; k ++)
+				for(e = 0; e < dual_edges->len; e ++) {
+					r = results + n;
+					r->tolerance = g_array_index(tolerances, gint32, i);
+					r->offset = g_array_index(offsets, gint32, j);
+					r->max_scans = g_array_index(max_scans, gint32, k);
+					r->dual_edge = g_array_index(dual_edges, gint32, e);
+					harness_run(&source, r);
+					n ++;
+				}
+
+	/* configurations marked with '*' are on the pareto front of error,
+	 * coverage and time */
+	printf("%dx%d, %d+%d bits (%s), %d rows\n", source.width, source.height,
+		source.n_bits, source.sub_bits, gray_code_name(source.code),
+		source.n_vert_y);
+	printf("  tol  off scans edges   rms[px] coverage filled[px] subs  "
+		"time[s] frames/s rejected\n");
+	for(i = 0; i < n; i ++) {
+		r = results + i;
+		printf("%c %3d %4d %5d %5d %9.3f %7.1f%% %10.3f %2u/%-2u %7.3f "
+			"%8.1f %8u\n", harness_dominated(results, n, i) ? ' ' : '*',
+			r->tolerance, r->offset, r->max_scans, r->dual_edge ? 2 : 1,
+			r->rms, r->coverage * 100.0, r->filled, r->n_subs,
+			1 << source.sub_bits, r->seconds,
+			r->n_frames / MAX(r->seconds, 1e-9), r->n_rejected);
+	}
+
+	g_free(results);
+	g_array_free(dual_edges, TRUE);
+	g_array_free(max_scans, TRUE);
+	g_array_free(offsets, TRUE);
+	g_array_free(tolerances, TRUE);
+	harness_source_cleanup(&source);
+
+	return EXIT_SUCCESS;
+}
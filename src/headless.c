@@ -0,0 +1,184 @@
+#include <glib.h>
+
+#include "headless.h"
+#include "main.h"
+#include "model.h"
+#include "region.h"
+#include "camera.h"
+#include "pipeline.h"
+
+typedef struct {
+	G3DScanner *scanner;
+	GMainLoop *loop;
+	GTimer *timer;
+	gboolean converged;
+	gdouble last_report;
+} Headless;
+
+static guint32 headless_converged_angles(Model *model)
+{
+	guint32 i, n = 0;
+
+	for(i = 0; i < model->n_angles; i ++)
+		if(model->angle_scans[i] >= model->max_scans)
+			n ++;
+	return n;
+}
+
+static gboolean headless_converged(G3DScanner *scanner)
+{
+	Camera *camera;
+	GSList *item;
+
+	if(headless_converged_angles(scanner->model) !=
+		scanner->model->n_angles)
+		return FALSE;
+	for(item = scanner->cameras; item != NULL; item = item->next) {
+		camera = item->data;
+		if(g_atomic_int_get(&(camera->n_converged)) !=
+			camera->model->n_angles)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void headless_report(Headless *hl)
+{
+	G3DScanner *scanner = hl->scanner;
+	gdouble elapsed = g_timer_elapsed(hl->timer, NULL);
+	Camera *camera;
+	GSList *item;
+
+	g_print("%.1fs: %u frames (%.1f fps), %u decoded, %u scanned, "
+		"%u/%u angles done\n",
+		elapsed, scanner->n_frames,
+		(elapsed > 0.0) ? scanner->n_frames / elapsed : 0.0,
+		scanner->n_valid, scanner->n_scanned,
+		headless_converged_angles(scanner->model),
+		scanner->model->n_angles);
+	for(item = scanner->cameras; item != NULL; item = item->next) {
+		camera = item->data;
+		g_print("  %s: %d frames, %d without angle, %d scanned, "
+			"%d/%u angles done, rejected: %d %s, %d %s, %d %s\n",
+			camera->section,
+			g_atomic_int_get(&(camera->n_frames)),
+			g_atomic_int_get(&(camera->n_unmatched)),
+			g_atomic_int_get(&(camera->n_scanned)),
+			g_atomic_int_get(&(camera->n_converged)),
+			camera->model->n_angles,
+			g_atomic_int_get(&(camera->n_rejected[QUALITY_BLURRED])),
+			quality_name(QUALITY_BLURRED),
+			g_atomic_int_get(&(camera->n_rejected[QUALITY_DARK])),
+			quality_name(QUALITY_DARK),
+			g_atomic_int_get(&(camera->n_rejected[QUALITY_BRIGHT])),
+			quality_name(QUALITY_BRIGHT));
+	}
+	if(scanner->n_rejected[QUALITY_BLURRED] ||
+		scanner->n_rejected[QUALITY_DARK] ||
+		scanner->n_rejected[QUALITY_BRIGHT])
+		g_print("  rejected: %u %s, %u %s, %u %s\n",
+			scanner->n_rejected[QUALITY_BLURRED],
+			quality_name(QUALITY_BLURRED),
+			scanner->n_rejected[QUALITY_DARK], quality_name(QUALITY_DARK),
+			scanner->n_rejected[QUALITY_BRIGHT],
+			quality_name(QUALITY_BRIGHT));
+	if(scanner->pipeline)
+		pipeline_report(scanner->pipeline);
+	if(scanner->model->obslog)
+		g_print("  observation log: %u records, %d blocks written, "
+			"%u dropped\n", scanner->model->obslog->n_records,
+			g_atomic_int_get(&(scanner->model->obslog->n_written)),
+			scanner->model->obslog->n_dropped);
+}
+
+static gboolean headless_idle(gpointer data)
+{
+	Headless *hl = data;
+
+	/* nothing else to keep responsive */
+	scanner_process_frame(hl->scanner, 20);
+
+	if(headless_converged(hl->scanner)) {
+		hl->converged = TRUE;
+		g_main_loop_quit(hl->loop);
+		return FALSE;
+	}
+	if(g_timer_elapsed(hl->timer, NULL) - hl->last_report >= 5.0) {
+		hl->last_report = g_timer_elapsed(hl->timer, NULL);
+		headless_report(hl);
+	}
+	return TRUE;
+}
+
+static gboolean headless_timeout(gpointer data)
+{
+	Headless *hl = data;
+
+	g_warning("headless scan timed out");
+	g_main_loop_quit(hl->loop);
+	return FALSE;
+}
+
+gboolean headless_run(G3DScanner *scanner, const gchar *output,
+	gint32 timeout)
+{
+	Headless *hl;
+	Camera *camera;
+	GSList *item;
+	gchar *filename, *cfilename;
+	guint idle_id, timeout_id;
+	gboolean retval;
+
+	if(timeout < 0)
+		timeout = config_get_int(scanner->config, "headless", "timeout", 300);
+	filename = output ? g_strdup(output) :
+		config_get_string(scanner->config, "headless", "output", "scan.ac");
+
+	hl = g_new0(Headless, 1);
+	hl->scanner = scanner;
+	hl->loop = g_main_loop_new(NULL, FALSE);
+
+	/* every batch run scans a new object */
+	model_clear(scanner->model);
+	for(item = scanner->cameras; item != NULL; item = item->next)
+		camera_clear(item->data);
+
+	hl->timer = g_timer_new();
+	idle_id = g_idle_add(headless_idle, hl);
+	timeout_id = g_timeout_add(timeout * 1000, headless_timeout, hl);
+
+	g_main_loop_run(hl->loop);
+
+	if(!hl->converged)
+		g_source_remove(idle_id);
+	else
+		g_source_remove(timeout_id);
+	g_timer_stop(hl->timer);
+	for(item = scanner->cameras; item != NULL; item = item->next)
+		camera_stop(item->data);
+	headless_report(hl);
+
+	/* a timed out scan is still written, but reported as failure */
+	retval = model_save(scanner->model, filename, NULL, NULL);
+	if(retval)
+		g_print("model written to %s\n", filename);
+	else
+		g_warning("failed to write model to %s", filename);
+	for(item = scanner->cameras; item != NULL; item = item->next) {
+		camera = item->data;
+		cfilename = camera_filename(filename, camera->model->name);
+		if(model_save(camera->model, cfilename, NULL, NULL))
+			g_print("model of %s written to %s\n", camera->section,
+				cfilename);
+		else
+			retval = FALSE;
+		g_free(cfilename);
+	}
+	retval = retval && hl->converged;
+
+	g_timer_destroy(hl->timer);
+	g_main_loop_unref(hl->loop);
+	g_free(hl);
+	g_free(filename);
+	return retval;
+}
@@ -0,0 +1,9 @@
+#ifndef _HEADLESS_H
+#define _HEADLESS_H
+
+#include "main.h"
+
+gboolean headless_run(G3DScanner *scanner, const gchar *output,
+	gint32 timeout);
+
+#endif
@@ -0,0 +1,571 @@
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "hull.h"
+#include "ac3d.h"
+#include "lens.h"
+
+/* voxel grid carved from the silhouettes: res x rows x res cells, index
+ * (y * res + z) * res + x, y counted up from the bottom of the region */
+typedef struct {
+	Hull *hull;
+	guint32 n_views;
+	gfloat *cos_a;
+	gfloat *sin_a;
+	guint8 **masks;
+	guint32 **sat;
+	guint8 *grid;
+} HullCarve;
+
+typedef struct {
+	HullCarve *hc;
+	gint32 x0, y0, z0;
+	gint32 size;
+} HullJob;
+
+typedef enum {
+	HULL_OUT,
+	HULL_IN,
+	HULL_PARTIAL
+} HullClass;
+
+static inline guint8 *hull_get_pixel(GdkPixbuf *pixbuf, guint32 x, guint32 y)
+{
+	return gdk_pixbuf_get_pixels(pixbuf) +
+		y * gdk_pixbuf_get_rowstride(pixbuf) +
+		x * gdk_pixbuf_get_n_channels(pixbuf);
+}
+
+/* frame pixel at the center of cell x, y */
+static inline guint32 hull_cell_x(Hull *hull, guint32 x)
+{
+	return hull->rect.x + (guint32)((x + 0.5) * hull->cell);
+}
+
+static inline guint32 hull_cell_y(Hull *hull, guint32 y)
+{
+	return (hull->rect.y + hull->rect.height - 1) -
+		(guint32)((y + 0.5) * hull->cell);
+}
+
+/* lens: NULL samples the cell centers in the frame as they are */
+Hull *hull_new(guint32 n_angles, GdkRectangle *rect, guint32 depth,
+	LensParams *lens)
+{
+	Hull *hull;
+	guint32 n, x, y;
+
+	g_return_val_if_fail((rect->width > 0) && (rect->height > 0), NULL);
+
+	hull = g_new0(Hull, 1);
+	hull->n_angles = n_angles;
+	hull->rect = *rect;
+	/* the longer side gets 2^depth cells, edge keys of the mesh have 10
+	 * bits per axis, see hull_edge_vertex() */
+	n = (1 << CLAMP(depth, 3, 8));
+	if(rect->width >= rect->height) {
+		hull->res = n;
+		hull->cell = (gfloat)rect->width / n;
+		hull->rows = CLAMP((guint32)(rect->height / hull->cell), 1, n);
+	} else {
+		hull->rows = n;
+		hull->cell = (gfloat)rect->height / n;
+		hull->res = CLAMP((guint32)(rect->width / hull->cell), 1, n);
+	}
+	hull->masks = g_new0(guint8 *, n_angles);
+	if(lens) {
+		hull->src = g_new(guint16, hull->res * hull->rows * 2);
+		for(y = 0; y < hull->rows; y ++)
+			for(x = 0; x < hull->res; x ++)
+				lens_map_point(lens, hull_cell_x(hull, x),
+					hull_cell_y(hull, y), &(hull->rect),
+					hull->src + (y * hull->res + x) * 2);
+	}
+	return hull;
+}
+
+Hull *hull_copy(Hull *hull)
+{
+	Hull *copy;
+	guint32 i;
+
+	copy = g_new0(Hull, 1);
+	memcpy(copy, hull, sizeof(Hull));
+	copy->masks = g_new0(guint8 *, hull->n_angles);
+	for(i = 0; i < hull->n_angles; i ++)
+		if(hull->masks[i])
+			copy->masks[i] = g_memdup(hull->masks[i], hull->res * hull->rows);
+	if(hull->src)
+		copy->src = g_memdup(hull->src,
+			hull->res * hull->rows * 2 * sizeof(guint16));
+	return copy;
+}
+
+void hull_clear(Hull *hull)
+{
+	guint32 i;
+
+	for(i = 0; i < hull->n_angles; i ++) {
+		g_free(hull->masks[i]);
+		hull->masks[i] = NULL;
+	}
+}
+
+void hull_free(Hull *hull)
+{
+	hull_clear(hull);
+	g_free(hull->masks);
+	g_free(hull->src);
+	g_free(hull);
+}
+
+/* pixbuf is a frame after scan_binarize_object_region(); every frame at
+ * the same angle can only remove cells from its silhouette */
+void hull_add_mask(Hull *hull, GdkPixbuf *pixbuf, guint32 angle)
+{
+	guint8 *mask, obj;
+	guint32 x, y, px, py;
+	gboolean first;
+
+	g_return_if_fail(angle < hull->n_angles);
+
+	first = (hull->masks[angle] == NULL);
+	if(first)
+		hull->masks[angle] = g_new(guint8, hull->res * hull->rows);
+	mask = hull->masks[angle];
+
+	for(y = 0; y < hull->rows; y ++) {
+		py = hull_cell_y(hull, y);
+		for(x = 0; x < hull->res; x ++) {
+			px = hull_cell_x(hull, x);
+			if(hull->src) {
+				px = hull->src[(y * hull->res + x) * 2];
+				py = hull->src[(y * hull->res + x) * 2 + 1];
+			}
+			obj = (hull_get_pixel(pixbuf, px, py)[0] == 0x00) ? 1 : 0;
+			if(first)
+				mask[y * hull->res + x] = obj;
+			else
+				mask[y * hull->res + x] &= obj;
+		}
+	}
+}
+
+/* the silhouettes of other, built from other frames of the same region,
+ * as if they had been added to hull */
+gboolean hull_merge(Hull *hull, Hull *other)
+{
+	guint32 i, j, n = hull->res * hull->rows;
+
+	if((other->n_angles != hull->n_angles) || (other->res != hull->res) ||
+		(other->rows != hull->rows)) {
+		g_warning("hull_merge: grids differ");
+		return FALSE;
+	}
+	for(i = 0; i < hull->n_angles; i ++) {
+		if(other->masks[i] == NULL)
+			continue;
+		if(hull->masks[i] == NULL) {
+			hull->masks[i] = g_memdup(other->masks[i], n);
+			continue;
+		}
+		for(j = 0; j < n; j ++)
+			hull->masks[i][j] &= other->masks[i][j];
+	}
+	return TRUE;
+}
+
+/*****************************************************************************/
+
+static inline guint32 hull_sat_count(guint32 *sat, guint32 res, gint32 c0,
+	gint32 c1, gint32 y0, gint32 y1)
+{
+	guint32 w = res + 1;
+
+	return sat[y1 * w + c1] - sat[y0 * w + c1] - sat[y1 * w + c0] +
+		sat[y0 * w + c0];
+}
+
+/* a view carves the box if the columns it projects to are empty in its
+ * silhouette; the box is inside if they are full in every view */
+static HullClass hull_classify(HullCarve *hc, gint32 x0, gint32 y0,
+	gint32 z0, gint32 x1, gint32 y1, gint32 z1)
+{
+	Hull *hull = hc->hull;
+	gfloat cx, cz, hx, hz, u, ext;
+	gint32 c0, c1;
+	guint32 v, count;
+	gboolean full = TRUE, clipped;
+
+	cx = (x0 + x1) / 2.0 - hull->res / 2.0;
+	cz = (z0 + z1) / 2.0 - hull->res / 2.0;
+	hx = (x1 - x0) / 2.0;
+	hz = (z1 - z0) / 2.0;
+
+	for(v = 0; v < hc->n_views; v ++) {
+		u = cx * hc->cos_a[v] - cz * hc->sin_a[v] + hull->res / 2.0;
+		ext = hx * fabs(hc->cos_a[v]) + hz * fabs(hc->sin_a[v]);
+		c0 = floor(u - ext);
+		c1 = ceil(u + ext);
+		clipped = (c0 < 0) || (c1 > (gint32)hull->res);
+		c0 = MAX(c0, 0);
+		c1 = MIN(c1, (gint32)hull->res);
+		if(c0 >= c1)
+			return HULL_OUT;
+		count = hull_sat_count(hc->sat[v], hull->res, c0, c1, y0, y1);
+		if(count == 0)
+			return HULL_OUT;
+		if(clipped || (count != (c1 - c0) * (y1 - y0)))
+			full = FALSE;
+	}
+	return full ? HULL_IN : HULL_PARTIAL;
+}
+
+static gboolean hull_cell_inside(HullCarve *hc, gint32 x, gint32 y, gint32 z)
+{
+	Hull *hull = hc->hull;
+	gfloat cx, cz, u;
+	gint32 col;
+	guint32 v;
+
+	cx = x + 0.5 - hull->res / 2.0;
+	cz = z + 0.5 - hull->res / 2.0;
+	for(v = 0; v < hc->n_views; v ++) {
+		u = cx * hc->cos_a[v] - cz * hc->sin_a[v] + hull->res / 2.0;
+		col = floor(u);
+		if((col < 0) || (col >= (gint32)hull->res) ||
+			!hc->masks[v][y * hull->res + col])
+			return FALSE;
+	}
+	return TRUE;
+}
+
+static void hull_carve_node(HullCarve *hc, gint32 x0, gint32 y0, gint32 z0,
+	gint32 size)
+{
+	Hull *hull = hc->hull;
+	gint32 x1, y1, z1, y, z, h;
+
+	x1 = MIN(x0 + size, (gint32)hull->res);
+	y1 = MIN(y0 + size, (gint32)hull->rows);
+	z1 = MIN(z0 + size, (gint32)hull->res);
+	if((x0 >= x1) || (y0 >= y1) || (z0 >= z1))
+		return;
+
+	if(size == 1) {
+		hc->grid[(y0 * hull->res + z0) * hull->res + x0] =
+			hull_cell_inside(hc, x0, y0, z0);
+		return;
+	}
+
+	switch(hull_classify(hc, x0, y0, z0, x1, y1, z1)) {
+		case HULL_OUT:
+			break;
+		case HULL_IN:
+			for(y = y0; y < y1; y ++)
+				for(z = z0; z < z1; z ++)
+					memset(hc->grid + (y * hull->res + z) * hull->res + x0, 1,
+						x1 - x0);
+			break;
+		case HULL_PARTIAL:
+			h = size / 2;
+			hull_carve_node(hc, x0,     y0,     z0,     h);
+			hull_carve_node(hc, x0 + h, y0,     z0,     h);
+			hull_carve_node(hc, x0,     y0 + h, z0,     h);
+			hull_carve_node(hc, x0 + h, y0 + h, z0,     h);
+			hull_carve_node(hc, x0,     y0,     z0 + h, h);
+			hull_carve_node(hc, x0 + h, y0,     z0 + h, h);
+			hull_carve_node(hc, x0,     y0 + h, z0 + h, h);
+			hull_carve_node(hc, x0 + h, y0 + h, z0 + h, h);
+			break;
+	}
+}
+
+static void hull_job_run(gpointer data, gpointer user_data)
+{
+	HullJob *job = data;
+
+	hull_carve_node(job->hc, job->x0, job->y0, job->z0, job->size);
+}
+
+/* subtrees below the level with enough nodes for all cpus are carved in
+ * parallel; they cover disjoint parts of the grid */
+static void hull_carve(HullCarve *hc)
+{
+	Hull *hull = hc->hull;
+	GThreadPool *pool;
+	HullJob *jobs;
+	guint32 n_threads, n_jobs = 0, side = 1, size, n_top = 1;
+	gint32 x, y, z;
+
+	while((side < hull->res) || (side < hull->rows))
+		side <<= 1;
+	n_threads = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+	size = side;
+	while((size > 1) && (n_top < n_threads * 4)) {
+		size >>= 1;
+		n_top *= 8;
+	}
+
+	jobs = g_new0(HullJob, n_top);
+	pool = g_thread_pool_new(hull_job_run, NULL, n_threads, TRUE, NULL);
+	for(y = 0; y < hull->rows; y += size)
+		for(z = 0; z < hull->res; z += size)
+			for(x = 0; x < hull->res; x += size) {
+				jobs[n_jobs].hc = hc;
+				jobs[n_jobs].x0 = x;
+				jobs[n_jobs].y0 = y;
+				jobs[n_jobs].z0 = z;
+				jobs[n_jobs].size = size;
+				g_thread_pool_push(pool, jobs + n_jobs, NULL);
+				n_jobs ++;
+			}
+	/* wait for all queued jobs */
+	g_thread_pool_free(pool, FALSE, TRUE);
+	g_free(jobs);
+}
+
+/* at most HULL_MAX_VIEWS of the seen angles, evenly spread */
+static gboolean hull_carve_init(HullCarve *hc, Hull *hull)
+{
+	guint32 i, n_seen = 0, stride, v, x, y, w;
+	guint32 *sat;
+	guint8 *mask;
+	gfloat a;
+
+	memset(hc, 0, sizeof(HullCarve));
+	hc->hull = hull;
+	for(i = 0; i < hull->n_angles; i ++)
+		if(hull->masks[i])
+			n_seen ++;
+	if(n_seen == 0)
+		return FALSE;
+	stride = (n_seen + HULL_MAX_VIEWS - 1) / HULL_MAX_VIEWS;
+
+	hc->cos_a = g_new(gfloat, HULL_MAX_VIEWS);
+	hc->sin_a = g_new(gfloat, HULL_MAX_VIEWS);
+	hc->masks = g_new(guint8 *, HULL_MAX_VIEWS);
+	hc->sat = g_new(guint32 *, HULL_MAX_VIEWS);
+	w = hull->res + 1;
+	for(i = 0, n_seen = 0; i < hull->n_angles; i ++) {
+		if(hull->masks[i] == NULL)
+			continue;
+		if((n_seen ++ % stride) != 0)
+			continue;
+		v = hc->n_views ++;
+		/* same rotation as the vertices in ac3d_write() */
+		a = G_PI * 2.0 * i / (gfloat)hull->n_angles;
+		hc->cos_a[v] = cos(a);
+		hc->sin_a[v] = sin(a);
+		mask = hc->masks[v] = hull->masks[i];
+		sat = hc->sat[v] = g_new0(guint32, w * (hull->rows + 1));
+		for(y = 0; y < hull->rows; y ++)
+			for(x = 0; x < hull->res; x ++)
+				sat[(y + 1) * w + x + 1] = mask[y * hull->res + x] +
+					sat[y * w + x + 1] + sat[(y + 1) * w + x] - sat[y * w + x];
+	}
+
+	hc->grid = g_new0(guint8, hull->res * hull->rows * hull->res);
+	return TRUE;
+}
+
+static void hull_carve_cleanup(HullCarve *hc)
+{
+	guint32 v;
+
+	for(v = 0; v < hc->n_views; v ++)
+		g_free(hc->sat[v]);
+	g_free(hc->sat);
+	g_free(hc->masks);
+	g_free(hc->cos_a);
+	g_free(hc->sin_a);
+	g_free(hc->grid);
+}
+
+/*****************************************************************************/
+
+/* surface extraction by marching tetrahedra: every cube between eight cell
+ * centers is split into six tetrahedra around its main diagonal, which
+ * needs no case tables and has no ambiguous cases */
+
+typedef struct {
+	Hull *hull;
+	GArray *verts;
+	GArray *tris;
+	GHashTable *edges;
+} HullMesh;
+
+static const guint8 hull_tetras[6][4] = {
+	{ 0, 1, 3, 7 }, { 0, 3, 2, 7 }, { 0, 2, 6, 7 },
+	{ 0, 6, 4, 7 }, { 0, 4, 5, 7 }, { 0, 5, 1, 7 }
+};
+
+static inline guint8 hull_sample(HullCarve *hc, gint32 x, gint32 y, gint32 z)
+{
+	Hull *hull = hc->hull;
+
+	if((x < 0) || (y < 0) || (z < 0) || (x >= (gint32)hull->res) ||
+		(y >= (gint32)hull->rows) || (z >= (gint32)hull->res))
+		return 0;
+	return hc->grid[(y * hull->res + z) * hull->res + x];
+}
+
+/* cell centers p and q are neighbours in the grid (coordinates -1 .. res),
+ * the vertex sits half way, in the object space of ac3d_write() */
+static guint32 hull_edge_vertex(HullMesh *mesh, gint32 *p, gint32 *q)
+{
+	Hull *hull = mesh->hull;
+	guint32 key, index;
+	gfloat v[3];
+
+	key = ((p[0] + q[0] + 2) << 21) | ((p[1] + q[1] + 2) << 10) |
+		(p[2] + q[2] + 2);
+	index = GPOINTER_TO_UINT(g_hash_table_lookup(mesh->edges,
+		GUINT_TO_POINTER(key)));
+	if(index != 0)
+		return index - 1;
+
+	v[0] = ((p[0] + q[0]) / 2.0 + 0.5 - hull->res / 2.0) * hull->cell;
+	v[1] = hull->rect.height - ((p[1] + q[1]) / 2.0 + 0.5) * hull->cell;
+	v[2] = ((p[2] + q[2]) / 2.0 + 0.5 - hull->res / 2.0) * hull->cell;
+	g_array_append_vals(mesh->verts, v, 3);
+	index = mesh->verts->len / 3;
+	g_hash_table_insert(mesh->edges, GUINT_TO_POINTER(key),
+		GUINT_TO_POINTER(index));
+	return index - 1;
+}
+
+/* wind the triangle so its normal points from the inside to the outside */
+static void hull_add_triangle(HullMesh *mesh, guint32 *t, gfloat *dir)
+{
+	gfloat *v = (gfloat *)mesh->verts->data, e1[3], e2[3], n[3];
+	guint32 tmp;
+	gint32 k;
+
+	for(k = 0; k < 3; k ++) {
+		e1[k] = v[t[1] * 3 + k] - v[t[0] * 3 + k];
+		e2[k] = v[t[2] * 3 + k] - v[t[0] * 3 + k];
+	}
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	if((n[0] * dir[0] + n[1] * dir[1] + n[2] * dir[2]) < 0) {
+		tmp = t[1];
+		t[1] = t[2];
+		t[2] = tmp;
+	}
+	g_array_append_vals(mesh->tris, t, 3);
+}
+
+static void hull_mesh_tetra(HullMesh *mesh, gint32 (*pos)[3], guint8 *in)
+{
+	gint32 ins[4], outs[4], n_in = 0, n_out = 0, i, k;
+	gfloat dir[3];
+	guint32 t[4], quad[3];
+
+	for(i = 0; i < 4; i ++) {
+		if(in[i])
+			ins[n_in ++] = i;
+		else
+			outs[n_out ++] = i;
+	}
+	if((n_in == 0) || (n_out == 0))
+		return;
+
+	/* inside to outside in object space, y is flipped there */
+	for(k = 0; k < 3; k ++) {
+		dir[k] = 0.0;
+		for(i = 0; i < n_out; i ++)
+			dir[k] += pos[outs[i]][k] / (gfloat)n_out;
+		for(i = 0; i < n_in; i ++)
+			dir[k] -= pos[ins[i]][k] / (gfloat)n_in;
+	}
+	dir[1] = -dir[1];
+
+	if(n_in == 1) {
+		for(i = 0; i < 3; i ++)
+			t[i] = hull_edge_vertex(mesh, pos[ins[0]], pos[outs[i]]);
+		hull_add_triangle(mesh, t, dir);
+	} else if(n_out == 1) {
+		for(i = 0; i < 3; i ++)
+			t[i] = hull_edge_vertex(mesh, pos[ins[i]], pos[outs[0]]);
+		hull_add_triangle(mesh, t, dir);
+	} else {
+		/* quad around the tetrahedron */
+		t[0] = hull_edge_vertex(mesh, pos[ins[0]], pos[outs[0]]);
+		t[1] = hull_edge_vertex(mesh, pos[ins[0]], pos[outs[1]]);
+		t[2] = hull_edge_vertex(mesh, pos[ins[1]], pos[outs[1]]);
+		t[3] = hull_edge_vertex(mesh, pos[ins[1]], pos[outs[0]]);
+		quad[0] = t[0];
+		quad[1] = t[2];
+		quad[2] = t[3];
+		hull_add_triangle(mesh, t, dir);
+		hull_add_triangle(mesh, quad, dir);
+	}
+}
+
+static void hull_mesh(HullCarve *hc, HullMesh *mesh)
+{
+	Hull *hull = hc->hull;
+	gint32 x, y, z, c, i, pos[8][3], tpos[4][3];
+	guint8 in[8], tin[4], sum;
+
+	for(y = -1; y < (gint32)hull->rows; y ++)
+		for(z = -1; z < (gint32)hull->res; z ++)
+			for(x = -1; x < (gint32)hull->res; x ++) {
+				sum = 0;
+				for(c = 0; c < 8; c ++) {
+					pos[c][0] = x + (c & 1);
+					pos[c][1] = y + ((c >> 1) & 1);
+					pos[c][2] = z + ((c >> 2) & 1);
+					in[c] = hull_sample(hc, pos[c][0], pos[c][1], pos[c][2]);
+					sum += in[c];
+				}
+				if((sum == 0) || (sum == 8))
+					continue;
+				for(i = 0; i < 6; i ++) {
+					for(c = 0; c < 4; c ++) {
+						memcpy(tpos[c], pos[hull_tetras[i][c]],
+							3 * sizeof(gint32));
+						tin[c] = in[hull_tetras[i][c]];
+					}
+					hull_mesh_tetra(mesh, tpos, tin);
+				}
+			}
+}
+
+gboolean hull_save(Hull *hull, const gchar *filename,
+	Ac3dProgressFunc progress, gpointer user_data)
+{
+	HullCarve hc;
+	HullMesh mesh;
+	gboolean retval;
+
+	if(!hull_carve_init(&hc, hull)) {
+		g_warning("hull: no silhouettes to carve from");
+		return FALSE;
+	}
+	hull_carve(&hc);
+
+	mesh.hull = hull;
+	mesh.verts = g_array_new(FALSE, FALSE, sizeof(gfloat));
+	mesh.tris = g_array_new(FALSE, FALSE, sizeof(guint32));
+	mesh.edges = g_hash_table_new(g_direct_hash, g_direct_equal);
+	hull_mesh(&hc, &mesh);
+	hull_carve_cleanup(&hc);
+
+	g_debug("hull: %d views, %d vertices, %d triangles", hc.n_views,
+		mesh.verts->len / 3, mesh.tris->len / 3);
+	retval = ac3d_write_mesh(filename, (gfloat *)mesh.verts->data,
+		mesh.verts->len / 3, (guint32 *)mesh.tris->data, mesh.tris->len / 3,
+		progress, user_data);
+
+	g_hash_table_destroy(mesh.edges);
+	g_array_free(mesh.tris, TRUE);
+	g_array_free(mesh.verts, TRUE);
+	return retval;
+}
@@ -0,0 +1,38 @@
+#ifndef _HULL_H
+#define _HULL_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "region.h"
+#include "ac3d.h"
+#include "lens.h"
+
+#define HULL_MAX_VIEWS 256
+
+/* silhouettes of the object region for the visual hull, downsampled to
+ * cells of the voxel grid: res cells across the region, rows cells up from
+ * its bottom edge; an angle without mask has not been seen yet. With a
+ * lens, src holds the frame pixel of every cell (index: (y * res + x) * 2),
+ * see lens_map_point() */
+typedef struct {
+	guint32 n_angles;
+	GdkRectangle rect;
+	guint32 res;
+	guint32 rows;
+	gfloat cell;
+	guint8 **masks;
+	guint16 *src;
+} Hull;
+
+Hull *hull_new(guint32 n_angles, GdkRectangle *rect, guint32 depth,
+	LensParams *lens);
+Hull *hull_copy(Hull *hull);
+void hull_free(Hull *hull);
+void hull_clear(Hull *hull);
+void hull_add_mask(Hull *hull, GdkPixbuf *pixbuf, guint32 angle);
+gboolean hull_merge(Hull *hull, Hull *other);
+gboolean hull_save(Hull *hull, const gchar *filename,
+	Ac3dProgressFunc progress, gpointer user_data);
+
+#endif
@@ -0,0 +1,689 @@
+#include <math.h>
+#include <string.h>
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "lens.h"
+#include "config.h"
+
+/* coefficients are stored in millionths, config values are integers */
+#define LENS_SCALE 1000000.0
+
+/* ring of the corner detector and the limits of the grid search */
+#define LENS_RADIUS 5
+#define LENS_GRID 48
+#define LENS_MIN_LINE 4
+
+typedef struct {
+	gfloat x, y;
+	gboolean used;
+} LensCorner;
+
+typedef struct {
+	/* normalized frame coordinates of the corners, one line after the
+	 * other */
+	gdouble *points;
+	guint32 n_points;
+	guint32 *starts;
+	guint32 *lengths;
+	guint32 n_lines;
+} LensLines;
+
+gboolean lens_load_config(LensParams *lens, Config *config,
+	const gchar *section)
+{
+	memset(lens, 0, sizeof(LensParams));
+	lens->width = config_get_int(config, section, "width", 0);
+	lens->height = config_get_int(config, section, "height", 0);
+	lens->k1 = config_get_int(config, section, "k1", 0) / LENS_SCALE;
+	lens->k2 = config_get_int(config, section, "k2", 0) / LENS_SCALE;
+	lens->p1 = config_get_int(config, section, "p1", 0) / LENS_SCALE;
+	lens->p2 = config_get_int(config, section, "p2", 0) / LENS_SCALE;
+
+	return (lens->width > 0) && (lens->height > 0) &&
+		((lens->k1 != 0.0) || (lens->k2 != 0.0) ||
+		(lens->p1 != 0.0) || (lens->p2 != 0.0));
+}
+
+void lens_save_config(LensParams *lens, Config *config, const gchar *section)
+{
+	config_set_int(config, section, "width", lens->width);
+	config_set_int(config, section, "height", lens->height);
+	config_set_int(config, section, "k1", floor(lens->k1 * LENS_SCALE + 0.5));
+	config_set_int(config, section, "k2", floor(lens->k2 * LENS_SCALE + 0.5));
+	config_set_int(config, section, "p1", floor(lens->p1 * LENS_SCALE + 0.5));
+	config_set_int(config, section, "p2", floor(lens->p2 * LENS_SCALE + 0.5));
+}
+
+static inline void lens_distort_norm(const gdouble *k, gdouble x, gdouble y,
+	gdouble *xd, gdouble *yd)
+{
+	gdouble r2, rad;
+
+	r2 = x * x + y * y;
+	rad = 1.0 + k[0] * r2 + k[1] * r2 * r2;
+	*xd = x * rad + 2.0 * k[2] * x * y + k[3] * (r2 + 2.0 * x * x);
+	*yd = y * rad + k[2] * (r2 + 2.0 * y * y) + 2.0 * k[3] * x * y;
+}
+
+/* the model maps undistorted to distorted positions, the way back is a
+ * fixed point iteration; it fails where the coefficients fold the image,
+ * i.e. no undistorted position maps to the distorted one */
+static gboolean lens_undistort_norm(const gdouble *k, gdouble xd,
+	gdouble yd, gdouble *x, gdouble *y)
+{
+	gdouble r2, rad, dx, dy, nx, ny;
+	gint32 i;
+
+	*x = xd;
+	*y = yd;
+	/* converge well below the step of the numerical jacobian */
+	for(i = 0; i < 200; i ++) {
+		r2 = *x * *x + *y * *y;
+		rad = 1.0 + k[0] * r2 + k[1] * r2 * r2;
+		if(rad < 0.1)
+			return FALSE;
+		dx = 2.0 * k[2] * *x * *y + k[3] * (r2 + 2.0 * *x * *x);
+		dy = k[2] * (r2 + 2.0 * *y * *y) + 2.0 * k[3] * *x * *y;
+		nx = (xd - dx) / rad;
+		ny = (yd - dy) / rad;
+		if((fabs(nx - *x) + fabs(ny - *y)) < 1e-13) {
+			*x = nx;
+			*y = ny;
+			return TRUE;
+		}
+		*x = nx;
+		*y = ny;
+	}
+	return FALSE;
+}
+
+/* pixel position in the raw frame of the undistorted pixel (x, y) */
+void lens_distort(LensParams *lens, gfloat x, gfloat y, gfloat *xd,
+	gfloat *yd)
+{
+	gdouble k[4], cx, cy, f, dx, dy;
+
+	k[0] = lens->k1;
+	k[1] = lens->k2;
+	k[2] = lens->p1;
+	k[3] = lens->p2;
+	cx = lens->width / 2.0;
+	cy = lens->height / 2.0;
+	f = sqrt(cx * cx + cy * cy);
+	lens_distort_norm(k, (x - cx) / f, (y - cy) / f, &dx, &dy);
+	*xd = dx * f + cx;
+	*yd = dy * f + cy;
+}
+
+/*****************************************************************************/
+
+static const gint8 lens_ring[16][2] = {
+	{  5,  0 }, {  5,  2 }, {  4,  4 }, {  2,  5 },
+	{  0,  5 }, { -2,  5 }, { -4,  4 }, { -5,  2 },
+	{ -5,  0 }, { -5, -2 }, { -4, -4 }, { -2, -5 },
+	{  0, -5 }, {  2, -5 }, {  4, -4 }, {  5, -2 }
+};
+
+/* checkerboard corner response: opposite quadrants of the ring around an
+ * X-junction are alike, neighbouring ones differ, while edges and single
+ * blobs are penalized by the difference of opposite samples and of the
+ * ring mean to the center */
+static gfloat *lens_response(GdkPixbuf *pixbuf, guint32 *width,
+	guint32 *height)
+{
+	guint8 *pixels, *pix;
+	gfloat *gray, *resp, ring[16], sr, dr, mean, local;
+	guint32 w, h, rs, nc;
+	gint32 x, y, n, dx, dy;
+
+	w = *width = gdk_pixbuf_get_width(pixbuf);
+	h = *height = gdk_pixbuf_get_height(pixbuf);
+	pixels = gdk_pixbuf_get_pixels(pixbuf);
+	rs = gdk_pixbuf_get_rowstride(pixbuf);
+	nc = gdk_pixbuf_get_n_channels(pixbuf);
+
+	gray = g_new(gfloat, w * h);
+	for(y = 0; y < h; y ++)
+		for(x = 0; x < w; x ++) {
+			pix = pixels + y * rs + x * nc;
+			gray[y * w + x] = 0.299 * pix[0] + 0.587 * pix[1] +
+				0.114 * pix[2];
+		}
+
+	resp = g_new0(gfloat, w * h);
+	for(y = LENS_RADIUS + 1; y < (gint32)h - LENS_RADIUS - 1; y ++)
+		for(x = LENS_RADIUS + 1; x < (gint32)w - LENS_RADIUS - 1; x ++) {
+			mean = 0.0;
+			for(n = 0; n < 16; n ++) {
+				ring[n] = gray[(y + lens_ring[n][1]) * w + x + lens_ring[n][0]];
+				mean += ring[n] / 16.0;
+			}
+			sr = dr = 0.0;
+			for(n = 0; n < 4; n ++)
+				sr += fabs((ring[n] + ring[n + 8]) -
+					(ring[n + 4] + ring[n + 12]));
+			for(n = 0; n < 8; n ++)
+				dr += fabs(ring[n] - ring[n + 8]);
+			local = 0.0;
+			for(dy = -1; dy <= 1; dy ++)
+				for(dx = -1; dx <= 1; dx ++)
+					local += gray[(y + dy) * w + x + dx] / 9.0;
+			resp[y * w + x] = sr - dr - 16.0 * fabs(mean - local);
+		}
+	g_free(gray);
+	return resp;
+}
+
+/* local maxima of the response above a fraction of the strongest one,
+ * refined to the centroid of the response around them */
+static LensCorner *lens_find_corners(gfloat *resp, guint32 w, guint32 h,
+	guint32 *n_corners)
+{
+	GArray *corners;
+	LensCorner corner;
+	gfloat rmax = 0.0, r, sx, sy, sw;
+	gint32 x, y, dx, dy, i;
+	gboolean is_max;
+
+	for(i = 0; i < w * h; i ++)
+		rmax = MAX(rmax, resp[i]);
+
+	corners = g_array_new(FALSE, FALSE, sizeof(LensCorner));
+	for(y = 3; y < (gint32)h - 3; y ++)
+		for(x = 3; x < (gint32)w - 3; x ++) {
+			r = resp[y * w + x];
+			if((r <= 0.0) || (r < rmax * 0.2))
+				continue;
+			is_max = TRUE;
+			for(dy = -3; is_max && (dy <= 3); dy ++)
+				for(dx = -3; dx <= 3; dx ++) {
+					/* plateaus keep their first pixel */
+					if((resp[(y + dy) * w + x + dx] > r) ||
+						(((dy < 0) || ((dy == 0) && (dx < 0))) &&
+						(resp[(y + dy) * w + x + dx] == r))) {
+						is_max = FALSE;
+						break;
+					}
+				}
+			if(!is_max)
+				continue;
+			sx = sy = sw = 0.0;
+			for(dy = -2; dy <= 2; dy ++)
+				for(dx = -2; dx <= 2; dx ++) {
+					r = MAX(resp[(y + dy) * w + x + dx], 0.0);
+					sx += r * (x + dx);
+					sy += r * (y + dy);
+					sw += r;
+				}
+			corner.x = sx / sw;
+			corner.y = sy / sw;
+			corner.used = FALSE;
+			g_array_append_vals(corners, &corner, 1);
+		}
+
+	*n_corners = corners->len;
+	return (LensCorner *)g_array_free(corners, FALSE);
+}
+
+static inline gfloat lens_length(gfloat x, gfloat y)
+{
+	return sqrt(x * x + y * y);
+}
+
+static gint32 lens_nearest(LensCorner *corners, guint32 n_corners,
+	gfloat x, gfloat y, gfloat max_dist)
+{
+	gfloat d, best = max_dist * max_dist;
+	gint32 i, found = -1;
+
+	for(i = 0; i < n_corners; i ++) {
+		if(corners[i].used)
+			continue;
+		d = (corners[i].x - x) * (corners[i].x - x) +
+			(corners[i].y - y) * (corners[i].y - y);
+		if(d < best) {
+			best = d;
+			found = i;
+		}
+	}
+	return found;
+}
+
+/* grow the board from the corner next to the frame center, predicting
+ * every neighbour from the step which led to its parent, so the grid
+ * follows the distortion; the rows and columns of the board become the
+ * lines which the calibration straightens */
+static gboolean lens_find_lines(LensCorner *corners, guint32 n_corners,
+	guint32 w, guint32 h, LensLines *lines)
+{
+	gint32 *cell, *queue, seed, n1 = -1, k, i, j, c, nc, step, dir;
+	gint32 head = 0, tail = 0, size = 2 * LENS_GRID + 1;
+	gfloat *basis, d, best, ux, uy, vx, vy, px, py, len, cx, cy, f;
+	gboolean row;
+
+	if(n_corners < 9)
+		return FALSE;
+
+	seed = lens_nearest(corners, n_corners, w / 2.0, h / 2.0, w + h);
+	corners[seed].used = TRUE;
+	best = w + h;
+	for(k = 0; k < n_corners; k ++) {
+		d = lens_length(corners[k].x - corners[seed].x,
+			corners[k].y - corners[seed].y);
+		if((k != seed) && (d < best)) {
+			best = d;
+			n1 = k;
+		}
+	}
+	ux = (corners[n1].x - corners[seed].x) / best;
+	uy = (corners[n1].y - corners[seed].y) / best;
+	vx = vy = 0.0;
+	len = w + h;
+	for(k = 0; k < n_corners; k ++) {
+		if(k == seed)
+			continue;
+		px = corners[k].x - corners[seed].x;
+		py = corners[k].y - corners[seed].y;
+		d = lens_length(px, py);
+		if((fabs(px * ux + py * uy) < 0.5 * d) && (d < len)) {
+			len = d;
+			vx = px;
+			vy = py;
+		}
+	}
+	if(len >= w + h)
+		return FALSE;
+
+	cell = g_new(gint32, size * size);
+	for(k = 0; k < size * size; k ++)
+		cell[k] = -1;
+	/* steps to the next corner along the row and the column */
+	basis = g_new(gfloat, size * size * 4);
+	queue = g_new(gint32, size * size);
+
+	c = LENS_GRID * size + LENS_GRID;
+	cell[c] = seed;
+	basis[c * 4 + 0] = ux * best;
+	basis[c * 4 + 1] = uy * best;
+	basis[c * 4 + 2] = vx;
+	basis[c * 4 + 3] = vy;
+	queue[tail ++] = c;
+
+	while(head < tail) {
+		c = queue[head ++];
+		i = c % size;
+		j = c / size;
+		for(dir = 0; dir < 4; dir ++) {
+			row = (dir < 2);
+			step = (dir & 1) ? -1 : 1;
+			nc = row ? (c + step) : (c + step * size);
+			if(row ? ((i + step < 0) || (i + step >= size)) :
+				((j + step < 0) || (j + step >= size)))
+				continue;
+			if(cell[nc] >= 0)
+				continue;
+			px = corners[cell[c]].x + step * basis[c * 4 + (row ? 0 : 2)];
+			py = corners[cell[c]].y + step * basis[c * 4 + (row ? 1 : 3)];
+			len = MIN(lens_length(basis[c * 4 + 0], basis[c * 4 + 1]),
+				lens_length(basis[c * 4 + 2], basis[c * 4 + 3]));
+			k = lens_nearest(corners, n_corners, px, py, len * 0.35);
+			if(k < 0)
+				continue;
+			corners[k].used = TRUE;
+			cell[nc] = k;
+			memcpy(basis + nc * 4, basis + c * 4, 4 * sizeof(gfloat));
+			basis[nc * 4 + (row ? 0 : 2)] =
+				(corners[k].x - corners[cell[c]].x) * step;
+			basis[nc * 4 + (row ? 1 : 3)] =
+				(corners[k].y - corners[cell[c]].y) * step;
+			queue[tail ++] = nc;
+		}
+	}
+
+	/* normalized coordinates, see lens_distort() */
+	cx = w / 2.0;
+	cy = h / 2.0;
+	f = sqrt(cx * cx + cy * cy);
+	memset(lines, 0, sizeof(LensLines));
+	lines->points = g_new(gdouble, tail * 2 * 2);
+	lines->starts = g_new(guint32, size * 2);
+	lines->lengths = g_new(guint32, size * 2);
+	for(dir = 0; dir < 2; dir ++)
+		for(j = 0; j < size; j ++) {
+			lines->starts[lines->n_lines] = lines->n_points;
+			lines->lengths[lines->n_lines] = 0;
+			for(i = 0; i < size; i ++) {
+				c = dir ? (i * size + j) : (j * size + i);
+				if(cell[c] < 0)
+					continue;
+				lines->points[lines->n_points * 2 + 0] =
+					(corners[cell[c]].x - cx) / f;
+				lines->points[lines->n_points * 2 + 1] =
+					(corners[cell[c]].y - cy) / f;
+				lines->n_points ++;
+				lines->lengths[lines->n_lines] ++;
+			}
+			if(lines->lengths[lines->n_lines] >= LENS_MIN_LINE)
+				lines->n_lines ++;
+			else
+				lines->n_points = lines->starts[lines->n_lines];
+		}
+
+	g_debug("lens: %d of %d corners on the board, %d lines", tail,
+		n_corners, lines->n_lines);
+
+	g_free(queue);
+	g_free(basis);
+	g_free(cell);
+	return (lines->n_lines >= 6);
+}
+
+/* distance of the undistorted corners to the line fitted through them,
+ * relative to the extent of the line so that shrinking all points does
+ * not pay off */
+static gboolean lens_residuals(LensLines *lines, const gdouble *k,
+	gdouble *res)
+{
+	gdouble *u, mx, my, sxx, sxy, syy, theta, nx, ny, lmax, scale;
+	guint32 l, n, p;
+
+	u = g_new(gdouble, lines->n_points * 2);
+	for(p = 0; p < lines->n_points; p ++)
+		if(!lens_undistort_norm(k, lines->points[p * 2],
+			lines->points[p * 2 + 1], u + p * 2, u + p * 2 + 1)) {
+			g_free(u);
+			return FALSE;
+		}
+
+	for(l = 0; l < lines->n_lines; l ++) {
+		n = lines->lengths[l];
+		mx = my = 0.0;
+		for(p = lines->starts[l]; p < lines->starts[l] + n; p ++) {
+			mx += u[p * 2] / n;
+			my += u[p * 2 + 1] / n;
+		}
+		sxx = sxy = syy = 0.0;
+		for(p = lines->starts[l]; p < lines->starts[l] + n; p ++) {
+			sxx += (u[p * 2] - mx) * (u[p * 2] - mx);
+			sxy += (u[p * 2] - mx) * (u[p * 2 + 1] - my);
+			syy += (u[p * 2 + 1] - my) * (u[p * 2 + 1] - my);
+		}
+		/* the normal keeps its side of the line from the first to the
+		 * last corner, or the jacobian of vertical lines is garbage */
+		theta = 0.5 * atan2(2.0 * sxy, sxx - syy);
+		nx = -sin(theta);
+		ny = cos(theta);
+		p = lines->starts[l];
+		if((ny * (u[(p + n - 1) * 2] - u[p * 2]) -
+			nx * (u[(p + n - 1) * 2 + 1] - u[p * 2 + 1])) < 0.0) {
+			nx = -nx;
+			ny = -ny;
+		}
+		lmax = (sxx + syy) / 2.0 +
+			sqrt((sxx - syy) * (sxx - syy) / 4.0 + sxy * sxy);
+		scale = sqrt(MAX(lmax / n, 1e-12));
+		for(p = lines->starts[l]; p < lines->starts[l] + n; p ++)
+			res[p] = (nx * (u[p * 2] - mx) + ny * (u[p * 2 + 1] - my)) /
+				scale;
+	}
+	g_free(u);
+	return TRUE;
+}
+
+static gdouble lens_cost(LensLines *lines, const gdouble *k, gdouble *res)
+{
+	gdouble sum = 0.0;
+	guint32 p;
+
+	if(!lens_residuals(lines, k, res))
+		return G_MAXDOUBLE;
+	for(p = 0; p < lines->n_points; p ++)
+		sum += res[p] * res[p];
+	return sum;
+}
+
+/* solves a x = b in place for the 4x4 normal equations */
+static gboolean lens_solve4(gdouble a[4][4], gdouble *b)
+{
+	gdouble f, t;
+	gint32 i, j, k, pivot;
+
+	for(i = 0; i < 4; i ++) {
+		pivot = i;
+		for(j = i + 1; j < 4; j ++)
+			if(fabs(a[j][i]) > fabs(a[pivot][i]))
+				pivot = j;
+		if(fabs(a[pivot][i]) < 1e-15)
+			return FALSE;
+		for(k = 0; k < 4; k ++) {
+			t = a[i][k];
+			a[i][k] = a[pivot][k];
+			a[pivot][k] = t;
+		}
+		t = b[i];
+		b[i] = b[pivot];
+		b[pivot] = t;
+		for(j = i + 1; j < 4; j ++) {
+			f = a[j][i] / a[i][i];
+			for(k = i; k < 4; k ++)
+				a[j][k] -= f * a[i][k];
+			b[j] -= f * b[i];
+		}
+	}
+	for(i = 3; i >= 0; i --) {
+		for(k = i + 1; k < 4; k ++)
+			b[i] -= a[i][k] * b[k];
+		b[i] /= a[i][i];
+	}
+	return TRUE;
+}
+
+/* central differences, tmp holds one set of residuals */
+static gboolean lens_jacobian(LensLines *lines, const gdouble *k,
+	gdouble *jac, gdouble *tmp)
+{
+	gdouble kn[4], h = 1e-6;
+	guint32 n = lines->n_points, p, i;
+
+	for(i = 0; i < 4; i ++) {
+		memcpy(kn, k, sizeof(kn));
+		kn[i] += h;
+		if(!lens_residuals(lines, kn, tmp))
+			return FALSE;
+		for(p = 0; p < n; p ++)
+			jac[p * 4 + i] = tmp[p];
+		kn[i] -= 2.0 * h;
+		if(!lens_residuals(lines, kn, tmp))
+			return FALSE;
+		for(p = 0; p < n; p ++)
+			jac[p * 4 + i] = (jac[p * 4 + i] - tmp[p]) / (2.0 * h);
+	}
+	return TRUE;
+}
+
+/* plumb-line calibration: Levenberg-Marquardt on the straightness of the
+ * board lines; steps into coefficients which fold the image are rejected
+ * like steps which raise the cost */
+static void lens_fit(LensLines *lines, gdouble *k)
+{
+	gdouble *res, *jac, *tmp, a[4][4], g[4], la[4][4], lg[4], kn[4], cost,
+		ncost = 0.0, lambda = 1e-3;
+	guint32 n = lines->n_points, p, i, j, iter;
+
+	res = g_new(gdouble, n);
+	tmp = g_new(gdouble, n);
+	jac = g_new(gdouble, n * 4);
+	cost = lens_cost(lines, k, res);
+	g_debug("lens: initial cost %g", cost);
+
+	for(iter = 0; iter < 100; iter ++) {
+		if(!lens_jacobian(lines, k, jac, tmp))
+			break;
+		for(i = 0; i < 4; i ++) {
+			g[i] = 0.0;
+			for(j = 0; j < 4; j ++)
+				a[i][j] = 0.0;
+			for(p = 0; p < n; p ++) {
+				g[i] -= jac[p * 4 + i] * res[p];
+				for(j = 0; j < 4; j ++)
+					a[i][j] += jac[p * 4 + i] * jac[p * 4 + j];
+			}
+		}
+		/* raise the damping until a step lowers the cost */
+		while(lambda < 1e10) {
+			memcpy(la, a, sizeof(la));
+			memcpy(lg, g, sizeof(lg));
+			for(i = 0; i < 4; i ++)
+				la[i][i] += lambda * (a[i][i] + 1e-9);
+			if(lens_solve4(la, lg)) {
+				for(i = 0; i < 4; i ++)
+					kn[i] = k[i] + lg[i];
+				ncost = lens_cost(lines, kn, tmp);
+				if(ncost < cost)
+					break;
+			}
+			lambda *= 10.0;
+		}
+		if(lambda >= 1e10)
+			break;
+		lambda = MAX(lambda / 10.0, 1e-9);
+		memcpy(k, kn, sizeof(kn));
+		memcpy(res, tmp, n * sizeof(gdouble));
+		if(cost - ncost < cost * 1e-9) {
+			cost = ncost;
+			break;
+		}
+		cost = ncost;
+	}
+	g_debug("lens: final cost %g after %d iterations", cost, iter);
+
+	g_free(jac);
+	g_free(tmp);
+	g_free(res);
+}
+
+/* pixbuf is a frame of a flat checkerboard, ideally covering the field of
+ * view; the board size does not need to be known */
+gboolean lens_calibrate(GdkPixbuf *pixbuf, LensParams *lens)
+{
+	LensCorner *corners;
+	LensLines lines;
+	gfloat *resp;
+	gdouble k[4] = { 0.0, 0.0, 0.0, 0.0 };
+	guint32 w, h, n_corners;
+	gboolean found;
+
+	memset(&lines, 0, sizeof(LensLines));
+	resp = lens_response(pixbuf, &w, &h);
+	corners = lens_find_corners(resp, w, h, &n_corners);
+	g_free(resp);
+
+	found = lens_find_lines(corners, n_corners, w, h, &lines);
+	g_free(corners);
+	if(!found) {
+		g_warning("lens: no checkerboard found");
+		g_free(lines.points);
+		g_free(lines.starts);
+		g_free(lines.lengths);
+		return FALSE;
+	}
+
+	lens_fit(&lines, k);
+	g_free(lines.points);
+	g_free(lines.starts);
+	g_free(lines.lengths);
+
+	lens->width = w;
+	lens->height = h;
+	lens->k1 = k[0];
+	lens->k2 = k[1];
+	lens->p1 = k[2];
+	lens->p2 = k[3];
+	return TRUE;
+}
+
+/*****************************************************************************/
+
+/* source pixel of the undistorted position x, y, kept inside clip */
+void lens_map_point(LensParams *lens, guint32 x, guint32 y,
+	GdkRectangle *clip, guint16 *src)
+{
+	gfloat xd, yd;
+
+	lens_distort(lens, x, y, &xd, &yd);
+	src[0] = CLAMP((gint32)floor(xd + 0.5), clip->x,
+		clip->x + clip->width - 1);
+	src[1] = CLAMP((gint32)floor(yd + 0.5), clip->y,
+		clip->y + clip->height - 1);
+}
+
+/* rows are placed as in scan_angle(), gray-code points as in
+ * scan_update_bits() and texels as in scan_texture(); sources stay inside
+ * the object region, which is all that is binarized, one pixel inside the
+ * frame for the gray-code neighbours and inside the frame for texels */
+LensMap *lens_map_new(LensParams *lens, GdkRectangle *object,
+	guint32 n_rows, GdkRectangle *graycode, GrayCode *code,
+	guint32 tex_rows, guint32 tex_band)
+{
+	LensMap *map;
+	GdkRectangle frame;
+	guint32 i, k, x, y;
+	gint32 x0;
+	gfloat sh;
+
+	map = g_new0(LensMap, 1);
+	map->n_rows = n_rows;
+	map->width = object->width;
+	map->n_bits = code->n_bits;
+	map->rows = g_new0(guint16, n_rows * object->width * 2);
+	map->gray = g_new0(guint16, code->n_bits * 2);
+	map->tex_rows = tex_rows;
+	map->tex_band = tex_band;
+	map->tex = g_new0(guint16, tex_rows * tex_band * 2);
+
+	if((object->width > 0) && (object->height > 0)) {
+		sh = (gfloat)object->height / n_rows;
+		for(i = 0; i < n_rows; i ++) {
+			y = (object->y + object->height - 1) - i * sh - sh / 2;
+			for(x = 0; x < object->width; x ++)
+				lens_map_point(lens, object->x + x, y, object,
+					map->rows + (i * object->width + x) * 2);
+		}
+	}
+
+	frame.x = 1;
+	frame.y = 1;
+	frame.width = lens->width - 2;
+	frame.height = lens->height - 2;
+	if((graycode->width > 0) && (graycode->height > 0)) {
+		for(i = 0; i < code->n_bits; i ++) {
+			gray_code_point(code, graycode, i, &x, &y);
+			lens_map_point(lens, x, y, &frame, map->gray + i * 2);
+		}
+	}
+
+	frame.x = frame.y = 0;
+	frame.width = lens->width;
+	frame.height = lens->height;
+	if((object->width > 0) && (object->height > 0) && (tex_band > 0)) {
+		sh = (gfloat)object->height / tex_rows;
+		x0 = object->x + object->width / 2 + tex_band / 2 - 1;
+		for(i = 0; i < tex_rows; i ++) {
+			y = object->y + (gint32)(i * sh + sh / 2);
+			for(k = 0; k < tex_band; k ++)
+				lens_map_point(lens, MAX(x0 - (gint32)k, 0), y, &frame,
+					map->tex + (i * tex_band + k) * 2);
+		}
+	}
+	return map;
+}
+
+void lens_map_free(LensMap *map)
+{
+	g_free(map->tex);
+	g_free(map->rows);
+	g_free(map->gray);
+	g_free(map);
+}
@@ -0,0 +1,52 @@
+#ifndef _LENS_H
+#define _LENS_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "config.h"
+#include "region.h"
+#include "gray.h"
+
+/* radial (k1, k2) and tangential (p1, p2) distortion of the frames the
+ * coefficients were fitted to, in coordinates relative to the frame
+ * center and normalized by half the frame diagonal */
+typedef struct {
+	guint32 width;
+	guint32 height;
+	gfloat k1, k2;
+	gfloat p1, p2;
+} LensParams;
+
+/* source pixels in the raw frame for the positions the scanner samples:
+ * every column of the object region on the n_rows scanlines (index:
+ * (row * width + column) * 2), the n_bits gray-code points (index:
+ * bit * 2, see gray_code_point()) and the tex_band columns of the
+ * tex_rows texture rows (index: (row * tex_band + k) * 2); only valid for
+ * frames of lens->width x lens->height */
+typedef struct {
+	guint32 n_rows;
+	guint32 width;
+	guint16 *rows;
+	guint32 n_bits;
+	guint16 *gray;
+	guint32 tex_rows;
+	guint32 tex_band;
+	guint16 *tex;
+} LensMap;
+
+gboolean lens_load_config(LensParams *lens, Config *config,
+	const gchar *section);
+void lens_save_config(LensParams *lens, Config *config, const gchar *section);
+void lens_distort(LensParams *lens, gfloat x, gfloat y, gfloat *xd,
+	gfloat *yd);
+gboolean lens_calibrate(GdkPixbuf *pixbuf, LensParams *lens);
+
+void lens_map_point(LensParams *lens, guint32 x, guint32 y,
+	GdkRectangle *clip, guint16 *src);
+LensMap *lens_map_new(LensParams *lens, GdkRectangle *object,
+	guint32 n_rows, GdkRectangle *graycode, GrayCode *code,
+	guint32 tex_rows, guint32 tex_band);
+void lens_map_free(LensMap *map);
+
+#endif
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <locale.h>
 
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -16,42 +17,170 @@
 #include "config.h"
 #include "scan.h"
 #include "model.h"
+#include "merge.h"
+#include "headless.h"
+#include "lens.h"
+#include "publish.h"
+#include "pipeline.h"
+#include "obslog.h"
+#include "export.h"
 
+static gchar *opt_merge = NULL;
+static gint opt_min_overlap = 8;
+static gboolean opt_headless = FALSE;
+static gchar *opt_output = NULL;
+static gint opt_timeout = -1;
+static gboolean opt_calibrate = FALSE;
+
+static GOptionEntry main_options[] = {
+	{ "merge", 'm', 0, G_OPTION_ARG_FILENAME, &opt_merge,
+		"merge the session files given as arguments into OUTPUT", "OUTPUT" },
+	{ "min-overlap", 0, 0, G_OPTION_ARG_INT, &opt_min_overlap,
+		"minimum number of rows shared by merged sessions", "ROWS" },
+	{ "headless", 'b', 0, G_OPTION_ARG_NONE, &opt_headless,
+		"scan without a display until done, then save the model", NULL },
+	{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output,
+		"model file written in headless mode", "FILE" },
+	{ "timeout", 't', 0, G_OPTION_ARG_INT, &opt_timeout,
+		"give up a headless scan after SECONDS", "SECONDS" },
+	{ "calibrate", 0, 0, G_OPTION_ARG_NONE, &opt_calibrate,
+		"fit the lens distortion to a checkerboard in the image given as "
+		"argument or in a camera frame", NULL },
+	{ NULL }
+};
+
+static gboolean scanner_calibrate(const gchar *filename);
+static gboolean scanner_init_cameras(G3DScanner *scanner);
+static void scanner_cleanup_cameras(G3DScanner *scanner);
+static void scanner_publish_cleanup(G3DScanner *scanner);
+static void scanner_pipeline_cleanup(G3DScanner *scanner);
+static void scanner_obslog_cleanup(G3DScanner *scanner);
 static gboolean idle_func(gpointer data);
+static gboolean pipeline_idle_func(gpointer data);
+static gboolean pipeline_debug_func(gpointer data);
 static gboolean main_quit(gpointer window, GdkEvent *ev, G3DScanner *scanner);
 
 int main(int argc, char *argv[])
 {
 	G3DScanner *scanner;
+	GOptionContext *context;
+	GError *error = NULL;
+	gchar *filename;
+	guint32 depth;
+	gboolean retval;
+
+	context = g_option_context_new("[SESSION...]");
+	g_option_context_add_main_entries(context, main_options, NULL);
+	g_option_context_add_group(context, gtk_get_option_group(FALSE));
+	if(!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(context);
+
+	if(!g_thread_supported())
+		g_thread_init(NULL);
 
-	gtk_init(&argc, &argv);
+	if(opt_merge != NULL) {
+		retval = merge_sessions(opt_merge, argv + 1, argc - 1,
+			opt_min_overlap);
+		g_free(opt_merge);
+		return retval ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if(opt_calibrate) {
+		retval = scanner_calibrate((argc > 1) ? argv[1] : NULL);
+		return retval ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if(!opt_headless)
+		gtk_init(&argc, &argv);
+	/* the model writers print numbers on the export thread, the locale
+	 * is process wide and only safe to set before any thread starts */
+	setlocale(LC_NUMERIC, "C");
 
 	scanner = g_new0(G3DScanner, 1);
 	scanner->config = config_init();
-	scanner->model = model_init(scanner->config);
-	scanner->v4l2 = v4l2_init(scanner->config);
-	if(!scanner->v4l2) {
+	/* a batch run scans a new object with the geometry and regions of
+	 * the config and keeps away from the interactive session */
+	scanner->model = model_init(scanner->config, !opt_headless);
+	scanner->tracker = angle_tracker_new(scanner->model->n_bits,
+		scanner->model->sub_bits);
+	scanner->publish_slots = CLAMP(config_get_int(scanner->config,
+		"publish", "slots", 0), 0, PUBLISH_MAX_SLOTS);
+	if(!scanner_init_cameras(scanner)) {
 		g_free(scanner);
 		return EXIT_FAILURE;
 	}
+	depth = CLAMP(config_get_int(scanner->config, "pipeline", "depth", 2),
+		0, PIPELINE_MAX_DEPTH);
+	if(depth > 0)
+		scanner->pipeline = pipeline_start(scanner->v4l2, scanner->model,
+			depth);
+	filename = config_get_string(scanner->config, "obslog", "file", "");
+	if(filename[0] != '\0')
+		scanner->model->obslog = obslog_new(filename,
+			scanner->model->n_bits, scanner->model->sub_bits,
+			scanner->model->n_vert_y);
+	g_free(filename);
+
+	if(opt_headless) {
+		retval = headless_run(scanner, opt_output, opt_timeout);
+		model_save_config(scanner->model, scanner->config);
+		config_save(scanner->config);
+		scanner_pipeline_cleanup(scanner);
+		scanner_cleanup_cameras(scanner);
+		scanner_publish_cleanup(scanner);
+		scanner_obslog_cleanup(scanner);
+		angle_tracker_free(scanner->tracker);
+		model_cleanup(scanner->model);
+		config_cleanup(scanner->config);
+		v4l2_cleanup(scanner->v4l2);
+		g_free(opt_output);
+		g_free(scanner);
+		return retval ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 	scanner->gui = gui_init(scanner->config, scanner->model);
 	if(!scanner->gui) {
+		scanner_pipeline_cleanup(scanner);
+		scanner_obslog_cleanup(scanner);
+		scanner_cleanup_cameras(scanner);
 		v4l2_cleanup(scanner->v4l2);
 		g_free(scanner);
 		return EXIT_FAILURE;
 	}
 
 	gui_set_quit_handler(scanner->gui, G_CALLBACK(main_quit), scanner);
+	gui_set_cameras(scanner->gui, scanner->cameras);
 
 	gui_show(scanner->gui);
 
-	g_idle_add(idle_func, scanner);
+	/* the pipeline wakes the main loop once frames are through, waiting
+	 * for them here would block the GUI */
+	if(scanner->pipeline) {
+		pipeline_set_notify(scanner->pipeline, pipeline_idle_func, scanner);
+		g_timeout_add(5000, pipeline_debug_func, scanner);
+	} else {
+		g_idle_add(idle_func, scanner);
+	}
 
 	gtk_main();
 
+	/* an export still running would be cut off, and report back to the
+	 * freed GUI */
+	export_finish();
+	gui_set_cameras(scanner->gui, NULL);
+	scanner_pipeline_cleanup(scanner);
+	scanner_cleanup_cameras(scanner);
+	scanner_publish_cleanup(scanner);
+	scanner_obslog_cleanup(scanner);
+
 	model_save_config(scanner->model, scanner->config);
 	config_save(scanner->config);
 
+	angle_tracker_free(scanner->tracker);
 	model_cleanup(scanner->model);
 	config_cleanup(scanner->config);
 	gui_cleanup(scanner->gui);
@@ -60,52 +189,277 @@ int main(int argc, char *argv[])
 	return EXIT_SUCCESS;
 }
 
-static gboolean idle_func(gpointer data)
+/* the coefficients go to [lens] of the default camera; a few frames are
+ * skipped to let the exposure settle */
+static gboolean scanner_calibrate(const gchar *filename)
 {
-	G3DScanner *scanner = data;
-	GdkPixbuf *pixbuf;
-	gchar *s;
-	guint32 gv;
-	gfloat deg;
+	Config *config;
+	V4l2Data *v4l2;
+	GdkPixbuf *pixbuf = NULL;
+	GError *error = NULL;
+	LensParams lens;
+	guint64 stamp;
+	gint32 i;
+	gboolean retval;
 
-	g_return_val_if_fail(scanner != NULL, FALSE);
+	g_type_init();
+	config = config_init();
+
+	if(filename) {
+		pixbuf = gdk_pixbuf_new_from_file(filename, &error);
+		if(pixbuf == NULL) {
+			g_printerr("%s\n", error->message);
+			g_error_free(error);
+		}
+	} else {
+		v4l2 = v4l2_init(config);
+		for(i = 0; v4l2 && (i < 10); i ++) {
+			if(pixbuf)
+				gdk_pixbuf_unref(pixbuf);
+			pixbuf = v4l2_get_frame(v4l2, &stamp);
+		}
+		if(v4l2)
+			v4l2_cleanup(v4l2);
+	}
+	if(pixbuf == NULL) {
+		config_cleanup(config);
+		return FALSE;
+	}
+
+	retval = lens_calibrate(pixbuf, &lens);
+	gdk_pixbuf_unref(pixbuf);
+	if(retval) {
+		g_print("k1 %f k2 %f p1 %f p2 %f\n", lens.k1, lens.k2,
+			lens.p1, lens.p2);
+		lens_save_config(&lens, config, "lens");
+		config_save(config);
+	}
+	config_cleanup(config);
+	return retval;
+}
+
+/* [v4l2.N] sections configure several cameras; the one named by
+ * base/angle_camera reads the gray code and drives the GUI, all others are
+ * scanned on their own threads */
+static gboolean scanner_init_cameras(G3DScanner *scanner)
+{
+	GSList *sections, *item;
+	Camera *camera;
+	gchar *master;
+
+	sections = config_get_sections(scanner->config, "v4l2.");
+	if(sections == NULL) {
+		scanner->v4l2 = v4l2_init(scanner->config);
+		return (scanner->v4l2 != NULL);
+	}
+
+	master = config_get_string(scanner->config, "base", "angle_camera",
+		sections->data);
+	scanner->v4l2 = v4l2_init_section(scanner->config, master);
+	if(scanner->v4l2 && (g_slist_length(sections) > 1)) {
+		scanner->history = angle_history_new(
+			config_get_int(scanner->config, "base", "angle_history", 256));
+		for(item = sections; item != NULL; item = item->next) {
+			if(strcmp(item->data, master) == 0)
+				continue;
+			camera = camera_start(scanner->config, item->data,
+				scanner->history, !opt_headless);
+			if(camera)
+				scanner->cameras = g_slist_append(scanner->cameras, camera);
+		}
+	}
+
+	for(item = sections; item != NULL; item = item->next)
+		g_free(item->data);
+	g_slist_free(sections);
+	g_free(master);
+	return (scanner->v4l2 != NULL);
+}
+
+static void scanner_cleanup_cameras(G3DScanner *scanner)
+{
+	GSList *item;
+
+	for(item = scanner->cameras; item != NULL; item = item->next)
+		camera_free(item->data);
+	g_slist_free(scanner->cameras);
+	scanner->cameras = NULL;
+	if(scanner->history)
+		angle_history_free(scanner->history);
+	scanner->history = NULL;
+}
+
+static void scanner_publish_cleanup(G3DScanner *scanner)
+{
+	if(scanner->publisher)
+		publish_free(scanner->publisher);
+	scanner->publisher = NULL;
+}
+
+static void scanner_pipeline_cleanup(G3DScanner *scanner)
+{
+	if(scanner->pipeline)
+		pipeline_stop(scanner->pipeline);
+	scanner->pipeline = NULL;
+}
+
+static void scanner_obslog_cleanup(G3DScanner *scanner)
+{
+	if(scanner->model->obslog)
+		obslog_free(scanner->model->obslog);
+	scanner->model->obslog = NULL;
+}
+
+/* mask: pixbuf binarized by the pipeline, NULL to binarize pixbuf here;
+ * a frame failing the quality check is shown and published without a
+ * mask, but neither decoded nor scanned */
+static void scanner_apply_frame(G3DScanner *scanner, GdkPixbuf *pixbuf,
+	GdkPixbuf *mask, guint64 stamp, QualityVerdict verdict)
+{
+	Region *region;
+	GString *s;
+	guint32 gv = 0, angle = 0;
+	gboolean valid, valid_dir = FALSE;
+	gint32 i;
+	gfloat deg;
 
-	pixbuf = v4l2_get_pixbuf(scanner->v4l2);
-	if(pixbuf) {
+	scanner->n_frames ++;
+	if(verdict == QUALITY_OK) {
 		scan_update_bits(scanner->model, pixbuf);
-		gv = gray_decode(scanner->model->bits, scanner->model->n_bits);
-		if(scanner->model->valid_dir) {
-			deg = (gfloat)gv / (gfloat)(1 << scanner->model->n_bits) * 360.0;
-			s = g_strdup_printf("%d:%d:%d:%d:%d:%d = %d (%.2f°)",
-				scanner->model->bits[0], scanner->model->bits[1],
-				scanner->model->bits[2], scanner->model->bits[3],
-				scanner->model->bits[4], scanner->model->bits[5],
-				gv, deg);
-			if(scanner->model->angle_scans[gv] == 0) {
-				/* scan colors of vertices a quarter rotation later */
-				scan_colors(scanner->model, pixbuf, (gv +
-					(1 << scanner->model->n_bits) * 3 / 4) %
-					(1 << scanner->model->n_bits));
-			}
+		valid_dir = scanner->model->valid_dir;
+		if(valid_dir)
+			gv = gray_code_decode(scanner->model->code,
+				scanner->model->bits);
+	} else {
+		scanner->n_rejected[verdict] ++;
+	}
+	valid = angle_tracker_update(scanner->tracker, stamp, valid_dir, gv,
+		&angle);
+	if(scanner->history)
+		angle_history_push(scanner->history, stamp, valid, angle);
+	if(valid)
+		scanner->n_valid ++;
+
+	if(scanner->publish_slots && (scanner->publisher == NULL)) {
+		scanner->publisher = publish_new(gdk_pixbuf_get_width(pixbuf),
+			gdk_pixbuf_get_height(pixbuf), scanner->publish_slots);
+		if(scanner->publisher == NULL)
+			scanner->publish_slots = 0;
+	}
+	if(scanner->publisher)
+		publish_begin(scanner->publisher, pixbuf);
+	region = g_slist_nth_data(scanner->model->regions, REGION_OBJECT);
+	if(verdict == QUALITY_OK) {
+		if(scanner->model->obslog && region)
+			obslog_frame(scanner->model->obslog, scanner->n_frames, stamp,
+				gv, &(region->rect));
+		if(scan_frame_mask(scanner->model, pixbuf, mask,
+			valid ? (gint32)angle : -1))
+			scanner->n_scanned ++;
+	}
+	if(mask == NULL)
+		mask = pixbuf;
+	if(scanner->publisher) {
+		/* a rejected frame was never binarized, its slot keeps an empty
+		 * mask rect */
+		if(region && (verdict == QUALITY_OK))
+			publish_set_mask(scanner->publisher, mask, &(region->rect));
+		publish_commit(scanner->publisher, stamp, valid ? (gint32)angle : -1,
+			gv, scanner->model->n_angles);
+	}
+
+	if(scanner->gui) {
+		if(verdict != QUALITY_OK) {
+			gui_set_angle(scanner->gui, quality_name(verdict));
+		} else if(valid) {
+			deg = (gfloat)angle / (gfloat)scanner->model->n_angles * 360.0;
+			s = g_string_new("");
+			for(i = 0; i < scanner->model->n_bits; i ++)
+				g_string_append_printf(s, i ? ":%d" : "%d",
+					scanner->model->bits[i]);
+			g_string_append_printf(s, " = %d (%.2f°)", gv, deg);
+			gui_set_angle(scanner->gui, s->str);
+			g_string_free(s, TRUE);
 		} else {
-			s = g_strdup("invalid");
+			gui_set_angle(scanner->gui, "invalid");
 		}
-		gui_set_angle(scanner->gui, s);
-		g_free(s);
-
 		gui_update(scanner->gui);
+		gui_set_image(scanner->gui, mask);
+		if(valid && (verdict == QUALITY_OK))
+			gui_set_scan_progress(scanner->gui, angle,
+				scanner->model->angle_scans[angle]);
+		gui_update_preview(scanner->gui);
+	}
+}
 
-		scan_binarize_object_region(scanner->model, pixbuf);
-		gui_set_image(scanner->gui, pixbuf);
-		if(scanner->model->valid_dir &&
-			(scanner->model->angle_scans[gv] < 10)) {
-			scan_angle(scanner->model, pixbuf, gv);
-			gui_set_scan_progress(scanner->gui, gv,
-				scanner->model->angle_scans[gv]);
-		}
+/* with the pipeline the frame was captured and binarized on other threads
+ * while earlier ones were applied here; a mask made before the object
+ * region changed is dropped and the frame binarized again. timeout_ms is
+ * how long to wait for the pipeline, 0 only polls */
+gboolean scanner_process_frame(G3DScanner *scanner, guint32 timeout_ms)
+{
+	PipelineFrame *frame;
+	Region *region;
+	GdkPixbuf *pixbuf;
+	guint64 stamp;
+
+	if(scanner->pipeline == NULL) {
+		pixbuf = v4l2_get_frame(scanner->v4l2, &stamp);
+		if(pixbuf == NULL)
+			return FALSE;
+		scanner_apply_frame(scanner, pixbuf, NULL, stamp,
+			scan_check_frame(scanner->model, pixbuf));
 		gdk_pixbuf_unref(pixbuf);
+		return TRUE;
 	}
 
+	frame = pipeline_next(scanner->pipeline, timeout_ms);
+	if(frame == NULL)
+		return FALSE;
+	region = g_slist_nth_data(scanner->model->regions, REGION_OBJECT);
+	if(frame->mask && (!region || memcmp(&(frame->rect), &(region->rect),
+		sizeof(GdkRectangle)))) {
+		scanner->pipeline->n_stale ++;
+		gdk_pixbuf_unref(frame->mask);
+		frame->mask = NULL;
+	}
+	scanner_apply_frame(scanner, frame->pixbuf, frame->mask, frame->stamp,
+		frame->verdict);
+	pipeline_set_params(scanner->pipeline, scanner->model);
+	pipeline_frame_free(frame);
+	return TRUE;
+}
+
+static gboolean idle_func(gpointer data)
+{
+	G3DScanner *scanner = data;
+
+	g_return_val_if_fail(scanner != NULL, FALSE);
+
+	scanner_process_frame(scanner, 0);
+	return TRUE;
+}
+
+/* one frame per call, so GTK gets its turn in between */
+static gboolean pipeline_idle_func(gpointer data)
+{
+	G3DScanner *scanner = data;
+
+	if(scanner_process_frame(scanner, 0))
+		return TRUE;
+	return pipeline_notify_done(scanner->pipeline);
+}
+
+static gboolean pipeline_debug_func(gpointer data)
+{
+	G3DScanner *scanner = data;
+	gchar *s;
+
+	if(scanner->pipeline == NULL)
+		return FALSE;
+	s = pipeline_stats(scanner->pipeline);
+	g_debug("pipeline:\n%s", s);
+	g_free(s);
 	return TRUE;
 }
 
@@ -5,12 +5,39 @@
 #include "gui.h"
 #include "config.h"
 #include "model.h"
+#include "camera.h"
+#include "angle.h"
+#include "publish.h"
+#include "pipeline.h"
+#include "quality.h"
 
 typedef struct {
 	V4l2Data *v4l2;
 	GuiData *gui;
 	Config *config;
 	Model *model;
+	AngleTracker *tracker;
+
+	/* further cameras, stamped with the angles decoded from this one */
+	GSList *cameras;
+	AngleHistory *history;
+
+	/* frames, masks and angles for other processes, [publish] slots > 0;
+	 * created with the size of the first frame */
+	guint32 publish_slots;
+	Publisher *publisher;
+
+	/* capture and binarization run ahead on their own threads,
+	 * [pipeline] depth > 0 frames per stage */
+	Pipeline *pipeline;
+
+	guint32 n_frames;
+	guint32 n_valid;
+	guint32 n_scanned;
+	/* frames dropped by quality_check(), per verdict */
+	guint32 n_rejected[NUM_QUALITY_VERDICTS];
 } G3DScanner;
 
+gboolean scanner_process_frame(G3DScanner *scanner, guint32 timeout_ms);
+
 #endif
@@ -0,0 +1,369 @@
+#include <math.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "merge.h"
+#include "session.h"
+#include "region.h"
+#include "model.h"
+
+/* one input session, resampled to the row pitch of the first input;
+ * rows are counted from the bottom as in scan_angle() */
+typedef struct {
+	Session *session;
+	guint32 n_rows;
+	gint32 offset;
+	gfloat *verts;
+	guint8 *colors;
+	guint8 *scans;
+} MergeInput;
+
+typedef struct {
+	MergeInput *inputs;
+	guint32 n_inputs;
+	guint32 n_angles;
+	gfloat sh;
+
+	/* alignment of inputs[k] against inputs[k - 1] */
+	guint32 k;
+	guint32 min_overlap;
+	guint32 n_overlaps;
+	gfloat *ncc;
+	gfloat *mad;
+
+	/* merged output */
+	guint32 n_rows;
+	gfloat *out_verts;
+	guint8 *out_colors[3];
+	guint8 *out_scans;
+} Merge;
+
+typedef void (*MergeFunc)(Merge *merge, guint32 angle);
+
+typedef struct {
+	Merge *merge;
+	MergeFunc func;
+	guint32 first;
+	guint32 last;
+} MergeJob;
+
+static void merge_job_run(gpointer data, gpointer user_data)
+{
+	MergeJob *job = data;
+	guint32 i;
+
+	for(i = job->first; i < job->last; i ++)
+		job->func(job->merge, i);
+}
+
+/* run func for every angle, split into one block of angles per cpu */
+static void merge_parallel(Merge *merge, MergeFunc func)
+{
+	GThreadPool *pool;
+	MergeJob *jobs;
+	guint32 n_threads, n_jobs, i, block;
+
+	n_threads = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+	n_jobs = MIN(n_threads * 4, merge->n_angles);
+	block = (merge->n_angles + n_jobs - 1) / n_jobs;
+
+	jobs = g_new0(MergeJob, n_jobs);
+	pool = g_thread_pool_new(merge_job_run, NULL, n_threads, TRUE, NULL);
+	for(i = 0; i < n_jobs; i ++) {
+		jobs[i].merge = merge;
+		jobs[i].func = func;
+		jobs[i].first = MIN(i * block, merge->n_angles);
+		jobs[i].last = MIN((i + 1) * block, merge->n_angles);
+		g_thread_pool_push(pool, jobs + i, NULL);
+	}
+	/* wait for all queued jobs */
+	g_thread_pool_free(pool, FALSE, TRUE);
+	g_free(jobs);
+}
+
+static gboolean merge_load_input(Merge *merge, MergeInput *input)
+{
+	SessionHeader *header = input->session->header;
+	ModelLayout layout;
+	gfloat *verts, sh, pos, f;
+	guint8 *arena;
+	guint32 i, j, j0, jn, c, n_vert_y;
+
+	n_vert_y = header->n_vert_y;
+	/* the texture plane comes last and is not merged */
+	model_layout(&layout, merge->n_angles, n_vert_y, 0);
+	if(header->size < header->arena_offset + layout.size)
+		return FALSE;
+	sh = (gfloat)header->regions[REGION_OBJECT][3] / n_vert_y;
+	if(sh <= 0.0)
+		return FALSE;
+	if(merge->sh == 0.0)
+		merge->sh = sh;
+
+	input->n_rows = MAX(1, (guint32)(n_vert_y * sh / merge->sh + 0.5));
+	input->verts = g_new0(gfloat, merge->n_angles * input->n_rows);
+	input->colors = g_new0(guint8, merge->n_angles * input->n_rows * 3);
+
+	arena = session_get_arena(input->session);
+	input->scans = arena + layout.scans;
+	verts = (gfloat *)(arena + layout.verts);
+	for(i = 0; i < merge->n_angles; i ++) {
+		for(j = 0; j < input->n_rows; j ++) {
+			/* linear resampling of the radius profile; 0 is "no
+			 * silhouette" and must not be blended into a measured radius,
+			 * so next to one (or without scans) the nearest sample is
+			 * taken */
+			pos = (j + 0.5) * merge->sh / sh - 0.5;
+			pos = CLAMP(pos, 0.0, n_vert_y - 1);
+			j0 = MIN((guint32)pos, n_vert_y - 1);
+			jn = MIN((guint32)(pos + 0.5), n_vert_y - 1);
+			f = pos - j0;
+			if((input->scans[i] != 0) && (j0 + 1 < n_vert_y) &&
+				(verts[i * n_vert_y + j0] != 0.0) &&
+				(verts[i * n_vert_y + j0 + 1] != 0.0))
+				input->verts[i * input->n_rows + j] =
+					verts[i * n_vert_y + j0] * (1.0 - f) +
+					verts[i * n_vert_y + j0 + 1] * f;
+			else
+				input->verts[i * input->n_rows + j] =
+					verts[i * n_vert_y + jn];
+			for(c = 0; c < 3; c ++)
+				input->colors[(i * input->n_rows + j) * 3 + c] =
+					(arena + layout.colors[c])[i * n_vert_y + jn];
+		}
+	}
+	return TRUE;
+}
+
+static void merge_correlate_angle(Merge *merge, guint32 angle)
+{
+	MergeInput *lo = merge->inputs + merge->k - 1;
+	MergeInput *hi = merge->inputs + merge->k;
+	gfloat *a, *b, ma, mb, saa, sbb, sab, sd;
+	guint32 o, j, n;
+
+	for(o = 0; o < merge->n_overlaps; o ++) {
+		merge->ncc[angle * merge->n_overlaps + o] = 0.0;
+		merge->mad[angle * merge->n_overlaps + o] = -1.0;
+	}
+	if((lo->scans[angle] == 0) || (hi->scans[angle] == 0))
+		return;
+
+	for(o = 0; o < merge->n_overlaps; o ++) {
+		/* the top n rows of lo against the bottom n rows of hi */
+		n = merge->min_overlap + o;
+		a = lo->verts + angle * lo->n_rows + lo->n_rows - n;
+		b = hi->verts + angle * hi->n_rows;
+
+		ma = mb = 0.0;
+		for(j = 0; j < n; j ++) {
+			ma += a[j];
+			mb += b[j];
+		}
+		ma /= n;
+		mb /= n;
+
+		saa = sbb = sab = sd = 0.0;
+		for(j = 0; j < n; j ++) {
+			saa += (a[j] - ma) * (a[j] - ma);
+			sbb += (b[j] - mb) * (b[j] - mb);
+			sab += (a[j] - ma) * (b[j] - mb);
+			sd += fabs(a[j] - b[j]);
+		}
+		if((saa > 1e-6) && (sbb > 1e-6))
+			merge->ncc[angle * merge->n_overlaps + o] =
+				sab / sqrt(saa * sbb);
+		merge->mad[angle * merge->n_overlaps + o] = sd / n;
+	}
+}
+
+static gboolean merge_align(Merge *merge, guint32 k)
+{
+	MergeInput *lo = merge->inputs + k - 1;
+	MergeInput *hi = merge->inputs + k;
+	gfloat score, best_score = -G_MAXFLOAT, mad, best_mad = G_MAXFLOAT;
+	guint32 i, o, n_valid, best = 0;
+
+	merge->k = k;
+	if(MIN(lo->n_rows, hi->n_rows) < merge->min_overlap) {
+		g_warning("merge: input %d too short for overlap of %d rows",
+			k, merge->min_overlap);
+		return FALSE;
+	}
+	merge->n_overlaps = MIN(lo->n_rows, hi->n_rows) - merge->min_overlap + 1;
+	merge->ncc = g_new0(gfloat, merge->n_angles * merge->n_overlaps);
+	merge->mad = g_new0(gfloat, merge->n_angles * merge->n_overlaps);
+
+	merge_parallel(merge, merge_correlate_angle);
+
+	for(o = 0; o < merge->n_overlaps; o ++) {
+		score = mad = 0.0;
+		n_valid = 0;
+		for(i = 0; i < merge->n_angles; i ++) {
+			if(merge->mad[i * merge->n_overlaps + o] < 0.0)
+				continue;
+			score += merge->ncc[i * merge->n_overlaps + o];
+			mad += merge->mad[i * merge->n_overlaps + o];
+			n_valid ++;
+		}
+		if(n_valid == 0)
+			continue;
+		score /= n_valid;
+		mad /= n_valid;
+		/* flat profiles correlate to nothing, fall back to the
+		 * smallest radius difference */
+		if((score > best_score + 1e-4) ||
+			((fabs(score - best_score) <= 1e-4) && (mad < best_mad))) {
+			best_score = score;
+			best_mad = mad;
+			best = o;
+		}
+	}
+
+	g_free(merge->ncc);
+	g_free(merge->mad);
+
+	if(best_score == -G_MAXFLOAT) {
+		g_warning("merge: inputs %d and %d share no scanned angles",
+			k - 1, k);
+		return FALSE;
+	}
+
+	hi->offset = lo->offset + lo->n_rows - (merge->min_overlap + best);
+	g_debug("merge: input %d overlaps by %d rows (ncc %.3f, mad %.2f)",
+		k, merge->min_overlap + best, best_score, best_mad);
+	return TRUE;
+}
+
+static void merge_blend_angle(Merge *merge, guint32 angle)
+{
+	MergeInput *input;
+	gfloat w, sum_w, sum_v, sum_c[3], v;
+	guint32 j, k, c;
+	gint32 r;
+	guint8 *col;
+
+	for(k = 0; k < merge->n_inputs; k ++)
+		merge->out_scans[angle] = MAX(merge->out_scans[angle],
+			merge->inputs[k].scans[angle]);
+
+	for(j = 0; j < merge->n_rows; j ++) {
+		sum_w = sum_v = 0.0;
+		sum_c[0] = sum_c[1] = sum_c[2] = 0.0;
+		for(k = 0; k < merge->n_inputs; k ++) {
+			input = merge->inputs + k;
+			r = (gint32)j - input->offset;
+			if((r < 0) || (r >= input->n_rows) ||
+				(input->scans[angle] == 0))
+				continue;
+			v = input->verts[angle * input->n_rows + r];
+			if(v <= 0.0)
+				continue;
+			/* feather towards the input's upper and lower edge */
+			w = MIN(r, input->n_rows - 1 - r) + 1.0;
+			col = input->colors + (angle * input->n_rows + r) * 3;
+			sum_w += w;
+			sum_v += w * v;
+			for(c = 0; c < 3; c ++)
+				sum_c[c] += w * col[c];
+		}
+		if(sum_w == 0.0)
+			continue;
+		merge->out_verts[angle * merge->n_rows + j] = sum_v / sum_w;
+		for(c = 0; c < 3; c ++)
+			merge->out_colors[c][angle * merge->n_rows + j] =
+				sum_c[c] / sum_w;
+	}
+}
+
+gboolean merge_sessions(const gchar *output, gchar **inputs, guint32 n_inputs,
+	guint32 min_overlap)
+{
+	Merge *merge;
+	Session *out = NULL;
+	ModelLayout layout;
+	guint8 *arena;
+	guint32 k, n_bits = 0, sub_bits = 0;
+	gboolean retval = FALSE;
+
+	g_return_val_if_fail(n_inputs > 0, FALSE);
+
+	merge = g_new0(Merge, 1);
+	merge->n_inputs = n_inputs;
+	merge->inputs = g_new0(MergeInput, n_inputs);
+	merge->min_overlap = MAX(min_overlap, 2);
+
+	for(k = 0; k < n_inputs; k ++) {
+		merge->inputs[k].session = session_open_readonly(inputs[k]);
+		if(merge->inputs[k].session == NULL) {
+			g_warning("merge: failed to open session %s", inputs[k]);
+			goto out;
+		}
+		if(k == 0) {
+			n_bits = merge->inputs[k].session->header->n_bits;
+			sub_bits = merge->inputs[k].session->header->sub_bits;
+			merge->n_angles = (1 << (n_bits + sub_bits));
+		} else if((merge->inputs[k].session->header->n_bits != n_bits) ||
+			(merge->inputs[k].session->header->sub_bits != sub_bits)) {
+			g_warning("merge: %s: angle grid %d+%d bits differs from %d+%d",
+				inputs[k], merge->inputs[k].session->header->n_bits,
+				merge->inputs[k].session->header->sub_bits, n_bits, sub_bits);
+			goto out;
+		}
+		if(!merge_load_input(merge, merge->inputs + k)) {
+			g_warning("merge: %s is truncated or has no object region",
+				inputs[k]);
+			goto out;
+		}
+	}
+
+	/* inputs are ordered from the lowest to the highest camera position */
+	for(k = 1; k < n_inputs; k ++)
+		if(!merge_align(merge, k))
+			goto out;
+
+	merge->n_rows = merge->inputs[n_inputs - 1].offset +
+		merge->inputs[n_inputs - 1].n_rows;
+	for(k = 0; k < n_inputs; k ++)
+		merge->n_rows = MAX(merge->n_rows,
+			merge->inputs[k].offset + merge->inputs[k].n_rows);
+
+	model_layout(&layout, merge->n_angles, merge->n_rows, 0);
+	out = session_create(output, n_bits, sub_bits, merge->n_rows, 0, 0,
+		layout.size);
+	if(out == NULL)
+		goto out;
+	arena = session_get_arena(out);
+	merge->out_scans = arena + layout.scans;
+	merge->out_verts = (gfloat *)(arena + layout.verts);
+	for(k = 0; k < 3; k ++)
+		merge->out_colors[k] = arena + layout.colors[k];
+
+	merge_parallel(merge, merge_blend_angle);
+
+	/* regions of the lowest pass, object region grown to the full height */
+	memcpy(out->header->regions, merge->inputs[0].session->header->regions,
+		sizeof(out->header->regions));
+	out->header->regions[REGION_OBJECT][3] = merge->n_rows * merge->sh;
+	out->header->regions[REGION_OBJECT][1] -=
+		out->header->regions[REGION_OBJECT][3] -
+		merge->inputs[0].session->header->regions[REGION_OBJECT][3];
+
+	g_debug("merge: %d sessions, %d rows total", n_inputs, merge->n_rows);
+	retval = TRUE;
+
+out:
+	if(out)
+		session_close(out);
+	for(k = 0; k < n_inputs; k ++) {
+		if(merge->inputs[k].session)
+			session_close(merge->inputs[k].session);
+		g_free(merge->inputs[k].verts);
+		g_free(merge->inputs[k].colors);
+	}
+	g_free(merge->inputs);
+	g_free(merge);
+	return retval;
+}
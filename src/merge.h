@@ -0,0 +1,9 @@
+#ifndef _MERGE_H
+#define _MERGE_H
+
+#include <glib.h>
+
+gboolean merge_sessions(const gchar *output, gchar **inputs, guint32 n_inputs,
+	guint32 min_overlap);
+
+#endif
@@ -1,40 +1,288 @@
+#include <string.h>
+
 #include "model.h"
 #include "config.h"
 #include "region.h"
 #include "ac3d.h"
+#include "session.h"
+#include "hull.h"
+#include "lens.h"
+#include "filter.h"
 
+static gchar *model_region_section(Model *model, RegionType type);
 static void model_delete_regions(Model *model);
 static void model_create_regions(Model *model, Config *config);
+static void model_set_params(Model *model, Config *config);
+static void model_update_lens_map(Model *model);
+static void model_remap_rows(Model *model, GdkRectangle *from,
+	GdkRectangle *to);
+static void model_delete_tiles(Model *model);
+static gboolean model_has_scans(Model *model);
 static void model_delete_storage(Model *model);
 static void model_create_storage(Model *model);
+static void model_decimate_rows(Model *model, gfloat *verts,
+	guint8 **colors, guint32 n_rows, gfloat *out_verts, guint8 **out_colors);
+
+static inline gsize model_align(gsize offset)
+{
+	return (offset + MODEL_ALIGN - 1) & ~(gsize)(MODEL_ALIGN - 1);
+}
+
+Model *model_init(Config *config, gboolean resume)
+{
+	return model_init_named(config, NULL, resume);
+}
 
-Model *model_init(Config *config)
+/* a named model keeps its regions and session apart from the default one,
+ * e.g. "regions.1.object" and "session.1" for name "1"; without resume
+ * (batch runs) the interactive session is left alone, the scan goes to the
+ * heap or to a new session named by "session.headless" ("session.1.headless"
+ * and so on), with the geometry and regions of the config */
+Model *model_init_named(Config *config, const gchar *name, gboolean resume)
 {
 	Model *model;
+	ModelLayout layout;
+	Region *region;
+	GrayCodeType code;
+	gchar *path, *key;
 
 	model = g_new0(Model, 1);
+	model->name = g_strdup(name);
 	model->n_bits = config_get_int(config, "base", "n_bits", 6);
+	key = config_get_string(config, "base", "code",
+		gray_code_name(GRAY_CODE_REFLECTED));
+	code = gray_code_parse(key);
+	g_free(key);
+	model->sub_bits = CLAMP(config_get_int(config, "base", "sub_bits", 0),
+		0, 4);
 	model->n_vert_y = config_get_int(config, "base", "n_vert_y", 64);
-	model->bits = g_new0(guint8, model->n_bits);
+	model->compact = config_get_int(config, "base", "compact", 0) ?
+		TRUE : FALSE;
 
 	model_create_regions(model, config);
+	model_set_params(model, config);
+	if(model->n_vert_y == 0) {
+		model->full_rows = TRUE;
+		region = g_slist_nth_data(model->regions, REGION_OBJECT);
+		model->n_vert_y = MIN(region->rect.height, MODEL_MAX_ROWS);
+		if(model->n_vert_y < 2) {
+			g_warning("a row per pixel needs an object region, "
+				"using 64 rows until the next start");
+			model->n_vert_y = 64;
+		}
+	}
+	model->n_vert_y = MIN(model->n_vert_y, MODEL_MAX_ROWS);
+	key = g_strdup_printf("lens%s%s", name ? "." : "", name ? name : "");
+	if(!lens_load_config(&(model->lens), config, key))
+		memset(&(model->lens), 0, sizeof(LensParams));
+	g_free(key);
+
+	/* an empty session path keeps the scan data on the heap only */
+	path = resume ? g_strdup_printf("%s/.3dscan/session%s%s.3ds",
+		g_get_home_dir(), name ? "." : "", name ? name : "") : g_strdup("");
+	key = g_strdup_printf("session%s%s%s", name ? "." : "", name ? name : "",
+		resume ? "" : ".headless");
+	model->session_file = config_get_string(config, "base", key, path);
+	g_free(key);
+	g_free(path);
+	/* the tiles of compact storage live on the heap only */
+	if(model->compact && (model->session_file[0] != '\0')) {
+		g_warning("compact storage, not using session %s",
+			model->session_file);
+		model->session_file[0] = '\0';
+	}
+	if(resume && (model->session_file[0] != '\0')) {
+		model->session = session_open(model->session_file);
+		if(model->session) {
+			model_layout(&layout, (1 << (model->session->header->n_bits +
+				model->session->header->sub_bits)),
+				model->session->header->n_vert_y,
+				model->session->header->tex_band *
+				model->session->header->tex_rows);
+			if(model->session->header->size <
+				model->session->header->arena_offset + layout.size) {
+				g_warning("session %s: arena too small, starting over",
+					model->session_file);
+				session_close(model->session);
+				model->session = NULL;
+			}
+		}
+		if(model->session) {
+			/* resume: geometry of the stored scan wins over the config */
+			model->n_bits = model->session->header->n_bits;
+			model->sub_bits = model->session->header->sub_bits;
+			model->n_vert_y = model->session->header->n_vert_y;
+			model->tex_band = model->session->header->tex_band;
+			model->tex_rows = model->session->header->tex_rows;
+			session_get_regions(model->session, model->regions);
+		}
+	}
+
+	model->bits = g_new0(guint8, model->n_bits);
+	model->code = gray_code_new(code, model->n_bits);
 	model_create_storage(model);
+	model_update_lens_map(model);
+	if((model->hull_depth > 0) && model->session && model_has_scans(model)) {
+		g_warning("session %s: the silhouettes of the visual hull are not "
+			"stored, start a new scan to export it", model->session_file);
+		model->hull_stale = TRUE;
+	}
 
 	return model;
 }
 
 void model_cleanup(Model *model)
 {
+	if(model->lens_map)
+		lens_map_free(model->lens_map);
+	if(model->hull)
+		hull_free(model->hull);
 	model_delete_storage(model);
 	model_delete_regions(model);
+	g_free(model->session_file);
+	g_free(model->name);
 	g_free(model->bits);
+	gray_code_free(model->code);
 	g_free(model);
 }
 
-void model_rebuild_storage(Model *model)
+/* heap-only model with empty regions, independent of config and sessions */
+Model *model_new(guint32 n_bits, guint32 sub_bits, guint32 n_vert_y)
 {
-	model_delete_storage(model);
+	Model *model;
+	Region *region;
+	gint32 i;
+
+	model = g_new0(Model, 1);
+	model->n_bits = n_bits;
+	model->sub_bits = sub_bits;
+	model->n_vert_y = n_vert_y;
+	model->bits = g_new0(guint8, n_bits);
+	model->code = gray_code_new(GRAY_CODE_REFLECTED, n_bits);
+	model->session_file = g_strdup("");
+	model_set_params(model, NULL);
+	for(i = 0; i < NUM_REGIONS; i ++) {
+		region = g_new0(Region, 1);
+		region->type = i;
+		model->regions = g_slist_append(model->regions, region);
+	}
+
 	model_create_storage(model);
+
+	return model;
+}
+
+/* heap-only copy of the scan data, safe to hand to another thread */
+Model *model_snapshot(Model *model)
+{
+	Model *snapshot;
+	Region *region;
+	gint32 i;
+
+	snapshot = model_new(model->n_bits, model->sub_bits,
+		model->n_vert_y);
+	if((model->tex_band > 0) || model->compact) {
+		model_delete_storage(snapshot);
+		snapshot->tex_band = model->tex_band;
+		snapshot->tex_rows = model->tex_rows;
+		snapshot->compact = model->compact;
+		model_create_storage(snapshot);
+	}
+	for(i = 0; i < NUM_REGIONS; i ++) {
+		region = g_slist_nth_data(model->regions, i);
+		((Region *)g_slist_nth_data(snapshot->regions, i))->rect =
+			region->rect;
+	}
+	snapshot->bg_tolerance = model->bg_tolerance;
+	snapshot->bg_offset = model->bg_offset;
+	snapshot->max_scans = model->max_scans;
+	snapshot->dual_edge = model->dual_edge;
+	snapshot->quality = model->quality;
+	snapshot->hull_depth = model->hull_depth;
+	snapshot->hull_stale = model->hull_stale;
+	snapshot->filter = model->filter;
+	snapshot->filter_window = model->filter_window;
+	snapshot->filter_outlier = model->filter_outlier;
+	snapshot->export_step = model->export_step;
+	if(model->hull)
+		snapshot->hull = hull_copy(model->hull);
+	memcpy(snapshot->arena, model->arena, model->layout.size);
+	if(model->compact)
+		for(i = 0; i < (model->n_angles + MODEL_TILE_ANGLES - 1) /
+			MODEL_TILE_ANGLES; i ++)
+			if(model->tiles[i])
+				snapshot->tiles[i] = g_memdup(model->tiles[i],
+					MODEL_TILE_ANGLES * model->n_vert_y * 2 * sizeof(guint16));
+
+	return snapshot;
+}
+
+void model_clear(Model *model)
+{
+	memset(model->arena, 0, model->layout.size);
+	model_delete_tiles(model);
+	memset(model->angle_dirty, 1, model->n_angles);
+	if(model->hull)
+		hull_clear(model->hull);
+	model->hull_stale = FALSE;
+}
+
+void model_set_region(Model *model, RegionType type, GdkRectangle *rect)
+{
+	Region *region;
+	GdkRectangle old;
+
+	region = g_slist_nth_data(model->regions, type);
+	g_return_if_fail(region != NULL);
+
+	old = region->rect;
+	region->rect = *rect;
+
+	if(type == REGION_OBJECT) {
+		/* silhouettes are not remapped, the hull is rebuilt from scratch */
+		if(model->hull) {
+			hull_free(model->hull);
+			model->hull = NULL;
+		}
+		if((old.width > 0) && (old.height > 0) &&
+			(rect->width > 0) && (rect->height > 0)) {
+			model_remap_rows(model, &old, rect);
+			if(model_has_scans(model))
+				model->hull_stale = TRUE;
+		} else {
+			model_clear(model);
+		}
+	}
+	model_update_lens_map(model);
+	if(model->session)
+		session_set_regions(model->session, model->regions);
+}
+
+/* the code changes where bits are read, not the angle grid */
+void model_set_code(Model *model, GrayCodeType type)
+{
+	GrayCode *code;
+
+	code = gray_code_new(type, model->n_bits);
+	g_return_if_fail(code != NULL);
+	gray_code_free(model->code);
+	model->code = code;
+	model_update_lens_map(model);
+}
+
+void model_layout(ModelLayout *layout, guint32 n_angles, guint32 n_vert_y,
+	guint32 tex_texels)
+{
+	gsize plane = (gsize)n_angles * n_vert_y;
+
+	layout->scans = 0;
+	layout->verts = model_align(layout->scans + n_angles);
+	layout->colors[0] = model_align(layout->verts + plane * sizeof(gfloat));
+	layout->colors[1] = model_align(layout->colors[0] + plane);
+	layout->colors[2] = model_align(layout->colors[1] + plane);
+	layout->texture = model_align(layout->colors[2] + plane);
+	layout->size = model_align(layout->texture +
+		(gsize)n_angles * tex_texels * 3);
 }
 
 gboolean model_save_config(Model *model, Config *config)
@@ -43,84 +291,502 @@ gboolean model_save_config(Model *model, Config *config)
 	gint32 i;
 	gchar *prefix;
 
+	if(model->name == NULL) {
+		config_set_int(config, "base", "n_bits", model->n_bits);
+		config_set_int(config, "base", "sub_bits", model->sub_bits);
+		config_set_int(config, "base", "n_vert_y",
+			model->full_rows ? 0 : model->n_vert_y);
+		config_set_int(config, "base", "compact", model->compact);
+		config_set_string(config, "base", "code",
+			gray_code_name(model->code->type));
+	}
+
 	for(i = 0; i < NUM_REGIONS; i ++) {
 		region = g_slist_nth_data(model->regions, i);
-		prefix = NULL;
-		switch(region->type) {
-			case REGION_GRAYCODE: prefix = "regions.graycode"; break;
-			case REGION_OBJECT:   prefix = "regions.object";   break;
-			default: break;
-		}
+		prefix = model_region_section(model, region->type);
 		if(prefix != NULL) {
 			config_set_int(config, prefix, "x", region->rect.x);
 			config_set_int(config, prefix, "y", region->rect.y);
 			config_set_int(config, prefix, "width", region->rect.width);
 			config_set_int(config, prefix, "height", region->rect.height);
+			g_free(prefix);
 		}
 	}
 	return TRUE;
 }
 
-gboolean model_save(Model *model, const gchar *filename)
+gboolean model_save(Model *model, const gchar *filename,
+	Ac3dProgressFunc progress, gpointer user_data)
 {
 	Region *region;
+	gfloat *verts, *rows;
+	guint8 *colors[3], *row_colors[3], rgb[3];
+	guint32 i, j, c, n_rows, height;
+	gboolean own_colors, retval;
 
 	region = g_slist_nth_data(model->regions, REGION_OBJECT);
 	g_return_val_if_fail(region != NULL, FALSE);
 
-	return ac3d_write(filename, model->angle_verts, model->angle_colors,
-		(1 << model->n_bits), model->n_vert_y, region->rect.height);
+	if((model->hull_depth > 0) && model->hull_stale) {
+		g_warning("%s: the visual hull is missing the silhouettes of "
+			"earlier frames, start a new scan or set [hull] depth = 0",
+			filename);
+		return FALSE;
+	}
+	if(model->hull)
+		return hull_save(model->hull, filename, progress, user_data);
+
+	/* the writers take plain planes, expand compact storage for them */
+	verts = g_new(gfloat, model->n_angles * model->n_vert_y);
+	if(model->filter)
+		filter_radii(model, verts, NULL);
+	else
+		for(i = 0; i < model->n_angles; i ++)
+			for(j = 0; j < model->n_vert_y; j ++)
+				verts[i * model->n_vert_y + j] =
+					model_get_radius(model, i, j);
+	for(c = 0; c < 3; c ++)
+		colors[c] = model->angle_colors[c];
+	own_colors = model->compact;
+	if(model->compact) {
+		for(c = 0; c < 3; c ++)
+			colors[c] = g_new(guint8, model->n_angles * model->n_vert_y);
+		for(i = 0; i < model->n_angles; i ++)
+			for(j = 0; j < model->n_vert_y; j ++) {
+				model_get_color(model, i, j, rgb);
+				for(c = 0; c < 3; c ++)
+					colors[c][i * model->n_vert_y + j] = rgb[c];
+			}
+	}
+
+	/* rows keep their spacing, a short last group makes the written
+	 * object region a bit taller */
+	n_rows = model->n_vert_y;
+	height = region->rect.height;
+	if(model->export_step > 1) {
+		n_rows = (model->n_vert_y + model->export_step - 1) /
+			model->export_step;
+		height = region->rect.height * n_rows * model->export_step /
+			model->n_vert_y;
+		rows = g_new(gfloat, model->n_angles * n_rows);
+		for(c = 0; c < 3; c ++)
+			row_colors[c] = g_new(guint8, model->n_angles * n_rows);
+		model_decimate_rows(model, verts, colors, n_rows, rows, row_colors);
+		g_free(verts);
+		verts = rows;
+		for(c = 0; c < 3; c ++) {
+			if(own_colors)
+				g_free(colors[c]);
+			colors[c] = row_colors[c];
+		}
+		own_colors = TRUE;
+	}
+
+	if(model->texture)
+		retval = ac3d_write_textured(filename, verts,
+			model->texture, model->tex_band, model->tex_rows,
+			model->n_angles, n_rows, height, progress, user_data);
+	else
+		retval = ac3d_write(filename, verts, colors,
+			model->n_angles, n_rows, height, progress, user_data);
+
+	g_free(verts);
+	if(own_colors)
+		for(c = 0; c < 3; c ++)
+			g_free(colors[c]);
+	return retval;
+}
+
+guint16 *model_alloc_tile(Model *model, guint32 angle)
+{
+	guint16 **tile = model->tiles + angle / MODEL_TILE_ANGLES;
+
+	if(*tile == NULL)
+		*tile = g_new0(guint16, MODEL_TILE_ANGLES * model->n_vert_y * 2);
+	return *tile;
+}
+
+/* black means no color yet, as in the preview; texture strips are
+ * cleared apart from the vertex colors when the object region moves */
+gboolean model_has_colors(Model *model, guint32 angle)
+{
+	guint32 i, n;
+	guint8 *texel, col[3];
+
+	if(model->texture) {
+		n = model->tex_rows * model->tex_band * 3;
+		texel = model->texture + angle * n;
+		for(i = 0; i < n; i ++)
+			if(texel[i])
+				return TRUE;
+		return FALSE;
+	}
+
+	for(i = 0; i < model->n_vert_y; i ++) {
+		model_get_color(model, angle, i, col);
+		if(col[0] | col[1] | col[2])
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* adds the scans of part, a model with the same geometry and regions
+ * which saw later frames of the same sequence: radii keep the smaller one
+ * as scan_angle() does, the colors of an angle come from the model which
+ * had them first and hull silhouettes are intersected; merging parts in
+ * frame order gives the model a single pass would have built */
+gboolean model_merge(Model *model, Model *part)
+{
+	guint32 a, i, n;
+	guint8 rgb[3];
+	gfloat v, r;
+
+	if((part->n_angles != model->n_angles) ||
+		(part->n_vert_y != model->n_vert_y) ||
+		(part->tex_band != model->tex_band) ||
+		(part->tex_rows != model->tex_rows)) {
+		g_warning("model_merge: geometry differs (%u x %u, %u x %u)",
+			model->n_angles, model->n_vert_y, part->n_angles,
+			part->n_vert_y);
+		return FALSE;
+	}
+
+	n = model->tex_rows * model->tex_band * 3;
+	for(a = 0; a < model->n_angles; a ++) {
+		if(part->angle_scans[a] == 0)
+			continue;
+		model->angle_scans[a] = MIN(model->angle_scans[a] +
+			part->angle_scans[a], 255);
+		for(i = 0; i < model->n_vert_y; i ++) {
+			r = model_get_radius(part, a, i);
+			v = model_get_radius(model, a, i);
+			if((r != 0) && ((v == 0) || (v > r)))
+				model_set_radius(model, a, i, r);
+		}
+		model->angle_dirty[a] = 1;
+	}
+	for(a = 0; a < model->n_angles; a ++) {
+		if(model_has_colors(model, a) || !model_has_colors(part, a))
+			continue;
+		for(i = 0; i < model->n_vert_y; i ++) {
+			model_get_color(part, a, i, rgb);
+			model_set_color(model, a, i, rgb);
+		}
+		if(model->texture)
+			memcpy(model->texture + a * n, part->texture + a * n, n);
+		model->angle_dirty[a] = 1;
+	}
+
+	if(part->hull_stale)
+		model->hull_stale = TRUE;
+	if(part->hull) {
+		if(model->hull == NULL)
+			model->hull = hull_copy(part->hull);
+		else if(!hull_merge(model->hull, part->hull))
+			return FALSE;
+	}
+	return TRUE;
 }
 
 /*****************************************************************************/
 
+static gchar *model_region_section(Model *model, RegionType type)
+{
+	const gchar *rname;
+
+	switch(type) {
+		case REGION_GRAYCODE: rname = "graycode"; break;
+		case REGION_OBJECT:   rname = "object";   break;
+		default: return NULL;
+	}
+	if(model->name)
+		return g_strdup_printf("regions.%s.%s", model->name, rname);
+	return g_strdup_printf("regions.%s", rname);
+}
+
 static void model_delete_regions(Model *model)
 {
+	GSList *item;
+
+	for(item = model->regions; item != NULL; item = item->next)
+		g_free(item->data);
+	g_slist_free(model->regions);
+	model->regions = NULL;
 }
 
 static void model_create_regions(Model *model, Config *config)
 {
 	Region *region;
-	const gchar *prefix;
+	gchar *prefix;
 	gint32 i;
 
 	for(i = 0; i < NUM_REGIONS; i ++) {
 		region = g_new0(Region, 1);
 		region->type = i;
-		switch(region->type) {
-			case REGION_GRAYCODE:
-				prefix = "regions.graycode";
-				break;
-			case REGION_OBJECT:
-				prefix = "regions.object";
-				break;
-			case NUM_REGIONS: /* ignore */ break;
-		}
+		prefix = model_region_section(model, region->type);
 		region->rect.x = config_get_int(config, prefix, "x", 0);
 		region->rect.y = config_get_int(config, prefix, "y", 0);
 		region->rect.width = config_get_int(config, prefix, "width", 0);
 		region->rect.height = config_get_int(config, prefix, "height", 0);
+		g_free(prefix);
 		model->regions = g_slist_append(model->regions, region);
 	}
 }
 
+/* heuristics are shared by all cameras; without a config the defaults
+ * are used, the tolerance is stored in percent */
+static void model_set_params(Model *model, Config *config)
+{
+	model->bg_tolerance = MODEL_BG_TOLERANCE / 100.0;
+	model->bg_offset = MODEL_BG_OFFSET;
+	model->max_scans = MODEL_MAX_SCANS;
+	model->dual_edge = MODEL_DUAL_EDGE;
+	model->quality.min_sharpness = MODEL_MIN_SHARPNESS;
+	model->quality.min_brightness = MODEL_MIN_BRIGHTNESS;
+	model->quality.max_saturated = MODEL_MAX_SATURATED;
+	model->hull_depth = MODEL_HULL_DEPTH;
+	model->filter = TRUE;
+	model->filter_window = MODEL_FILTER_WINDOW;
+	model->filter_outlier = MODEL_FILTER_OUTLIER;
+	model->export_step = 1;
+	model->tex_band = MODEL_TEX_BAND;
+	model->tex_rows = MODEL_TEX_ROWS;
+	if(config == NULL)
+		return;
+
+	model->bg_tolerance = config_get_int(config, "scan", "bg_tolerance",
+		MODEL_BG_TOLERANCE) / 100.0;
+	model->bg_offset = config_get_int(config, "scan", "bg_offset",
+		MODEL_BG_OFFSET);
+	/* angle_scans counts in a byte */
+	model->max_scans = CLAMP(config_get_int(config, "scan", "max_scans",
+		MODEL_MAX_SCANS), 1, 255);
+	model->dual_edge = config_get_int(config, "scan", "dual_edge",
+		MODEL_DUAL_EDGE) ? TRUE : FALSE;
+	model->quality.min_sharpness = CLAMP(config_get_int(config, "quality",
+		"sharpness", MODEL_MIN_SHARPNESS), 0, 100);
+	model->quality.min_brightness = CLAMP(config_get_int(config, "quality",
+		"brightness", MODEL_MIN_BRIGHTNESS), 0, 255);
+	model->quality.max_saturated = CLAMP(config_get_int(config, "quality",
+		"saturated", MODEL_MAX_SATURATED), 0, 100);
+	/* see hull_new() for the supported range */
+	model->hull_depth = CLAMP(config_get_int(config, "hull", "depth",
+		MODEL_HULL_DEPTH), 0, 8);
+	model->filter = config_get_int(config, "filter", "enabled", 1) ?
+		TRUE : FALSE;
+	model->filter_window = CLAMP(config_get_int(config, "filter", "window",
+		MODEL_FILTER_WINDOW), 0, FILTER_MAX_WINDOW);
+	model->filter_outlier = MAX(config_get_int(config, "filter", "outlier",
+		MODEL_FILTER_OUTLIER), 1);
+	model->export_step = CLAMP(config_get_int(config, "export", "row_step",
+		1), 1, 64);
+	model->tex_band = CLAMP(config_get_int(config, "texture", "band",
+		MODEL_TEX_BAND), 0, 64);
+	model->tex_rows = CLAMP(config_get_int(config, "texture", "rows",
+		MODEL_TEX_ROWS), 16, 4096);
+}
+
+static void model_update_lens_map(Model *model)
+{
+	Region *object, *graycode;
+
+	if(model->lens_map)
+		lens_map_free(model->lens_map);
+	model->lens_map = NULL;
+	if(model->lens.width == 0)
+		return;
+
+	object = g_slist_nth_data(model->regions, REGION_OBJECT);
+	graycode = g_slist_nth_data(model->regions, REGION_GRAYCODE);
+	model->lens_map = lens_map_new(&(model->lens), &(object->rect),
+		model->n_vert_y, &(graycode->rect), model->code,
+		model->texture ? model->tex_rows : 0, model->tex_band);
+}
+
+/* move the radius profiles from the object rectangle "from" to "to":
+ * radii are re-based on the new center column and rows are resampled at
+ * their new pixel heights; rows outside the old rectangle start empty */
+static void model_remap_rows(Model *model, GdkRectangle *from,
+	GdkRectangle *to)
+{
+	gfloat *pos, *row, sh_from, sh_to, y, f, v0, v1;
+	guint8 *col;
+	guint32 n_angles, i, j, j0, j1;
+	gint32 dx;
+	gboolean uncovered = FALSE;
+
+	n_angles = model->n_angles;
+	sh_from = (gfloat)from->height / model->n_vert_y;
+	sh_to = (gfloat)to->height / model->n_vert_y;
+	dx = (to->x + to->width / 2) - (from->x + from->width / 2);
+
+	pos = g_new(gfloat, model->n_vert_y);
+	for(j = 0; j < model->n_vert_y; j ++) {
+		/* inverse of the row placement in scan_angle() */
+		y = (to->y + to->height - 1) - j * sh_to - sh_to / 2;
+		pos[j] = ((from->y + from->height - 1) - sh_from / 2 - y) / sh_from;
+		if((pos[j] < -0.5) || (pos[j] > model->n_vert_y - 0.5)) {
+			pos[j] = -1.0;
+			uncovered = TRUE;
+		} else {
+			pos[j] = CLAMP(pos[j], 0.0, model->n_vert_y - 1);
+		}
+	}
+
+	row = g_new(gfloat, model->n_vert_y);
+	col = g_new(guint8, model->n_vert_y * 3);
+	for(i = 0; i < n_angles; i ++) {
+		for(j = 0; j < model->n_vert_y; j ++) {
+			if(pos[j] < 0.0) {
+				row[j] = 0.0;
+				memset(col + j * 3, 0, 3);
+				continue;
+			}
+			j0 = (guint32)pos[j];
+			j1 = MIN(j0 + 1, model->n_vert_y - 1);
+			f = pos[j] - j0;
+			v0 = model_get_radius(model, i, j0);
+			v1 = model_get_radius(model, i, j1);
+			/* never blend with rows which were not scanned yet */
+			if((v0 == 0.0) || (v1 == 0.0))
+				row[j] = (f < 0.5) ? v0 : v1;
+			else
+				row[j] = v0 * (1.0 - f) + v1 * f;
+			if(row[j] != 0.0)
+				row[j] += dx;
+			model_get_color(model, i, (f < 0.5) ? j0 : j1, col + j * 3);
+		}
+		for(j = 0; j < model->n_vert_y; j ++) {
+			model_set_radius(model, i, j, row[j]);
+			model_set_color(model, i, j, col + j * 3);
+		}
+		/* strips follow the region rows, sample them again */
+		if(model->texture)
+			memset(model->texture + i * model->tex_rows * model->tex_band * 3,
+				0, model->tex_rows * model->tex_band * 3);
+		/* rescan angles with rows which are new to the region */
+		if(uncovered)
+			model->angle_scans[i] = 0;
+		model->angle_dirty[i] = 1;
+	}
+	g_free(col);
+	g_free(row);
+	g_free(pos);
+}
+
+/* every export_step rows of the planes become one, the mean of those with
+ * a silhouette (radii) and those with a color (colors) */
+static void model_decimate_rows(Model *model, gfloat *verts,
+	guint8 **colors, guint32 n_rows, gfloat *out_verts, guint8 **out_colors)
+{
+	guint32 i, j, k, c, src, dst, n_verts, n_colors, sum[3];
+	gfloat sum_r;
+
+	for(i = 0; i < model->n_angles; i ++)
+		for(j = 0; j < n_rows; j ++) {
+			sum_r = 0.0;
+			sum[0] = sum[1] = sum[2] = 0;
+			n_verts = n_colors = 0;
+			for(k = j * model->export_step; (k < model->n_vert_y) &&
+				(k < (j + 1) * model->export_step); k ++) {
+				src = i * model->n_vert_y + k;
+				if(verts[src] != 0.0) {
+					sum_r += verts[src];
+					n_verts ++;
+				}
+				if(colors[0][src] | colors[1][src] | colors[2][src]) {
+					for(c = 0; c < 3; c ++)
+						sum[c] += colors[c][src];
+					n_colors ++;
+				}
+			}
+			dst = i * n_rows + j;
+			out_verts[dst] = n_verts ? (sum_r / n_verts) : 0.0;
+			for(c = 0; c < 3; c ++)
+				out_colors[c][dst] = n_colors ? (sum[c] / n_colors) : 0;
+		}
+}
+
+static gboolean model_has_scans(Model *model)
+{
+	guint32 i;
+
+	for(i = 0; i < model->n_angles; i ++)
+		if(model->angle_scans[i])
+			return TRUE;
+	return FALSE;
+}
+
+static void model_delete_tiles(Model *model)
+{
+	guint32 i;
+
+	if(model->tiles == NULL)
+		return;
+	for(i = 0; i < (model->n_angles + MODEL_TILE_ANGLES - 1) /
+		MODEL_TILE_ANGLES; i ++) {
+		g_free(model->tiles[i]);
+		model->tiles[i] = NULL;
+	}
+}
+
 static void model_delete_storage(Model *model)
 {
-	if(model->angle_scans)
-		g_free(model->angle_scans);
-	if(model->angle_colors)
-		g_free(model->angle_colors);
-	if(model->angle_verts)
-		g_free(model->angle_verts);
+	model_delete_tiles(model);
+	g_free(model->tiles);
+	model->tiles = NULL;
+	g_free(model->angle_dirty);
+	model->angle_dirty = NULL;
+	if(model->session) {
+		session_set_regions(model->session, model->regions);
+		session_close(model->session);
+		model->session = NULL;
+	}
+	g_free(model->arena_block);
+	model->arena_block = NULL;
+	model->arena = NULL;
 }
 
 static void model_create_storage(Model *model)
 {
-	model->angle_scans = g_new0(guint8, (1 << model->n_bits));
-	model->angle_verts = g_new0(gfloat,
-		model->n_vert_y * (1 << model->n_bits));
-	model->angle_colors = g_new0(guint8,
-		model->n_vert_y * (1 << model->n_bits) * 3);
-}
+	guint32 n_angles;
+	gint32 c;
+
+	model->n_angles = n_angles = (1 << (model->n_bits + model->sub_bits));
+	/* compact storage keeps only the scan counts and textures in the
+	 * arena */
+	model_layout(&(model->layout), n_angles,
+		model->compact ? 0 : model->n_vert_y,
+		model->tex_band * model->tex_rows);
 
+	/* everything is new to consumers of the dirty flags */
+	model->angle_dirty = g_new(guint8, n_angles);
+	memset(model->angle_dirty, 1, n_angles);
 
+	if((model->session == NULL) && (model->session_file[0] != '\0'))
+		model->session = session_create(model->session_file,
+			model->n_bits, model->sub_bits, model->n_vert_y,
+			model->tex_band, model->tex_rows, model->layout.size);
+	if(model->session) {
+		session_set_regions(model->session, model->regions);
+		model->arena = session_get_arena(model->session);
+	} else {
+		model->arena_block = g_malloc0(model->layout.size + MODEL_ALIGN);
+		model->arena = (guint8 *)model_align((gsize)model->arena_block);
+	}
+
+	model->angle_scans = model->arena + model->layout.scans;
+	if(model->compact) {
+		model->tiles = g_new0(guint16 *,
+			(n_angles + MODEL_TILE_ANGLES - 1) / MODEL_TILE_ANGLES);
+		model->angle_verts = NULL;
+		for(c = 0; c < 3; c ++)
+			model->angle_colors[c] = NULL;
+	} else {
+		model->angle_verts = (gfloat *)(model->arena + model->layout.verts);
+		for(c = 0; c < 3; c ++)
+			model->angle_colors[c] = model->arena + model->layout.colors[c];
+	}
+	model->texture = (model->tex_band > 0) ?
+		(model->arena + model->layout.texture) : NULL;
+}
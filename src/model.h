@@ -2,24 +2,244 @@
 #define _MODEL_H
 
 #include "config.h"
+#include "region.h"
+#include "session.h"
+#include "ac3d.h"
+#include "hull.h"
+#include "lens.h"
+#include "gray.h"
+#include "obslog.h"
+#include "quality.h"
+
+#define MODEL_ALIGN 64
+/* defaults of the scan heuristics, see scan_binarize_object_region() */
+#define MODEL_MAX_SCANS 10
+#define MODEL_BG_TOLERANCE 80
+#define MODEL_BG_OFFSET 32
+#define MODEL_DUAL_EDGE 1
+/* frame gating, see quality_check(): only clearly smeared, black or
+ * mostly clipped frames are dropped */
+#define MODEL_MIN_SHARPNESS 30
+#define MODEL_MIN_BRIGHTNESS 16
+#define MODEL_MAX_SATURATED 50
+/* octree depth of the visual hull, 0 exports the radius profiles */
+#define MODEL_HULL_DEPTH 0
+/* texture strips: band width in pixels (0 keeps vertex colors) and rows */
+#define MODEL_TEX_BAND 0
+#define MODEL_TEX_ROWS 256
+/* post-processing: median window in angles on each side (0: only fill
+ * gaps) and smallest deviation in pixels rejected as outlier */
+#define MODEL_FILTER_WINDOW 2
+#define MODEL_FILTER_OUTLIER 3
+/* compact storage: angles per tile, radii in 1/MODEL_RADIUS_SCALE pixels
+ * (signed, the left edge may lie beyond the center column) */
+#define MODEL_TILE_ANGLES 16
+#define MODEL_RADIUS_SCALE 8.0
+/* most profile rows, also with a row per pixel row of the object region */
+#define MODEL_MAX_ROWS 4096
+
+/* byte offsets of the storage planes inside the model arena; each plane
+ * starts on a MODEL_ALIGN boundary and keeps the rows of one angle
+ * contiguous (index: angle * n_vert_y + row); the optional texture plane
+ * comes last, so readers which ignore it can use a layout without it */
+typedef struct {
+	gsize scans;
+	gsize verts;
+	gsize colors[3];
+	gsize texture;
+	gsize size;
+} ModelLayout;
 
 typedef struct {
+	gchar *name;
 	GSList *regions;
 	gboolean valid_dir;
 
 	guint32 n_vert_y;
+	/* [base] n_vert_y 0: a profile row per pixel row of the object region
+	 * as it was when the model was created */
+	gboolean full_rows;
 	guint32 n_bits;
 	guint8 *bits;
+	/* how bits are read from the strip region and decoded, [base] code */
+	GrayCode *code;
+	/* the angle grid splits every printed code step into 1 << sub_bits
+	 * angles, see angle_tracker_update() */
+	guint32 sub_bits;
+	guint32 n_angles;
+
+	ModelLayout layout;
+	guint8 *arena_block;
+	guint8 *arena;
 
 	guint8 *angle_scans;
 	gfloat *angle_verts;
-	guint8 *angle_colors;
+	guint8 *angle_colors[3];
+	guint8 *angle_dirty;
+
+	/* compact storage replaces angle_verts and angle_colors (both NULL
+	 * then) by tiles of MODEL_TILE_ANGLES angles, allocated on the first
+	 * write; a tile holds signed 16 bit fixed point radii followed by
+	 * RGB565 colors, where 0 is kept for black (index: (angle %
+	 * MODEL_TILE_ANGLES) * n_vert_y + row); use
+	 * the accessors below, which work for both layouts */
+	gboolean compact;
+	guint16 **tiles;
+
+	/* per angle a strip of tex_rows x tex_band RGB texels from the center
+	 * column band of the object region, top row first (index:
+	 * ((angle * tex_rows + row) * tex_band + column) * 3) */
+	guint32 tex_band;
+	guint32 tex_rows;
+	guint8 *texture;
+
+	/* scan heuristics: color ratio tolerance, gray value offset, scans
+	 * per angle and whether the right silhouette edge is used as well */
+	gfloat bg_tolerance;
+	guint32 bg_offset;
+	guint32 max_scans;
+	gboolean dual_edge;
+	/* frames failing these never reach the scan, [quality] */
+	QualityParams quality;
+
+	/* outlier rejection and gap filling for export and preview, see
+	 * filter_radii() */
+	gboolean filter;
+	guint32 filter_window;
+	gfloat filter_outlier;
+	/* model_save() writes the mean of every export_step rows as one,
+	 * [export] row_step */
+	guint32 export_step;
+
+	/* silhouettes for the visual hull, created on the first frame once
+	 * hull_depth is set and the object region is known; they live on the
+	 * heap only, hull_stale marks radii scanned from frames whose
+	 * silhouettes are gone (a resumed session, a moved object region), so
+	 * model_save() refuses the hull until model_clear() */
+	guint32 hull_depth;
+	Hull *hull;
+	gboolean hull_stale;
+
+	/* lens distortion from [lens] (or [lens.NAME]), the map follows the
+	 * regions; without calibration the map is NULL and raw pixels are
+	 * sampled */
+	LensParams lens;
+	LensMap *lens_map;
+
+	gchar *session_file;
+	Session *session;
+
+	/* every silhouette edge scan_frame() finds is appended here if set;
+	 * owned by whoever set it */
+	ObsLog *obslog;
 } Model;
 
-Model *model_init(Config *config);
+Model *model_init(Config *config, gboolean resume);
+Model *model_init_named(Config *config, const gchar *name, gboolean resume);
+Model *model_new(guint32 n_bits, guint32 sub_bits, guint32 n_vert_y);
 void model_cleanup(Model *model);
-void model_rebuild_storage(Model *model);
+Model *model_snapshot(Model *model);
+void model_clear(Model *model);
+void model_set_region(Model *model, RegionType type, GdkRectangle *rect);
+void model_set_code(Model *model, GrayCodeType type);
+void model_layout(ModelLayout *layout, guint32 n_angles, guint32 n_vert_y,
+	guint32 tex_texels);
 gboolean model_save_config(Model *model, Config *config);
-gboolean model_save(Model *model, const gchar *filename);
+gboolean model_save(Model *model, const gchar *filename,
+	Ac3dProgressFunc progress, gpointer user_data);
+guint16 *model_alloc_tile(Model *model, guint32 angle);
+gboolean model_has_colors(Model *model, guint32 angle);
+gboolean model_merge(Model *model, Model *part);
+
+/*****************************************************************************/
+
+static inline guint16 *model_tile(Model *model, guint32 angle,
+	guint32 row, gboolean colors)
+{
+	guint16 *tile = model->tiles[angle / MODEL_TILE_ANGLES];
+
+	if(tile == NULL)
+		return NULL;
+	return tile + (colors ? MODEL_TILE_ANGLES * model->n_vert_y : 0) +
+		(angle % MODEL_TILE_ANGLES) * model->n_vert_y + row;
+}
+
+/* 0 is a row without silhouette */
+static inline gfloat model_get_radius(Model *model, guint32 angle,
+	guint32 row)
+{
+	guint16 *v;
+
+	if(!model->compact)
+		return model->angle_verts[angle * model->n_vert_y + row];
+	v = model_tile(model, angle, row, FALSE);
+	return v ? (*(gint16 *)v / MODEL_RADIUS_SCALE) : 0.0;
+}
+
+static inline void model_set_radius(Model *model, guint32 angle,
+	guint32 row, gfloat r)
+{
+	guint16 *v;
+
+	if(!model->compact) {
+		model->angle_verts[angle * model->n_vert_y + row] = r;
+		return;
+	}
+	v = model_tile(model, angle, row, FALSE);
+	if(v == NULL) {
+		if(r == 0.0)
+			return;
+		model_alloc_tile(model, angle);
+		v = model_tile(model, angle, row, FALSE);
+	}
+	*(gint16 *)v = CLAMP(r * MODEL_RADIUS_SCALE + ((r < 0.0) ? -0.5 : 0.5),
+		-32767.0, 32767.0);
+}
+
+/* black is a row without color */
+static inline void model_get_color(Model *model, guint32 angle,
+	guint32 row, guint8 *rgb)
+{
+	guint16 *c;
+	gint32 i;
+
+	if(!model->compact) {
+		for(i = 0; i < 3; i ++)
+			rgb[i] = model->angle_colors[i][angle * model->n_vert_y + row];
+		return;
+	}
+	c = model_tile(model, angle, row, TRUE);
+	if(c == NULL) {
+		rgb[0] = rgb[1] = rgb[2] = 0;
+		return;
+	}
+	rgb[0] = ((*c >> 11) & 0x1F) * 255 / 31;
+	rgb[1] = ((*c >> 5) & 0x3F) * 255 / 63;
+	rgb[2] = (*c & 0x1F) * 255 / 31;
+}
+
+static inline void model_set_color(Model *model, guint32 angle,
+	guint32 row, guint8 *rgb)
+{
+	guint16 *c;
+	gint32 i;
+
+	if(!model->compact) {
+		for(i = 0; i < 3; i ++)
+			model->angle_colors[i][angle * model->n_vert_y + row] = rgb[i];
+		return;
+	}
+	c = model_tile(model, angle, row, TRUE);
+	if(c == NULL) {
+		if((rgb[0] | rgb[1] | rgb[2]) == 0)
+			return;
+		model_alloc_tile(model, angle);
+		c = model_tile(model, angle, row, TRUE);
+	}
+	*c = ((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3);
+	/* dark colors would read back as black, i.e. as none */
+	if((*c == 0) && (rgb[0] | rgb[1] | rgb[2]))
+		*c = 1;
+}
 
 #endif
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "obslog.h"
+
+static gpointer obslog_thread(gpointer data)
+{
+	ObsLog *log = data;
+	ObsLogBlock *block;
+
+	while((block = g_async_queue_pop(log->full)) != (gpointer)log) {
+		if(!g_atomic_int_get(&(log->failed))) {
+			if(fwrite(block, sizeof(ObsLogBlock), 1, log->f) == 1) {
+				g_atomic_int_inc(&(log->n_written));
+			} else {
+				g_warning("writing observation log %s failed: %s (%d)",
+					log->filename, strerror(errno), errno);
+				g_atomic_int_set(&(log->failed), 1);
+			}
+		}
+		g_async_queue_push(log->empty, block);
+	}
+	fflush(log->f);
+	return NULL;
+}
+
+/* hands the current block to the writer, empty blocks are never written */
+static void obslog_flush(ObsLog *log)
+{
+	if((log->block == NULL) || (log->block->n_records == 0))
+		return;
+	g_async_queue_push(log->full, log->block);
+	log->block = NULL;
+}
+
+static ObsLogBlock *obslog_block(ObsLog *log)
+{
+	if(log->block == NULL) {
+		log->block = g_async_queue_try_pop(log->empty);
+		if(log->block == NULL)
+			return NULL;
+		log->block->n_records = 0;
+		log->block->rect[0] = log->rect.x;
+		log->block->rect[1] = log->rect.y;
+		log->block->rect[2] = log->rect.width;
+		log->block->rect[3] = log->rect.height;
+	}
+	return log->block;
+}
+
+ObsLog *obslog_new(const gchar *filename, guint32 n_bits, guint32 sub_bits,
+	guint32 n_vert_y)
+{
+	ObsLog *log;
+	GError *error = NULL;
+	gchar *dirname;
+	gint32 i;
+
+	log = g_new0(ObsLog, 1);
+	log->filename = g_strdup(filename);
+	memcpy(log->header.magic, OBSLOG_MAGIC, 8);
+	log->header.version = OBSLOG_VERSION;
+	log->header.header_size = sizeof(ObsLogHeader);
+	log->header.block_size = sizeof(ObsLogBlock);
+	log->header.block_records = OBSLOG_BLOCK_RECORDS;
+	log->header.n_bits = n_bits;
+	log->header.sub_bits = sub_bits;
+	log->header.n_vert_y = n_vert_y;
+
+	dirname = g_path_get_dirname(filename);
+	g_mkdir(dirname, 0755);
+	g_free(dirname);
+
+	log->f = fopen(filename, "wb");
+	if(log->f == NULL) {
+		g_warning("failed to create observation log %s: %s (%d)", filename,
+			strerror(errno), errno);
+		g_free(log->filename);
+		g_free(log);
+		return NULL;
+	}
+	if(fwrite(&(log->header), sizeof(ObsLogHeader), 1, log->f) != 1) {
+		g_warning("failed to write observation log %s: %s (%d)", filename,
+			strerror(errno), errno);
+		fclose(log->f);
+		g_free(log->filename);
+		g_free(log);
+		return NULL;
+	}
+
+	log->full = g_async_queue_new();
+	log->empty = g_async_queue_new();
+	for(i = 0; i < OBSLOG_BLOCKS; i ++)
+		g_async_queue_push(log->empty, g_new0(ObsLogBlock, 1));
+
+	log->thread = g_thread_create(obslog_thread, log, TRUE, &error);
+	if(log->thread == NULL) {
+		g_warning("failed to start observation log writer: %s",
+			error->message);
+		g_error_free(error);
+		log->failed = 1;
+	}
+	return log;
+}
+
+/* writes what is left and waits for the disk */
+void obslog_free(ObsLog *log)
+{
+	ObsLogBlock *block;
+
+	if(log->thread) {
+		obslog_flush(log);
+		g_async_queue_push(log->full, log);
+		g_thread_join(log->thread);
+	}
+	if(log->block)
+		g_free(log->block);
+	while((block = g_async_queue_try_pop(log->full)) != NULL)
+		g_free(block);
+	while((block = g_async_queue_try_pop(log->empty)) != NULL)
+		g_free(block);
+	g_async_queue_unref(log->full);
+	g_async_queue_unref(log->empty);
+
+	g_debug("observation log %s: %u records, %d blocks, %u dropped",
+		log->filename, log->n_records, log->n_written, log->n_dropped);
+	fclose(log->f);
+	g_free(log->filename);
+	g_free(log);
+}
+
+/* the frame every following obslog_add() belongs to */
+void obslog_frame(ObsLog *log, guint32 seq, guint64 stamp, guint32 code,
+	GdkRectangle *rect)
+{
+	log->seq = seq;
+	log->stamp = stamp;
+	log->code = code;
+	if(memcmp(&(log->rect), rect, sizeof(GdkRectangle)) != 0) {
+		obslog_flush(log);
+		log->rect = *rect;
+	}
+}
+
+void obslog_add(ObsLog *log, guint32 angle, guint32 row, guint32 side,
+	gint32 edge, guint8 confidence, guint8 *rgb)
+{
+	ObsLogBlock *block;
+	guint32 i;
+
+	block = obslog_block(log);
+	if(block == NULL) {
+		log->n_dropped ++;
+		return;
+	}
+
+	i = block->n_records ++;
+	block->stamp[i] = log->stamp;
+	block->seq[i] = log->seq;
+	block->code[i] = log->code;
+	block->angle[i] = angle;
+	block->edge[i] = edge;
+	block->row[i] = row;
+	block->side[i] = side;
+	block->confidence[i] = confidence;
+	block->red[i] = rgb[0];
+	block->green[i] = rgb[1];
+	block->blue[i] = rgb[2];
+	log->n_records ++;
+
+	if(block->n_records == OBSLOG_BLOCK_RECORDS)
+		obslog_flush(log);
+}
+
+/*****************************************************************************/
+
+FILE *obslog_open(const gchar *filename, ObsLogHeader *header)
+{
+	FILE *f;
+
+	f = fopen(filename, "rb");
+	if(f == NULL) {
+		g_warning("failed to open observation log %s: %s (%d)", filename,
+			strerror(errno), errno);
+		return NULL;
+	}
+	if(fread(header, sizeof(ObsLogHeader), 1, f) != 1) {
+		g_warning("observation log %s: short file", filename);
+		fclose(f);
+		return NULL;
+	}
+	if(memcmp(header->magic, OBSLOG_MAGIC, 8) != 0) {
+		g_warning("observation log %s: bad magic", filename);
+		fclose(f);
+		return NULL;
+	}
+	if((header->version != OBSLOG_VERSION) ||
+		(header->header_size != sizeof(ObsLogHeader)) ||
+		(header->block_size != sizeof(ObsLogBlock)) ||
+		(header->block_records != OBSLOG_BLOCK_RECORDS)) {
+		g_warning("observation log %s: unsupported version %d", filename,
+			header->version);
+		fclose(f);
+		return NULL;
+	}
+	if((header->n_bits == 0) || (header->n_bits > 16) ||
+		((header->n_bits + header->sub_bits) > 20) ||
+		(header->n_vert_y == 0)) {
+		g_warning("observation log %s: corrupt header", filename);
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+/* FALSE at the end of the log; a block cut short by a crash ends it too */
+gboolean obslog_read(FILE *f, ObsLogBlock *block)
+{
+	if(fread(block, sizeof(ObsLogBlock), 1, f) != 1)
+		return FALSE;
+	return (block->n_records <= OBSLOG_BLOCK_RECORDS);
+}
@@ -0,0 +1,96 @@
+#ifndef _OBSLOG_H
+#define _OBSLOG_H
+
+#include <stdio.h>
+
+#include <glib.h>
+
+#include "region.h"
+
+#define OBSLOG_MAGIC      "3DSCANOL"
+#define OBSLOG_VERSION    2
+/* records per block; blocks are always written whole */
+#define OBSLOG_BLOCK_RECORDS 4096
+/* blocks filled or in flight; with all of them waiting for the disk new
+ * records are dropped instead of stalling the scan */
+#define OBSLOG_BLOCKS     8
+
+/* edge sides: the left one is the profile at angle, the right one the
+ * profile half a turn later, see scan_angle(); color records hold the
+ * vertex colors scan_colors() took for angle instead of an edge */
+#define OBSLOG_LEFT       0
+#define OBSLOG_RIGHT      1
+#define OBSLOG_COLOR      2
+
+/* on-disk header at offset 0, host byte order; blocks follow back to back */
+typedef struct {
+	gchar magic[8];
+	guint32 version;
+	guint32 header_size;
+	guint32 block_size;
+	guint32 block_records;
+	guint32 n_bits;
+	guint32 sub_bits;
+	guint32 n_vert_y;
+	guint32 reserved;
+} ObsLogHeader;
+
+/* one silhouette edge per record, stored column by column; rect is the
+ * object region the rows of the block refer to, a block never spans a
+ * region change. angle is the profile the edge belongs to (the opposite
+ * one for right edges), code the decoded gray code value of the frame,
+ * edge the distance from the turntable axis in pixels, confidence the
+ * gray value step across the edge in the raw frame and the color the one
+ * just inside the silhouette. color records leave edge and confidence 0 */
+typedef struct {
+	guint32 n_records;
+	gint32 rect[4];
+	guint32 reserved[3];
+	guint64 stamp[OBSLOG_BLOCK_RECORDS];
+	guint32 seq[OBSLOG_BLOCK_RECORDS];
+	guint32 code[OBSLOG_BLOCK_RECORDS];
+	guint32 angle[OBSLOG_BLOCK_RECORDS];
+	gint16 edge[OBSLOG_BLOCK_RECORDS];
+	guint16 row[OBSLOG_BLOCK_RECORDS];
+	guint8 side[OBSLOG_BLOCK_RECORDS];
+	guint8 confidence[OBSLOG_BLOCK_RECORDS];
+	guint8 red[OBSLOG_BLOCK_RECORDS];
+	guint8 green[OBSLOG_BLOCK_RECORDS];
+	guint8 blue[OBSLOG_BLOCK_RECORDS];
+} ObsLogBlock;
+
+/* appended to by the thread which updates the model, written by its own
+ * thread */
+typedef struct {
+	gchar *filename;
+	FILE *f;
+	ObsLogHeader header;
+	GThread *thread;
+	GAsyncQueue *full;
+	GAsyncQueue *empty;
+	ObsLogBlock *block;
+
+	/* current frame, see obslog_frame() */
+	guint32 seq;
+	guint64 stamp;
+	guint32 code;
+	GdkRectangle rect;
+
+	guint32 n_records;
+	guint32 n_dropped;
+	volatile gint n_written;
+	volatile gint failed;
+} ObsLog;
+
+ObsLog *obslog_new(const gchar *filename, guint32 n_bits, guint32 sub_bits,
+	guint32 n_vert_y);
+void obslog_free(ObsLog *log);
+void obslog_frame(ObsLog *log, guint32 seq, guint64 stamp, guint32 code,
+	GdkRectangle *rect);
+void obslog_add(ObsLog *log, guint32 angle, guint32 row, guint32 side,
+	gint32 edge, guint8 confidence, guint8 *rgb);
+
+FILE *obslog_open(const gchar *filename, ObsLogHeader *header);
+gboolean obslog_read(FILE *f, ObsLogBlock *block);
+
+#endif
@@ -0,0 +1,344 @@
+#include <string.h>
+
+#include <glib.h>
+
+#include "pipeline.h"
+#include "model.h"
+#include "region.h"
+#include "quality.h"
+#include "scan.h"
+#include "v4l2.h"
+
+static PipelineQueue *pipeline_queue_new(const gchar *name, guint32 depth)
+{
+	PipelineQueue *queue;
+
+	queue = g_new0(PipelineQueue, 1);
+	queue->name = name;
+	queue->mutex = g_mutex_new();
+	queue->not_empty = g_cond_new();
+	queue->not_full = g_cond_new();
+	queue->items = g_queue_new();
+	queue->depth = MAX(depth, 1);
+	return queue;
+}
+
+static void pipeline_queue_free(PipelineQueue *queue)
+{
+	PipelineFrame *frame;
+
+	while((frame = g_queue_pop_head(queue->items)) != NULL)
+		pipeline_frame_free(frame);
+	g_queue_free(queue->items);
+	g_cond_free(queue->not_full);
+	g_cond_free(queue->not_empty);
+	g_mutex_free(queue->mutex);
+	g_free(queue);
+}
+
+/* wakes up everyone waiting, later pushes fail and pops drain the rest */
+static void pipeline_queue_close(PipelineQueue *queue)
+{
+	g_mutex_lock(queue->mutex);
+	queue->closed = TRUE;
+	g_cond_broadcast(queue->not_empty);
+	g_cond_broadcast(queue->not_full);
+	g_mutex_unlock(queue->mutex);
+}
+
+static gboolean pipeline_queue_push(PipelineQueue *queue,
+	PipelineFrame *frame)
+{
+	g_mutex_lock(queue->mutex);
+	if(!queue->closed && (queue->items->length >= queue->depth)) {
+		queue->n_full ++;
+		while(!queue->closed && (queue->items->length >= queue->depth))
+			g_cond_wait(queue->not_full, queue->mutex);
+	}
+	if(queue->closed) {
+		g_mutex_unlock(queue->mutex);
+		return FALSE;
+	}
+	g_queue_push_tail(queue->items, frame);
+	queue->n_pushed ++;
+	queue->max_length = MAX(queue->max_length, queue->items->length);
+	g_cond_signal(queue->not_empty);
+	g_mutex_unlock(queue->mutex);
+	return TRUE;
+}
+
+/* NULL at once if the queue is empty */
+static PipelineFrame *pipeline_queue_poll(PipelineQueue *queue)
+{
+	PipelineFrame *frame;
+
+	g_mutex_lock(queue->mutex);
+	frame = g_queue_pop_head(queue->items);
+	if(frame)
+		g_cond_signal(queue->not_full);
+	else if(!queue->closed)
+		queue->n_empty ++;
+	g_mutex_unlock(queue->mutex);
+	return frame;
+}
+
+/* timeout_ms 0 waits until a frame arrives or the queue is closed */
+static PipelineFrame *pipeline_queue_pop(PipelineQueue *queue,
+	guint32 timeout_ms)
+{
+	PipelineFrame *frame;
+	GTimeVal until;
+
+	g_get_current_time(&until);
+	g_time_val_add(&until, timeout_ms * 1000);
+
+	g_mutex_lock(queue->mutex);
+	if(!queue->closed && (queue->items->length == 0)) {
+		queue->n_empty ++;
+		while(!queue->closed && (queue->items->length == 0)) {
+			if(timeout_ms == 0)
+				g_cond_wait(queue->not_empty, queue->mutex);
+			else if(!g_cond_timed_wait(queue->not_empty, queue->mutex,
+				&until))
+				break;
+		}
+	}
+	frame = g_queue_pop_head(queue->items);
+	if(frame)
+		g_cond_signal(queue->not_full);
+	g_mutex_unlock(queue->mutex);
+	return frame;
+}
+
+/* from the binarize thread after it queued a frame for the consumer */
+static void pipeline_notify(Pipeline *pipeline, GSourceFunc notify,
+	gpointer user_data)
+{
+	if(notify && g_atomic_int_compare_and_exchange(
+		&(pipeline->notify_pending), 0, 1))
+		g_idle_add(notify, user_data);
+}
+
+/*****************************************************************************/
+
+static gpointer pipeline_capture_thread(gpointer data)
+{
+	Pipeline *pipeline = data;
+	PipelineFrame *frame;
+	GdkPixbuf *pixbuf;
+	guint64 stamp;
+
+	while(g_atomic_int_get(&(pipeline->running))) {
+		pixbuf = v4l2_get_frame(pipeline->v4l2, &stamp);
+		if(pixbuf == NULL) {
+			g_usleep(10000);
+			continue;
+		}
+		frame = g_new0(PipelineFrame, 1);
+		frame->pixbuf = pixbuf;
+		frame->stamp = stamp;
+		if(!pipeline_queue_push(pipeline->captured, frame)) {
+			pipeline_frame_free(frame);
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* the mask is a copy, colors are still sampled from the raw frame;
+ * frames failing the quality check are passed on without one */
+static gpointer pipeline_binarize_thread(gpointer data)
+{
+	Pipeline *pipeline = data;
+	PipelineFrame *frame;
+	GdkRectangle graycode;
+	QualityParams quality;
+	GSourceFunc notify;
+	gpointer notify_data;
+	gfloat bg_tolerance;
+	guint32 bg_offset;
+
+	while((frame = pipeline_queue_pop(pipeline->captured, 0)) != NULL) {
+		g_mutex_lock(pipeline->mutex);
+		frame->rect = pipeline->rect;
+		graycode = pipeline->graycode;
+		bg_tolerance = pipeline->bg_tolerance;
+		bg_offset = pipeline->bg_offset;
+		quality = pipeline->quality;
+		notify = pipeline->notify;
+		notify_data = pipeline->notify_data;
+		g_mutex_unlock(pipeline->mutex);
+
+		if(quality_enabled(&quality))
+			frame->verdict = quality_check(&quality, frame->pixbuf,
+				&graycode, &(frame->rect));
+		if(frame->verdict != QUALITY_OK) {
+			if(!pipeline_queue_push(pipeline->binarized, frame)) {
+				pipeline_frame_free(frame);
+				break;
+			}
+			pipeline_notify(pipeline, notify, notify_data);
+			continue;
+		}
+
+		frame->mask = gdk_pixbuf_copy(frame->pixbuf);
+		if(!scan_binarize(frame->mask, &(frame->rect), bg_tolerance,
+			bg_offset)) {
+			gdk_pixbuf_unref(frame->mask);
+			frame->mask = NULL;
+		}
+		if(!pipeline_queue_push(pipeline->binarized, frame)) {
+			pipeline_frame_free(frame);
+			break;
+		}
+		pipeline_notify(pipeline, notify, notify_data);
+	}
+	return NULL;
+}
+
+/*****************************************************************************/
+
+Pipeline *pipeline_start(V4l2Data *v4l2, Model *model, guint32 depth)
+{
+	Pipeline *pipeline;
+	GError *error = NULL;
+
+	pipeline = g_new0(Pipeline, 1);
+	pipeline->v4l2 = v4l2;
+	pipeline->captured = pipeline_queue_new("capture -> binarize", depth);
+	pipeline->binarized = pipeline_queue_new("binarize -> model", depth);
+	pipeline->mutex = g_mutex_new();
+	pipeline_set_params(pipeline, model);
+
+	pipeline->running = 1;
+	pipeline->binarize_thread = g_thread_create(pipeline_binarize_thread,
+		pipeline, TRUE, &error);
+	if(pipeline->binarize_thread)
+		pipeline->capture_thread = g_thread_create(pipeline_capture_thread,
+			pipeline, TRUE, &error);
+	if(pipeline->capture_thread == NULL) {
+		g_warning("failed to start frame pipeline: %s", error->message);
+		g_error_free(error);
+		pipeline_stop(pipeline);
+		return NULL;
+	}
+	return pipeline;
+}
+
+/* frames still queued are dropped */
+void pipeline_stop(Pipeline *pipeline)
+{
+	g_atomic_int_set(&(pipeline->running), 0);
+	pipeline_queue_close(pipeline->captured);
+	pipeline_queue_close(pipeline->binarized);
+	if(pipeline->capture_thread)
+		g_thread_join(pipeline->capture_thread);
+	if(pipeline->binarize_thread)
+		g_thread_join(pipeline->binarize_thread);
+	if(pipeline->notify)
+		g_idle_remove_by_data(pipeline->notify_data);
+
+	pipeline_queue_free(pipeline->binarized);
+	pipeline_queue_free(pipeline->captured);
+	g_mutex_free(pipeline->mutex);
+	g_free(pipeline);
+}
+
+/* called by the consumer for every frame, region changes reach the
+ * binarize stage with the next frame it takes */
+void pipeline_set_params(Pipeline *pipeline, Model *model)
+{
+	Region *object, *graycode;
+
+	graycode = g_slist_nth_data(model->regions, REGION_GRAYCODE);
+	object = g_slist_nth_data(model->regions, REGION_OBJECT);
+	g_mutex_lock(pipeline->mutex);
+	pipeline->rect = object->rect;
+	pipeline->graycode = graycode->rect;
+	pipeline->bg_tolerance = model->bg_tolerance;
+	pipeline->bg_offset = model->bg_offset;
+	pipeline->quality = model->quality;
+	g_mutex_unlock(pipeline->mutex);
+}
+
+/* oldest frame through all stages, NULL if none arrived within
+ * timeout_ms; 0 only polls, for a consumer woken by pipeline_set_notify() */
+PipelineFrame *pipeline_next(Pipeline *pipeline, guint32 timeout_ms)
+{
+	if(timeout_ms == 0)
+		return pipeline_queue_poll(pipeline->binarized);
+	return pipeline_queue_pop(pipeline->binarized, timeout_ms);
+}
+
+/* notify runs in the main loop whenever frames are waiting, instead of
+ * the consumer blocking in pipeline_next(); it stays installed while it
+ * returns TRUE, and returns pipeline_notify_done() once pipeline_next()
+ * came back empty */
+void pipeline_set_notify(Pipeline *pipeline, GSourceFunc notify,
+	gpointer user_data)
+{
+	g_mutex_lock(pipeline->mutex);
+	pipeline->notify = notify;
+	pipeline->notify_data = user_data;
+	g_mutex_unlock(pipeline->mutex);
+	/* for frames queued before */
+	pipeline_notify(pipeline, notify, user_data);
+}
+
+/* TRUE if a frame arrived after the consumer found the queue empty, and
+ * no other notify was added for it */
+gboolean pipeline_notify_done(Pipeline *pipeline)
+{
+	PipelineQueue *queue = pipeline->binarized;
+	gboolean waiting;
+
+	g_atomic_int_set(&(pipeline->notify_pending), 0);
+	g_mutex_lock(queue->mutex);
+	waiting = (queue->items->length > 0);
+	g_mutex_unlock(queue->mutex);
+	return waiting && g_atomic_int_compare_and_exchange(
+		&(pipeline->notify_pending), 0, 1);
+}
+
+void pipeline_frame_free(PipelineFrame *frame)
+{
+	if(frame->mask)
+		gdk_pixbuf_unref(frame->mask);
+	gdk_pixbuf_unref(frame->pixbuf);
+	g_free(frame);
+}
+
+/* queue depths and stalls per stage, one indented line each; n_stale is
+ * only read right by the consumer */
+gchar *pipeline_stats(Pipeline *pipeline)
+{
+	PipelineQueue *queues[2], *queue;
+	GString *s;
+	gint32 i;
+
+	s = g_string_new("");
+	queues[0] = pipeline->captured;
+	queues[1] = pipeline->binarized;
+	for(i = 0; i < 2; i ++) {
+		queue = queues[i];
+		g_mutex_lock(queue->mutex);
+		g_string_append_printf(s, "  %s: %u/%u queued (max %u), "
+			"%u frames, %u producer stalls, %u consumer stalls\n",
+			queue->name, queue->items->length, queue->depth,
+			queue->max_length, queue->n_pushed, queue->n_full,
+			queue->n_empty);
+		g_mutex_unlock(queue->mutex);
+	}
+	g_string_append_printf(s, "  %u masks made for an old object region",
+		pipeline->n_stale);
+	return g_string_free(s, FALSE);
+}
+
+void pipeline_report(Pipeline *pipeline)
+{
+	gchar *s;
+
+	s = pipeline_stats(pipeline);
+	g_print("%s\n", s);
+	g_free(s);
+}
@@ -0,0 +1,86 @@
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "model.h"
+#include "region.h"
+#include "quality.h"
+#include "v4l2.h"
+
+/* frames a stage may run ahead of the next one */
+#define PIPELINE_MAX_DEPTH 16
+
+/* bounded FIFO between two stages; a full queue blocks the producer, so a
+ * slow stage throttles the camera instead of piling up frames */
+typedef struct {
+	const gchar *name;
+	GMutex *mutex;
+	GCond *not_empty;
+	GCond *not_full;
+	GQueue *items;
+	guint32 depth;
+	gboolean closed;
+
+	/* pushes and pops which had to wait, i.e. stalls of the producing
+	 * and the consuming stage */
+	guint32 n_pushed;
+	guint32 n_full;
+	guint32 n_empty;
+	guint32 max_length;
+} PipelineQueue;
+
+/* mask is a copy of pixbuf with rect of the object region binarized by
+ * scan_binarize(), NULL if the frame skipped that stage or failed the
+ * quality check */
+typedef struct {
+	GdkPixbuf *pixbuf;
+	GdkPixbuf *mask;
+	GdkRectangle rect;
+	guint64 stamp;
+	QualityVerdict verdict;
+} PipelineFrame;
+
+/* capture and convert on one thread, binarize on another, everything
+ * order dependent (angle decoding, model updates, GUI) stays with the
+ * consumer of pipeline_next(); every stage keeps the frame order */
+typedef struct {
+	V4l2Data *v4l2;
+	PipelineQueue *captured;
+	PipelineQueue *binarized;
+	GThread *capture_thread;
+	GThread *binarize_thread;
+	volatile gint running;
+
+	/* binarization parameters, copied from the model by the consumer */
+	GMutex *mutex;
+	GdkRectangle rect;
+	GdkRectangle graycode;
+	gfloat bg_tolerance;
+	guint32 bg_offset;
+	QualityParams quality;
+
+	/* frames whose mask was made for an object region which changed
+	 * before the model saw them */
+	guint32 n_stale;
+
+	/* added as idle when a frame is ready for pipeline_next(), at most
+	 * once until it calls pipeline_notify_done() */
+	GSourceFunc notify;
+	gpointer notify_data;
+	volatile gint notify_pending;
+} Pipeline;
+
+Pipeline *pipeline_start(V4l2Data *v4l2, Model *model, guint32 depth);
+void pipeline_stop(Pipeline *pipeline);
+void pipeline_set_params(Pipeline *pipeline, Model *model);
+PipelineFrame *pipeline_next(Pipeline *pipeline, guint32 timeout_ms);
+void pipeline_set_notify(Pipeline *pipeline, GSourceFunc notify,
+	gpointer user_data);
+gboolean pipeline_notify_done(Pipeline *pipeline);
+void pipeline_frame_free(PipelineFrame *frame);
+gchar *pipeline_stats(Pipeline *pipeline);
+void pipeline_report(Pipeline *pipeline);
+
+#endif
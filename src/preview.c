@@ -0,0 +1,223 @@
+#include <math.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "preview.h"
+#include "model.h"
+#include "region.h"
+#include "filter.h"
+
+Preview *preview_new(guint32 width, guint32 height)
+{
+	Preview *preview;
+
+	preview = g_new0(Preview, 1);
+	preview->width = width;
+	preview->height = height;
+	preview->rgb = g_new0(guint8, width * height * 3);
+	preview->zbuf = g_new0(gfloat, width * height);
+	preview->pitch = 0.3;
+	preview->invalid = TRUE;
+	return preview;
+}
+
+void preview_free(Preview *preview)
+{
+	g_free(preview->proj);
+	g_free(preview->verts);
+	g_free(preview->confidence);
+	g_free(preview->zbuf);
+	g_free(preview->rgb);
+	g_free(preview);
+}
+
+void preview_set_view(Preview *preview, gfloat yaw, gfloat pitch)
+{
+	preview->yaw = yaw;
+	preview->pitch = CLAMP(pitch, -G_PI / 2, G_PI / 2);
+	preview->invalid = TRUE;
+}
+
+/*****************************************************************************/
+
+static void preview_project_angle(Preview *preview, guint32 i)
+{
+	gfloat a, r, sh, s, x, y, z, x1, z1, *p;
+	gint32 j;
+
+	a = G_PI * 2.0 * i / (gfloat)preview->n_angles;
+	sh = (gfloat)preview->rect.height / preview->n_vert_y;
+	s = 0.9 * MIN(preview->width, preview->height) /
+		(gfloat)MAX(MAX(preview->rect.height, preview->rect.width), 1);
+
+	for(j = 0; j < preview->n_vert_y; j ++) {
+		r = preview->verts[i * preview->n_vert_y + j];
+		/* same object space as ac3d_write(), centered on the axis */
+		x = -r * cos(a);
+		y = preview->rect.height / 2.0 - sh * j - sh / 2;
+		z = r * sin(a);
+		/* orthographic view: yaw around y, then pitch around x */
+		x1 = x * cos(preview->yaw) + z * sin(preview->yaw);
+		z1 = -x * sin(preview->yaw) + z * cos(preview->yaw);
+		p = preview->proj + (i * preview->n_vert_y + j) * 3;
+		p[0] = preview->width / 2.0 + x1 * s;
+		p[1] = preview->height / 2.0 -
+			(y * cos(preview->pitch) - z1 * sin(preview->pitch)) * s;
+		p[2] = (y * sin(preview->pitch) + z1 * cos(preview->pitch)) * s;
+	}
+}
+
+static inline gfloat preview_edge(gfloat *a, gfloat *b, gfloat x, gfloat y)
+{
+	return (b[0] - a[0]) * (y - a[1]) - (b[1] - a[1]) * (x - a[0]);
+}
+
+static void preview_triangle(Preview *preview, gfloat *v0, gfloat *v1,
+	gfloat *v2, guint8 *col)
+{
+	gint32 x, y, minx, maxx, miny, maxy;
+	gfloat area, w0, w1, w2, z, nx, ny, nz, shade, px, py;
+	gfloat e1[3], e2[3];
+	guint8 *pix;
+
+	area = preview_edge(v0, v1, v2[0], v2[1]);
+	if(fabs(area) < 1e-6)
+		return;
+
+	/* two-sided lambert, light from the viewer */
+	e1[0] = v1[0] - v0[0]; e1[1] = v0[1] - v1[1]; e1[2] = v1[2] - v0[2];
+	e2[0] = v2[0] - v0[0]; e2[1] = v0[1] - v2[1]; e2[2] = v2[2] - v0[2];
+	nx = e1[1] * e2[2] - e1[2] * e2[1];
+	ny = e1[2] * e2[0] - e1[0] * e2[2];
+	nz = e1[0] * e2[1] - e1[1] * e2[0];
+	shade = 0.2 + 0.8 * fabs(nz) / sqrt(nx * nx + ny * ny + nz * nz);
+
+	minx = MAX(0, (gint32)floor(MIN(v0[0], MIN(v1[0], v2[0]))));
+	maxx = MIN((gint32)preview->width - 1,
+		(gint32)ceil(MAX(v0[0], MAX(v1[0], v2[0]))));
+	miny = MAX(0, (gint32)floor(MIN(v0[1], MIN(v1[1], v2[1]))));
+	maxy = MIN((gint32)preview->height - 1,
+		(gint32)ceil(MAX(v0[1], MAX(v1[1], v2[1]))));
+
+	for(y = miny; y <= maxy; y ++) {
+		py = y + 0.5;
+		for(x = minx; x <= maxx; x ++) {
+			px = x + 0.5;
+			w0 = preview_edge(v1, v2, px, py) / area;
+			w1 = preview_edge(v2, v0, px, py) / area;
+			w2 = preview_edge(v0, v1, px, py) / area;
+			if((w0 < 0) || (w1 < 0) || (w2 < 0))
+				continue;
+			z = w0 * v0[2] + w1 * v1[2] + w2 * v2[2];
+			if(z <= preview->zbuf[y * preview->width + x])
+				continue;
+			preview->zbuf[y * preview->width + x] = z;
+			pix = preview->rgb + (y * preview->width + x) * 3;
+			pix[0] = col[0] * shade;
+			pix[1] = col[1] * shade;
+			pix[2] = col[2] * shade;
+		}
+	}
+}
+
+gboolean preview_render(Preview *preview, Model *model)
+{
+	Region *region;
+	guint32 n_angles, i, i1;
+	gint32 j, k;
+	gboolean changed = FALSE, reset = FALSE;
+	guint8 *dirty, col[3], c0, c1;
+	gfloat *p0, *p1, *p2, *p3;
+
+	region = g_slist_nth_data(model->regions, REGION_OBJECT);
+	g_return_val_if_fail(region != NULL, FALSE);
+
+	n_angles = model->n_angles;
+	if((n_angles != preview->n_angles) ||
+		(model->n_vert_y != preview->n_vert_y) ||
+		(memcmp(&(region->rect), &(preview->rect),
+			sizeof(GdkRectangle)) != 0)) {
+		preview->n_angles = n_angles;
+		preview->n_vert_y = model->n_vert_y;
+		preview->rect = region->rect;
+		g_free(preview->proj);
+		g_free(preview->verts);
+		g_free(preview->confidence);
+		preview->proj = g_new0(gfloat, n_angles * model->n_vert_y * 3);
+		preview->verts = g_new0(gfloat, n_angles * model->n_vert_y);
+		preview->confidence = g_new0(guint8, n_angles * model->n_vert_y);
+		preview->invalid = TRUE;
+		reset = TRUE;
+	}
+
+	dirty = g_new0(guint8, n_angles);
+	for(i = 0; i < n_angles; i ++) {
+		if(model->angle_dirty[i]) {
+			model->angle_dirty[i] = 0;
+			dirty[i] = 1;
+			changed = TRUE;
+		}
+	}
+	if(!changed && !preview->invalid) {
+		g_free(dirty);
+		return FALSE;
+	}
+	if(reset)
+		memset(dirty, 1, n_angles);
+
+	/* a new scan may fill gaps up to the nearest kept angles in its rows,
+	 * the filter marks all angles it had to redo as dirty; unfiltered
+	 * angles only change with their own scans */
+	if(reset && model->filter)
+		filter_radii(model, preview->verts, preview->confidence);
+	else if(model->filter)
+		filter_radii_dirty(model, preview->verts, preview->confidence, dirty);
+	else
+		for(i = 0; i < n_angles; i ++)
+			for(j = 0; dirty[i] && (j < model->n_vert_y); j ++) {
+				k = i * model->n_vert_y + j;
+				preview->verts[k] = model_get_radius(model, i, j);
+				preview->confidence[k] =
+					model->angle_scans[i] ? FILTER_MEASURED : 0;
+			}
+	/* a new view moves all of them */
+	for(i = 0; i < n_angles; i ++)
+		if(dirty[i] || preview->invalid)
+			preview_project_angle(preview, i);
+	g_free(dirty);
+	preview->invalid = FALSE;
+
+	memset(preview->rgb, 0x30, preview->width * preview->height * 3);
+	for(k = 0; k < preview->width * preview->height; k ++)
+		preview->zbuf[k] = -G_MAXFLOAT;
+
+	if(preview->n_vert_y < 2)
+		return TRUE;
+
+	for(i = 0; i < n_angles; i ++) {
+		i1 = (i + 1) % n_angles;
+		for(j = 0; j < (preview->n_vert_y - 1); j ++) {
+			c0 = preview->confidence[i * preview->n_vert_y + j];
+			c1 = preview->confidence[i1 * preview->n_vert_y + j];
+			if((c0 == 0) || (c1 == 0))
+				continue;
+			model_get_color(model, i, j, col);
+			if((col[0] | col[1] | col[2]) == 0)
+				memset(col, 0xC8, 3);
+			/* interpolated surface in a cold tint */
+			if((c0 < FILTER_MEASURED) || (c1 < FILTER_MEASURED)) {
+				col[0] = col[0] / 2;
+				col[1] = col[1] / 2 + 0x20;
+				col[2] = col[2] / 2 + 0x60;
+			}
+			p0 = preview->proj + (i * preview->n_vert_y + j) * 3;
+			p1 = preview->proj + (i1 * preview->n_vert_y + j) * 3;
+			p2 = p1 + 3;
+			p3 = p0 + 3;
+			preview_triangle(preview, p0, p1, p2, col);
+			preview_triangle(preview, p0, p2, p3, col);
+		}
+	}
+	return TRUE;
+}
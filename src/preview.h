@@ -0,0 +1,34 @@
+#ifndef _PREVIEW_H
+#define _PREVIEW_H
+
+#include <glib.h>
+
+#include "region.h"
+#include "model.h"
+
+typedef struct {
+	guint32 width;
+	guint32 height;
+	guint8 *rgb;
+	gfloat *zbuf;
+
+	gfloat yaw;
+	gfloat pitch;
+
+	/* cached geometry, filtered and re-projected when the model changes;
+	 * see filter_radii() for verts and confidence */
+	guint32 n_angles;
+	guint32 n_vert_y;
+	GdkRectangle rect;
+	gboolean invalid;
+	gfloat *verts;
+	guint8 *confidence;
+	gfloat *proj;
+} Preview;
+
+Preview *preview_new(guint32 width, guint32 height);
+void preview_free(Preview *preview);
+void preview_set_view(Preview *preview, gfloat yaw, gfloat pitch);
+gboolean preview_render(Preview *preview, Model *model);
+
+#endif
@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+
+#include "publish.h"
+#include "region.h"
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC       0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+static inline guint64 publish_align(guint64 offset)
+{
+	return (offset + PUBLISH_ALIGN - 1) & ~(guint64)(PUBLISH_ALIGN - 1);
+}
+
+static inline guint64 publish_frame_offset(void)
+{
+	return publish_align(sizeof(PublishSlot));
+}
+
+static inline guint64 publish_mask_offset(PublishHeader *header)
+{
+	return publish_frame_offset() +
+		publish_align((guint64)header->width * header->height * 3);
+}
+
+/* anonymous memory with a file descriptor; other processes reach it
+ * through /proc/PID/fd/FD */
+static int publish_memfd(const gchar *name)
+{
+#ifdef __NR_memfd_create
+	return syscall(__NR_memfd_create, name,
+		MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static Publisher *publish_map(const gchar *path, int fd, gsize size,
+	gboolean writable)
+{
+	Publisher *pub;
+	void *map;
+
+	map = mmap(NULL, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+		MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED) {
+		g_warning("mmapping frame ring %s failed: %s (%d)", path,
+			strerror(errno), errno);
+		close(fd);
+		return NULL;
+	}
+
+	pub = g_new0(Publisher, 1);
+	pub->path = g_strdup(path);
+	pub->fd = fd;
+	pub->map = map;
+	pub->header = map;
+	pub->writable = writable;
+	return pub;
+}
+
+Publisher *publish_new(guint32 width, guint32 height, guint32 n_slots)
+{
+	PublishHeader header;
+	Publisher *pub;
+	gchar *path;
+	int fd;
+
+	g_return_val_if_fail((width > 0) && (height > 0), NULL);
+
+	memset(&header, 0, sizeof(PublishHeader));
+	memcpy(header.magic, PUBLISH_MAGIC, 8);
+	header.version = PUBLISH_VERSION;
+	header.header_size = sizeof(PublishHeader);
+	header.width = width;
+	header.height = height;
+	header.n_slots = CLAMP(n_slots, 2, PUBLISH_MAX_SLOTS);
+	header.slot_size = publish_mask_offset(&header) +
+		publish_align((guint64)width * height);
+	header.slots_offset = publish_align(sizeof(PublishHeader));
+	header.size = header.slots_offset +
+		(guint64)header.slot_size * header.n_slots;
+
+	fd = publish_memfd("3dscan-frames");
+	if(fd < 0) {
+		g_warning("failed to create frame ring: %s (%d)", strerror(errno),
+			errno);
+		return NULL;
+	}
+	/* zero filled, so every slot starts with an even seq */
+	if((ftruncate(fd, header.size) != 0) ||
+		(write(fd, &header, sizeof(PublishHeader)) !=
+			sizeof(PublishHeader))) {
+		g_warning("failed to write frame ring: %s (%d)", strerror(errno),
+			errno);
+		close(fd);
+		return NULL;
+	}
+#ifdef F_ADD_SEALS
+	/* readers may trust the size they mapped */
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+#endif
+
+	path = g_strdup_printf("/proc/%d/fd/%d", getpid(), fd);
+	pub = publish_map(path, fd, header.size, TRUE);
+	if(pub)
+		g_message("publishing %dx%d frames in %d slots at %s", width, height,
+			header.n_slots, path);
+	g_free(path);
+	return pub;
+}
+
+Publisher *publish_attach(const gchar *path)
+{
+	PublishHeader header;
+	struct stat st;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if(fd < 0) {
+		g_warning("failed to open frame ring %s: %s (%d)", path,
+			strerror(errno), errno);
+		return NULL;
+	}
+
+	if((fstat(fd, &st) != 0) || (st.st_size < sizeof(PublishHeader)) ||
+		(read(fd, &header, sizeof(PublishHeader)) !=
+			sizeof(PublishHeader))) {
+		g_warning("frame ring %s: short file", path);
+		close(fd);
+		return NULL;
+	}
+	if((memcmp(header.magic, PUBLISH_MAGIC, 8) != 0) ||
+		(header.version != PUBLISH_VERSION) ||
+		(header.header_size != sizeof(PublishHeader))) {
+		g_warning("frame ring %s: unsupported format", path);
+		close(fd);
+		return NULL;
+	}
+	if((header.n_slots == 0) || (header.n_slots > PUBLISH_MAX_SLOTS) ||
+		(header.size != st.st_size) ||
+		(header.slot_size < (publish_mask_offset(&header) +
+			(guint64)header.width * header.height))) {
+		g_warning("frame ring %s: corrupt header", path);
+		close(fd);
+		return NULL;
+	}
+
+	return publish_map(path, fd, header.size, FALSE);
+}
+
+void publish_free(Publisher *pub)
+{
+	munmap(pub->map, pub->header->size);
+	close(pub->fd);
+	g_free(pub->path);
+	g_free(pub);
+}
+
+/*****************************************************************************/
+
+static inline PublishSlot *publish_slot(Publisher *pub, guint32 i)
+{
+	return (PublishSlot *)(pub->map + pub->header->slots_offset +
+		(guint64)i * pub->header->slot_size);
+}
+
+guint8 *publish_slot_frame(Publisher *pub, PublishSlot *slot)
+{
+	return (guint8 *)slot + publish_frame_offset();
+}
+
+guint8 *publish_slot_mask(Publisher *pub, PublishSlot *slot)
+{
+	return (guint8 *)slot + publish_mask_offset(pub->header);
+}
+
+/* takes the next slot and copies the raw frame, before scan_frame()
+ * binarizes the object region in place */
+void publish_begin(Publisher *pub, GdkPixbuf *pixbuf)
+{
+	PublishSlot *slot;
+	guint8 *src, *dst;
+	guint32 x, y, nc, rs;
+
+	g_return_if_fail(pub->writable);
+
+	if((gdk_pixbuf_get_width(pixbuf) != pub->header->width) ||
+		(gdk_pixbuf_get_height(pixbuf) != pub->header->height))
+		return;
+
+	if(pub->current == NULL) {
+		slot = publish_slot(pub, pub->n_frames % pub->header->n_slots);
+		g_atomic_int_inc(&(slot->seq));
+		pub->current = slot;
+	}
+	slot = pub->current;
+
+	nc = gdk_pixbuf_get_n_channels(pixbuf);
+	rs = gdk_pixbuf_get_rowstride(pixbuf);
+	dst = publish_slot_frame(pub, slot);
+	for(y = 0; y < pub->header->height; y ++) {
+		src = gdk_pixbuf_get_pixels(pixbuf) + y * rs;
+		if(nc == 3) {
+			memcpy(dst, src, pub->header->width * 3);
+			dst += pub->header->width * 3;
+			continue;
+		}
+		for(x = 0; x < pub->header->width; x ++, src += nc, dst += 3)
+			memcpy(dst, src, 3);
+	}
+	memset(slot->rect, 0, sizeof(slot->rect));
+}
+
+/* the binarized object region, once scan_frame() is done with it */
+void publish_set_mask(Publisher *pub, GdkPixbuf *pixbuf, GdkRectangle *rect)
+{
+	GdkRectangle frame, area;
+	guint8 *src, *dst;
+	gint32 x, y, nc, rs;
+
+	if(pub->current == NULL)
+		return;
+
+	frame.x = frame.y = 0;
+	frame.width = pub->header->width;
+	frame.height = pub->header->height;
+	if(!gdk_rectangle_intersect(rect, &frame, &area))
+		return;
+
+	nc = gdk_pixbuf_get_n_channels(pixbuf);
+	rs = gdk_pixbuf_get_rowstride(pixbuf);
+	dst = publish_slot_mask(pub, pub->current);
+	for(y = 0; y < area.height; y ++) {
+		src = gdk_pixbuf_get_pixels(pixbuf) + (area.y + y) * rs +
+			area.x * nc;
+		for(x = 0; x < area.width; x ++, src += nc)
+			*dst ++ = src[0];
+	}
+	pub->current->rect[0] = area.x;
+	pub->current->rect[1] = area.y;
+	pub->current->rect[2] = area.width;
+	pub->current->rect[3] = area.height;
+}
+
+/* angle < 0: no valid angle for the frame */
+void publish_commit(Publisher *pub, guint64 stamp, gint32 angle,
+	guint32 gray, guint32 n_angles)
+{
+	PublishSlot *slot = pub->current;
+	PublishHeader *header = pub->header;
+
+	if(slot == NULL)
+		return;
+
+	slot->frame = pub->n_frames;
+	slot->stamp = stamp;
+	slot->angle = angle;
+	slot->gray = gray;
+	slot->n_angles = n_angles;
+	g_atomic_int_inc(&(slot->seq));
+
+	g_atomic_int_inc(&(header->seq));
+	header->latest = pub->n_frames % header->n_slots;
+	header->n_published ++;
+	g_atomic_int_inc(&(header->seq));
+
+	pub->current = NULL;
+	pub->n_frames ++;
+}
+
+/*****************************************************************************/
+
+/* most recent complete slot, read in place; FALSE until the first frame,
+ * or if the writer held the header or the slot for PUBLISH_MAX_RETRIES
+ * reads (e.g. it died while writing). The slot may be overwritten while it
+ * is used, publish_check() with the returned seq tells whether what was
+ * read is consistent */
+gboolean publish_latest(Publisher *pub, PublishSlot **slot, gint *seq)
+{
+	PublishHeader *header = pub->header;
+	guint32 latest, i;
+	gint hs;
+
+	*slot = NULL;
+	for(i = 0; i < PUBLISH_MAX_RETRIES; i ++) {
+		hs = g_atomic_int_get(&(header->seq));
+		if(hs & 1)
+			continue;
+		if(header->n_published == 0)
+			return FALSE;
+		latest = header->latest;
+		if(g_atomic_int_get(&(header->seq)) != hs)
+			continue;
+
+		*slot = publish_slot(pub, latest % header->n_slots);
+		*seq = g_atomic_int_get(&((*slot)->seq));
+		if(!(*seq & 1))
+			return TRUE;
+	}
+	*slot = NULL;
+	return FALSE;
+}
+
+gboolean publish_check(PublishSlot *slot, gint seq)
+{
+	return (g_atomic_int_get(&(slot->seq)) == seq);
+}
@@ -0,0 +1,74 @@
+#ifndef _PUBLISH_H
+#define _PUBLISH_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "region.h"
+
+#define PUBLISH_MAGIC     "3DSCANPB"
+#define PUBLISH_VERSION   1
+#define PUBLISH_ALIGN     64
+#define PUBLISH_MAX_SLOTS 64
+/* reads of the header publish_latest() tries while the writer holds it */
+#define PUBLISH_MAX_RETRIES 1000
+
+/* header of the shared ring, in host byte order at offset 0; seq is odd
+ * while latest and n_published change */
+typedef struct {
+	gchar magic[8];
+	guint32 version;
+	guint32 header_size;
+	guint32 width;
+	guint32 height;
+	guint32 n_slots;
+	guint32 slot_size;
+	guint64 slots_offset;
+	guint64 size;
+
+	volatile gint seq;
+	guint32 latest;
+	guint64 n_published;
+} PublishHeader;
+
+/* one frame of the ring: the raw RGB frame (width * height * 3, rows
+ * packed) and the binarized object region (rect[2] * rect[3] bytes, 0x00
+ * is object) follow at PUBLISH_ALIGN-aligned offsets; seq is odd while
+ * the slot is written, a reader has a consistent slot if seq was even and
+ * did not change while it looked; rect is all 0 for a frame without a mask,
+ * e.g. one failing the quality check */
+typedef struct {
+	volatile gint seq;
+	guint32 frame;
+	guint64 stamp;
+	gint32 angle;
+	guint32 gray;
+	guint32 n_angles;
+	gint32 rect[4];
+} PublishSlot;
+
+typedef struct {
+	gchar *path;
+	int fd;
+	guint8 *map;
+	PublishHeader *header;
+	gboolean writable;
+	PublishSlot *current;
+	guint32 n_frames;
+} Publisher;
+
+Publisher *publish_new(guint32 width, guint32 height, guint32 n_slots);
+Publisher *publish_attach(const gchar *path);
+void publish_free(Publisher *pub);
+
+void publish_begin(Publisher *pub, GdkPixbuf *pixbuf);
+void publish_set_mask(Publisher *pub, GdkPixbuf *pixbuf, GdkRectangle *rect);
+void publish_commit(Publisher *pub, guint64 stamp, gint32 angle,
+	guint32 gray, guint32 n_angles);
+
+gboolean publish_latest(Publisher *pub, PublishSlot **slot, gint *seq);
+gboolean publish_check(PublishSlot *slot, gint seq);
+guint8 *publish_slot_frame(Publisher *pub, PublishSlot *slot);
+guint8 *publish_slot_mask(Publisher *pub, PublishSlot *slot);
+
+#endif
@@ -0,0 +1,116 @@
+#include <string.h>
+
+#include <glib.h>
+
+#include "quality.h"
+
+static const gchar *quality_names[] = {
+	"ok",
+	"blurred",
+	"too dark",
+	"too bright"
+};
+
+typedef struct {
+	/* summed sharpness of the scanlines with enough contrast */
+	guint32 sharpness;
+	guint32 n_sharp;
+
+	guint32 sum;
+	guint32 n_saturated;
+	guint32 n_pixels;
+} QualityLines;
+
+/* one scanline of rect, gray values from integer weights */
+static void quality_line(GdkPixbuf *pixbuf, GdkRectangle *rect, guint32 y,
+	QualityLines *lines)
+{
+	guint8 *pix;
+	guint32 nc, x, g, g0, g1, min = 255, max = 0, step = 0;
+
+	nc = gdk_pixbuf_get_n_channels(pixbuf);
+	pix = gdk_pixbuf_get_pixels(pixbuf) +
+		y * gdk_pixbuf_get_rowstride(pixbuf) + rect->x * nc;
+
+	g0 = g1 = 0;
+	for(x = 0; x < rect->width; x ++, pix += nc) {
+		g = (pix[0] * 77 + pix[1] * 150 + pix[2] * 29) >> 8;
+		min = MIN(min, g);
+		max = MAX(max, g);
+		lines->sum += g;
+		if(g >= 250)
+			lines->n_saturated ++;
+		if(x >= 2)
+			step = MAX(step, (g > g0) ? (g - g0) : (g0 - g));
+		g0 = g1;
+		g1 = g;
+	}
+	lines->n_pixels += rect->width;
+
+	if((max - min) >= QUALITY_MIN_CONTRAST) {
+		lines->sharpness += MIN(step * 100 / (max - min), 100);
+		lines->n_sharp ++;
+	}
+}
+
+static void quality_region(GdkPixbuf *pixbuf, GdkRectangle *region,
+	QualityLines *lines)
+{
+	GdkRectangle rect, frame;
+	guint32 i;
+
+	frame.x = frame.y = 0;
+	frame.width = gdk_pixbuf_get_width(pixbuf);
+	frame.height = gdk_pixbuf_get_height(pixbuf);
+	if(!gdk_rectangle_intersect(region, &frame, &rect) || (rect.width < 3))
+		return;
+
+	for(i = 0; i < QUALITY_LINES; i ++)
+		quality_line(pixbuf, &rect,
+			rect.y + (2 * i + 1) * rect.height / (2 * QUALITY_LINES), lines);
+}
+
+gboolean quality_enabled(QualityParams *params)
+{
+	return (params->min_sharpness > 0) || (params->min_brightness > 0) ||
+		(params->max_saturated > 0);
+}
+
+/* a few scanlines of the gray code strip and the object region; the
+ * exposure comes from the object lines only, as the strip is black and
+ * white anyway, and a region without any edge is never called blurred */
+QualityVerdict quality_check(QualityParams *params, GdkPixbuf *pixbuf,
+	GdkRectangle *graycode, GdkRectangle *object)
+{
+	QualityLines strip, lines;
+
+	memset(&strip, 0, sizeof(QualityLines));
+	memset(&lines, 0, sizeof(QualityLines));
+	if(params->min_sharpness > 0)
+		quality_region(pixbuf, graycode, &strip);
+	quality_region(pixbuf, object, &lines);
+
+	if(lines.n_pixels > 0) {
+		if(params->min_brightness &&
+			(lines.sum / lines.n_pixels < params->min_brightness))
+			return QUALITY_DARK;
+		if(params->max_saturated &&
+			(lines.n_saturated * 100 / lines.n_pixels > params->max_saturated))
+			return QUALITY_BRIGHT;
+	}
+	if(params->min_sharpness > 0) {
+		if(strip.n_sharp &&
+			(strip.sharpness / strip.n_sharp < params->min_sharpness))
+			return QUALITY_BLURRED;
+		if(lines.n_sharp &&
+			(lines.sharpness / lines.n_sharp < params->min_sharpness))
+			return QUALITY_BLURRED;
+	}
+	return QUALITY_OK;
+}
+
+const gchar *quality_name(QualityVerdict verdict)
+{
+	g_return_val_if_fail(verdict < NUM_QUALITY_VERDICTS, NULL);
+	return quality_names[verdict];
+}
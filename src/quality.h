@@ -0,0 +1,39 @@
+#ifndef _QUALITY_H
+#define _QUALITY_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "region.h"
+
+/* scanlines sampled in each region */
+#define QUALITY_LINES 4
+/* smallest gray value range of a scanline which tells anything about the
+ * sharpness of its edges */
+#define QUALITY_MIN_CONTRAST 48
+
+typedef enum {
+	QUALITY_OK,
+	/* edges of the gray code strip or the silhouette are smeared */
+	QUALITY_BLURRED,
+	/* the object scanlines are too dark or clipped white */
+	QUALITY_DARK,
+	QUALITY_BRIGHT,
+	NUM_QUALITY_VERDICTS
+} QualityVerdict;
+
+/* 0 turns a check off; sharpness is the steepest gray value step across
+ * two pixels in percent of the scanline contrast (100: a hard edge, 50:
+ * an edge smeared over about four pixels) */
+typedef struct {
+	guint32 min_sharpness;
+	guint32 min_brightness;
+	guint32 max_saturated;
+} QualityParams;
+
+QualityVerdict quality_check(QualityParams *params, GdkPixbuf *pixbuf,
+	GdkRectangle *graycode, GdkRectangle *object);
+gboolean quality_enabled(QualityParams *params);
+const gchar *quality_name(QualityVerdict verdict);
+
+#endif
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "model.h"
+#include "region.h"
+#include "obslog.h"
+#include "filter.h"
+
+/* rebuilds a model from an observation log (see obslog.h), with other
+ * choices than the live scan made: which observations count and how the
+ * edges of a profile point are reduced to one radius */
+
+typedef struct {
+	guint32 cell;
+	gint16 edge;
+} ReplayEdge;
+
+typedef struct {
+	Model *model;
+	GArray *edges;
+	guint8 *colors;
+	guint8 *has_color;
+	guint32 *last_seq;
+	guint32 *n_frames;
+
+	guint32 n_blocks;
+	guint32 n_records;
+	guint32 n_used;
+} Replay;
+
+static gchar *opt_output = "replay.ac";
+static gchar *opt_reduce = "min";
+static gint opt_min_confidence = 0;
+static gint opt_max_scans = 0;
+static gint opt_filter_window = MODEL_FILTER_WINDOW;
+
+static GOptionEntry replay_options[] = {
+	{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output,
+		"model file to write", "FILE" },
+	{ "reduce", 'r', 0, G_OPTION_ARG_STRING, &opt_reduce,
+		"radius of a profile point from its edges: min (as scanned) or "
+		"median", "NAME" },
+	{ "min-confidence", 'c', 0, G_OPTION_ARG_INT, &opt_min_confidence,
+		"ignore edges with a smaller gray value step", "N" },
+	{ "max-scans", 's', 0, G_OPTION_ARG_INT, &opt_max_scans,
+		"use only the first N frames of each angle (0: all)", "N" },
+	{ "filter-window", 'w', 0, G_OPTION_ARG_INT, &opt_filter_window,
+		"outlier median window in angles on each side (0: only fill gaps)",
+		"N" },
+	{ NULL }
+};
+
+static int replay_compare(const void *a, const void *b)
+{
+	const ReplayEdge *ea = a, *eb = b;
+
+	if(ea->cell != eb->cell)
+		return (ea->cell < eb->cell) ? -1 : 1;
+	return ea->edge - eb->edge;
+}
+
+/* moves the collected edges into the model; runs before the object region
+ * changes, so the model remaps them like a live scan would */
+static void replay_reduce(Replay *replay, gboolean median)
+{
+	Model *model = replay->model;
+	ReplayEdge *edges = (ReplayEdge *)replay->edges->data;
+	guint32 n = replay->edges->len, i, j, cell;
+
+	qsort(edges, n, sizeof(ReplayEdge), replay_compare);
+	for(i = 0; i < n; i = j) {
+		cell = edges[i].cell;
+		for(j = i; (j < n) && (edges[j].cell == cell); j ++);
+		model_set_radius(model, cell / model->n_vert_y,
+			cell % model->n_vert_y,
+			median ? edges[i + (j - i) / 2].edge : edges[i].edge);
+	}
+	g_array_set_size(replay->edges, 0);
+
+	for(cell = 0; cell < model->n_angles * model->n_vert_y; cell ++) {
+		if(!replay->has_color[cell])
+			continue;
+		replay->has_color[cell] = 0;
+		model_set_color(model, cell / model->n_vert_y,
+			cell % model->n_vert_y, replay->colors + cell * 3);
+	}
+}
+
+static void replay_block(Replay *replay, ObsLogBlock *block,
+	gboolean median)
+{
+	Model *model = replay->model;
+	Region *region;
+	ReplayEdge e;
+	GdkRectangle rect;
+	guint32 i, a, cell;
+
+	rect.x = block->rect[0];
+	rect.y = block->rect[1];
+	rect.width = block->rect[2];
+	rect.height = block->rect[3];
+	region = g_slist_nth_data(model->regions, REGION_OBJECT);
+	if(memcmp(&rect, &(region->rect), sizeof(GdkRectangle)) != 0) {
+		replay_reduce(replay, median);
+		model_set_region(model, REGION_OBJECT, &rect);
+	}
+
+	for(i = 0; i < block->n_records; i ++) {
+		a = block->angle[i];
+		if((a >= model->n_angles) || (block->row[i] >= model->n_vert_y))
+			continue;
+		cell = a * model->n_vert_y + block->row[i];
+		/* the colors the live scan sampled, a later set (after the model
+		 * was cleared) replaces the earlier one as it did live */
+		if(block->side[i] == OBSLOG_COLOR) {
+			replay->colors[cell * 3] = block->red[i];
+			replay->colors[cell * 3 + 1] = block->green[i];
+			replay->colors[cell * 3 + 2] = block->blue[i];
+			replay->has_color[cell] = 1;
+			continue;
+		}
+		/* negative radii count as in scan_angle_log(), 0 is no edge */
+		if(block->edge[i] == 0)
+			continue;
+		/* a frame counts once per profile, even with both edges on it */
+		if(block->seq[i] != replay->last_seq[a]) {
+			if((opt_max_scans > 0) && (replay->n_frames[a] >= opt_max_scans))
+				continue;
+			replay->last_seq[a] = block->seq[i];
+			replay->n_frames[a] ++;
+			model->angle_scans[a] = MIN(replay->n_frames[a], 255);
+		}
+		if(block->confidence[i] < opt_min_confidence)
+			continue;
+
+		e.cell = cell;
+		e.edge = block->edge[i];
+		g_array_append_val(replay->edges, e);
+		replay->n_used ++;
+	}
+	replay->n_records += block->n_records;
+	replay->n_blocks ++;
+}
+
+int main(int argc, char *argv[])
+{
+	Replay replay;
+	ObsLogHeader header;
+	ObsLogBlock *block;
+	GOptionContext *context;
+	GError *error = NULL;
+	FILE *f;
+	guint32 n_cells, i, n_angles = 0;
+	gboolean median, retval;
+
+	context = g_option_context_new("LOG");
+	g_option_context_add_main_entries(context, replay_options, NULL);
+	if(!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(context);
+
+	if(argc != 2) {
+		g_printerr("usage: %s [OPTION...] LOG\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if(strcmp(opt_reduce, "min") == 0)
+		median = FALSE;
+	else if(strcmp(opt_reduce, "median") == 0)
+		median = TRUE;
+	else {
+		g_printerr("unknown reduction: %s\n", opt_reduce);
+		return EXIT_FAILURE;
+	}
+
+	g_type_init();
+
+	f = obslog_open(argv[1], &header);
+	if(f == NULL)
+		return EXIT_FAILURE;
+
+	memset(&replay, 0, sizeof(Replay));
+	replay.model = model_new(header.n_bits, header.sub_bits,
+		header.n_vert_y);
+	replay.model->filter_window = CLAMP(opt_filter_window, 0,
+		FILTER_MAX_WINDOW);
+	n_cells = replay.model->n_angles * replay.model->n_vert_y;
+	replay.edges = g_array_new(FALSE, FALSE, sizeof(ReplayEdge));
+	replay.colors = g_new0(guint8, n_cells * 3);
+	replay.has_color = g_new0(guint8, n_cells);
+	replay.last_seq = g_new(guint32, replay.model->n_angles);
+	memset(replay.last_seq, 0xFF, replay.model->n_angles * sizeof(guint32));
+	replay.n_frames = g_new0(guint32, replay.model->n_angles);
+
+	block = g_new(ObsLogBlock, 1);
+	while(obslog_read(f, block))
+		replay_block(&replay, block, median);
+	replay_reduce(&replay, median);
+	g_free(block);
+	fclose(f);
+
+	for(i = 0; i < replay.model->n_angles; i ++)
+		if(replay.n_frames[i] > 0)
+			n_angles ++;
+	printf("%u blocks, %u records, %u used, %u/%u angles seen\n",
+		replay.n_blocks, replay.n_records, replay.n_used, n_angles,
+		replay.model->n_angles);
+
+	retval = model_save(replay.model, opt_output, NULL, NULL);
+
+	g_free(replay.n_frames);
+	g_free(replay.last_seq);
+	g_free(replay.has_color);
+	g_free(replay.colors);
+	g_array_free(replay.edges, TRUE);
+	model_cleanup(replay.model);
+
+	return retval ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,480 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "model.h"
+#include "session.h"
+#include "region.h"
+#include "scan.h"
+#include "gray.h"
+#include "v4l2.h"
+#include "angle.h"
+#include "filter.h"
+
+/* rebuilds a model from a raw YUYV frame stream, as recorded with [v4l2]
+ * record (see v4l2_init_section()) and read by the harness, with the
+ * regions of a reference session (the session of the recorded scan) and
+ * other rows, scan heuristics or the visual hull; frames are split into
+ * one block per thread, each scanned into its own model, and the models
+ * merged in frame order with model_merge().
+ *
+ * angles depend on the frames before, so the gray code is read first (in
+ * parallel, converting only the rows of the strip unless the [quality]
+ * gate needs the object region too), then the angles are
+ * tracked and the scans per angle counted in frame order, and only then
+ * the blocks are scanned; that way every block scans exactly the frames
+ * and edges a single pass would have scanned */
+
+typedef struct {
+	guint32 gv;
+	gint32 angle;
+	guint8 valid_dir;
+	/* failed the quality gate, neither decoded nor scanned */
+	guint8 rejected;
+	/* scan the silhouette, and the right edge as the opposite angle */
+	guint8 scan;
+	guint8 right;
+} ReprocessFrame;
+
+typedef struct {
+	const gchar *filename;
+	guint32 width;
+	guint32 height;
+	gsize frame_size;
+	guint32 n_frames;
+	ReprocessFrame *frames;
+
+	guint32 n_bits;
+	guint32 sub_bits;
+	guint32 n_vert_y;
+	GrayCodeType code;
+	GSList *regions;
+} Reprocess;
+
+typedef struct {
+	Reprocess *rp;
+	guint32 first;
+	guint32 last;
+	Model *model;
+	guint32 n_scanned;
+	gboolean failed;
+} ReprocessJob;
+
+static gchar *opt_size = "640x480";
+static gchar *opt_reference = NULL;
+static gchar *opt_output = "reprocess.ac";
+static gchar *opt_code = "reflected";
+static gint opt_threads = 0;
+static gint opt_rows = -1;
+static gint opt_fps = 30;
+static gint opt_tolerance = MODEL_BG_TOLERANCE;
+static gint opt_offset = MODEL_BG_OFFSET;
+static gint opt_max_scans = MODEL_MAX_SCANS;
+static gint opt_dual_edge = MODEL_DUAL_EDGE;
+static gint opt_hull_depth = MODEL_HULL_DEPTH;
+static gint opt_filter_window = MODEL_FILTER_WINDOW;
+static gint opt_min_sharpness = MODEL_MIN_SHARPNESS;
+static gint opt_min_brightness = MODEL_MIN_BRIGHTNESS;
+static gint opt_max_saturated = MODEL_MAX_SATURATED;
+
+static GOptionEntry reprocess_options[] = {
+	{ "size", 's', 0, G_OPTION_ARG_STRING, &opt_size,
+		"frame size of the recording", "WxH" },
+	{ "reference", 'r', 0, G_OPTION_ARG_FILENAME, &opt_reference,
+		"session holding the regions and angle grid of the recording",
+		"SESSION" },
+	{ "output", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output,
+		"model file to write", "FILE" },
+	{ "code", 0, 0, G_OPTION_ARG_STRING, &opt_code,
+		"angle code on the ring: reflected or debruijn", "NAME" },
+	{ "threads", 'j', 0, G_OPTION_ARG_INT, &opt_threads,
+		"worker threads (0: one per cpu)", "N" },
+	{ "rows", 'y', 0, G_OPTION_ARG_INT, &opt_rows,
+		"profile rows (0: one per pixel row, default: as the reference)",
+		"N" },
+	{ "fps", 0, 0, G_OPTION_ARG_INT, &opt_fps,
+		"frame rate assumed for angle interpolation", "N" },
+	{ "tolerance", 0, 0, G_OPTION_ARG_INT, &opt_tolerance,
+		"background color ratio tolerance, in percent", "N" },
+	{ "offset", 0, 0, G_OPTION_ARG_INT, &opt_offset,
+		"background gray value offset", "N" },
+	{ "max-scans", 0, 0, G_OPTION_ARG_INT, &opt_max_scans,
+		"scans per angle", "N" },
+	{ "dual-edge", 0, 0, G_OPTION_ARG_INT, &opt_dual_edge,
+		"use the right silhouette edge as well (0 or 1)", "N" },
+	{ "hull-depth", 0, 0, G_OPTION_ARG_INT, &opt_hull_depth,
+		"octree depth of the visual hull (0: radius profiles)", "N" },
+	{ "filter-window", 'w', 0, G_OPTION_ARG_INT, &opt_filter_window,
+		"outlier median window in angles on each side (0: only fill gaps)",
+		"N" },
+	{ "min-sharpness", 0, 0, G_OPTION_ARG_INT, &opt_min_sharpness,
+		"drop frames with softer edges, in percent (0: off)", "N" },
+	{ "min-brightness", 0, 0, G_OPTION_ARG_INT, &opt_min_brightness,
+		"drop frames with a darker object region (0: off)", "N" },
+	{ "max-saturated", 0, 0, G_OPTION_ARG_INT, &opt_max_saturated,
+		"drop frames with more clipped object pixels, in percent (0: off)",
+		"N" },
+	{ NULL }
+};
+
+static Model *reprocess_model(Reprocess *rp)
+{
+	Model *model;
+	Region *region;
+	GSList *item, *other;
+
+	model = model_new(rp->n_bits, rp->sub_bits, rp->n_vert_y);
+	model_set_code(model, rp->code);
+	for(item = rp->regions, other = model->regions;
+		item && other; item = item->next, other = other->next) {
+		region = other->data;
+		region->rect = ((Region *)item->data)->rect;
+	}
+	model->bg_tolerance = opt_tolerance / 100.0;
+	model->bg_offset = opt_offset;
+	model->max_scans = CLAMP(opt_max_scans, 1, 255);
+	model->dual_edge = opt_dual_edge ? TRUE : FALSE;
+	model->hull_depth = CLAMP(opt_hull_depth, 0, 8);
+	model->filter_window = CLAMP(opt_filter_window, 0, FILTER_MAX_WINDOW);
+	model->quality.min_sharpness = CLAMP(opt_min_sharpness, 0, 100);
+	model->quality.min_brightness = CLAMP(opt_min_brightness, 0, 255);
+	model->quality.max_saturated = CLAMP(opt_max_saturated, 0, 100);
+	return model;
+}
+
+static FILE *reprocess_open(Reprocess *rp, guint32 first)
+{
+	FILE *f;
+
+	f = fopen(rp->filename, "rb");
+	if(f == NULL) {
+		g_warning("failed to open %s", rp->filename);
+		return NULL;
+	}
+	if(fseek(f, (long)first * rp->frame_size, SEEK_SET) != 0) {
+		g_warning("failed to seek to frame %u of %s", first, rp->filename);
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+/* without the quality gate the gray code strip is converted alone, the
+ * decode model sees it at the top of a frame which is only as high as the
+ * strip (plus a row above and below for scan_black_5()) */
+static void reprocess_decode_job(gpointer data, gpointer user_data)
+{
+	ReprocessJob *job = data;
+	Reprocess *rp = job->rp;
+	ReprocessFrame *frame;
+	GdkPixbuf *pixbuf;
+	Region *region;
+	guint8 *buffer;
+	guint32 i, y0, y1;
+	FILE *f;
+
+	region = g_slist_nth_data(job->model->regions, REGION_GRAYCODE);
+	y0 = MIN(MAX(region->rect.y, 1) - 1, rp->height - 1);
+	y1 = CLAMP(region->rect.y + region->rect.height + 1, y0 + 1, rp->height);
+	if(quality_enabled(&(job->model->quality))) {
+		y0 = 0;
+		y1 = rp->height;
+	}
+	region->rect.y -= y0;
+
+	f = reprocess_open(rp, job->first);
+	if(f == NULL) {
+		job->failed = TRUE;
+		return;
+	}
+	buffer = g_new(guint8, rp->frame_size);
+	for(i = job->first; i < job->last; i ++) {
+		if(fread(buffer, rp->frame_size, 1, f) != 1) {
+			g_warning("%s: short read at frame %u", rp->filename, i);
+			job->failed = TRUE;
+			break;
+		}
+		pixbuf = v4l2_convert_yuyv(buffer + y0 * rp->width * 2, rp->width,
+			y1 - y0);
+		frame = rp->frames + i;
+		frame->rejected =
+			(scan_check_frame(job->model, pixbuf) != QUALITY_OK);
+		if(!frame->rejected)
+			scan_update_bits(job->model, pixbuf);
+		frame->valid_dir = !frame->rejected && job->model->valid_dir;
+		frame->gv = frame->valid_dir ?
+			gray_code_decode(job->model->code, job->model->bits) : 0;
+		gdk_pixbuf_unref(pixbuf);
+	}
+	g_free(buffer);
+	fclose(f);
+}
+
+/* in frame order: the angle of every frame and whether scan_frame() would
+ * have scanned it, from the scan counts alone */
+static void reprocess_plan(Reprocess *rp, Model *model)
+{
+	AngleTracker *tracker;
+	ReprocessFrame *frame;
+	guint8 *scans;
+	guint32 i, angle, opposite;
+	guint64 stamp;
+
+	tracker = angle_tracker_new(rp->n_bits, rp->sub_bits);
+	scans = g_new0(guint8, model->n_angles);
+	for(i = 0; i < rp->n_frames; i ++) {
+		frame = rp->frames + i;
+		/* no capture times in a raw stream, assume a steady frame rate */
+		stamp = (guint64)i * G_USEC_PER_SEC / MAX(opt_fps, 1);
+		frame->angle = -1;
+		if(!angle_tracker_update(tracker, stamp, frame->valid_dir,
+			frame->gv, &angle))
+			continue;
+		frame->angle = angle;
+		if(scans[angle] >= model->max_scans)
+			continue;
+		frame->scan = 1;
+		opposite = (angle + model->n_angles / 2) % model->n_angles;
+		if(model->dual_edge && (scans[opposite] < model->max_scans)) {
+			frame->right = 1;
+			scans[opposite] ++;
+		}
+		scans[angle] ++;
+	}
+	g_free(scans);
+	angle_tracker_free(tracker);
+}
+
+/* max_scans and dual_edge are set per frame, so the block model scans
+ * what the plan says whatever it saw before */
+static void reprocess_scan_job(gpointer data, gpointer user_data)
+{
+	ReprocessJob *job = data;
+	Reprocess *rp = job->rp;
+	ReprocessFrame *frame;
+	GdkPixbuf *pixbuf;
+	guint8 *buffer;
+	guint32 i;
+	FILE *f;
+
+	f = reprocess_open(rp, job->first);
+	if(f == NULL) {
+		job->failed = TRUE;
+		return;
+	}
+	buffer = g_new(guint8, rp->frame_size);
+	for(i = job->first; i < job->last; i ++) {
+		if(fread(buffer, rp->frame_size, 1, f) != 1) {
+			g_warning("%s: short read at frame %u", rp->filename, i);
+			job->failed = TRUE;
+			break;
+		}
+		frame = rp->frames + i;
+		if(frame->angle < 0)
+			continue;
+		pixbuf = v4l2_convert_yuyv(buffer, rp->width, rp->height);
+		job->model->max_scans = frame->scan ? 255 : 0;
+		job->model->dual_edge = frame->right ? TRUE : FALSE;
+		if(scan_frame(job->model, pixbuf, frame->angle))
+			job->n_scanned ++;
+		gdk_pixbuf_unref(pixbuf);
+	}
+	g_free(buffer);
+	fclose(f);
+}
+
+/* one block of frames per thread, each with its own model */
+static gboolean reprocess_parallel(ReprocessJob *jobs, guint32 n_jobs,
+	GFunc func)
+{
+	GThreadPool *pool;
+	guint32 i;
+	gboolean retval = TRUE;
+
+	pool = g_thread_pool_new(func, NULL, n_jobs, TRUE, NULL);
+	for(i = 0; i < n_jobs; i ++)
+		g_thread_pool_push(pool, jobs + i, NULL);
+	/* wait for all queued jobs */
+	g_thread_pool_free(pool, FALSE, TRUE);
+	for(i = 0; i < n_jobs; i ++)
+		if(jobs[i].failed)
+			retval = FALSE;
+	return retval;
+}
+
+static gboolean reprocess_init(Reprocess *rp, const gchar *filename)
+{
+	Session *reference;
+	Region *object;
+	Model *model;
+	FILE *f;
+	long size;
+
+	if(sscanf(opt_size, "%ux%u", &(rp->width), &(rp->height)) != 2) {
+		g_printerr("invalid size: %s\n", opt_size);
+		return FALSE;
+	}
+	rp->filename = filename;
+	rp->frame_size = rp->width * rp->height * 2;
+	rp->code = gray_code_parse(opt_code);
+
+	f = fopen(filename, "rb");
+	if(f == NULL) {
+		g_printerr("failed to open %s\n", filename);
+		return FALSE;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fclose(f);
+	rp->n_frames = (size > 0) ? size / rp->frame_size : 0;
+	if(rp->n_frames == 0) {
+		g_printerr("%s: no %s frame\n", filename, opt_size);
+		return FALSE;
+	}
+
+	reference = session_open_readonly(opt_reference);
+	if(reference == NULL)
+		return FALSE;
+	rp->n_bits = reference->header->n_bits;
+	rp->sub_bits = reference->header->sub_bits;
+	rp->n_vert_y = reference->header->n_vert_y;
+	model = model_new(rp->n_bits, rp->sub_bits, rp->n_vert_y);
+	session_get_regions(reference, model->regions);
+	session_close(reference);
+
+	/* the regions outlive the model they were read into */
+	rp->regions = model->regions;
+	model->regions = NULL;
+	object = g_slist_nth_data(rp->regions, REGION_OBJECT);
+	model_cleanup(model);
+
+	if(opt_rows == 0) {
+		rp->n_vert_y = MIN(object->rect.height, MODEL_MAX_ROWS);
+		if(rp->n_vert_y < 2) {
+			g_printerr("a row per pixel needs an object region\n");
+			return FALSE;
+		}
+	} else if(opt_rows > 0) {
+		rp->n_vert_y = MIN(opt_rows, MODEL_MAX_ROWS);
+	}
+	rp->frames = g_new0(ReprocessFrame, rp->n_frames);
+	return TRUE;
+}
+
+static void reprocess_cleanup(Reprocess *rp)
+{
+	GSList *item;
+
+	for(item = rp->regions; item != NULL; item = item->next)
+		g_free(item->data);
+	g_slist_free(rp->regions);
+	g_free(rp->frames);
+}
+
+int main(int argc, char *argv[])
+{
+	Reprocess rp;
+	ReprocessJob *jobs;
+	Model *model;
+	GOptionContext *context;
+	GError *error = NULL;
+	GTimer *timer;
+	gdouble t_decode, t_scan, t_merge;
+	guint32 n_jobs, i, n_valid = 0, n_scanned = 0, n_angles = 0;
+	guint32 n_rejected = 0;
+	gboolean retval;
+
+	context = g_option_context_new("FRAMES");
+	g_option_context_add_main_entries(context, reprocess_options, NULL);
+	if(!g_option_context_parse(context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return EXIT_FAILURE;
+	}
+	g_option_context_free(context);
+
+	if((argc != 2) || (opt_reference == NULL)) {
+		g_printerr("usage: %s [OPTION...] --reference SESSION FRAMES\n",
+			argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(!g_thread_supported())
+		g_thread_init(NULL);
+	g_type_init();
+
+	memset(&rp, 0, sizeof(Reprocess));
+	if(!reprocess_init(&rp, argv[1])) {
+		reprocess_cleanup(&rp);
+		return EXIT_FAILURE;
+	}
+
+	n_jobs = (opt_threads > 0) ? opt_threads :
+		MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+	n_jobs = MIN(n_jobs, rp.n_frames);
+	jobs = g_new0(ReprocessJob, n_jobs);
+	for(i = 0; i < n_jobs; i ++) {
+		jobs[i].rp = &rp;
+		jobs[i].first = (guint64)rp.n_frames * i / n_jobs;
+		jobs[i].last = (guint64)rp.n_frames * (i + 1) / n_jobs;
+		jobs[i].model = reprocess_model(&rp);
+	}
+	model = reprocess_model(&rp);
+	timer = g_timer_new();
+
+	retval = reprocess_parallel(jobs, n_jobs, reprocess_decode_job);
+	t_decode = g_timer_elapsed(timer, NULL);
+	if(retval) {
+		/* the decode pass moved the strip of its models */
+		for(i = 0; i < n_jobs; i ++) {
+			model_cleanup(jobs[i].model);
+			jobs[i].model = reprocess_model(&rp);
+		}
+		reprocess_plan(&rp, model);
+		retval = reprocess_parallel(jobs, n_jobs, reprocess_scan_job);
+	}
+	t_scan = g_timer_elapsed(timer, NULL) - t_decode;
+
+	/* block order is frame order, whatever the thread count */
+	for(i = 0; retval && (i < n_jobs); i ++) {
+		retval = model_merge(model, jobs[i].model);
+		n_scanned += jobs[i].n_scanned;
+	}
+	t_merge = g_timer_elapsed(timer, NULL) - t_decode - t_scan;
+	g_timer_destroy(timer);
+
+	if(retval) {
+		for(i = 0; i < rp.n_frames; i ++) {
+			if(rp.frames[i].angle >= 0)
+				n_valid ++;
+			if(rp.frames[i].rejected)
+				n_rejected ++;
+		}
+		for(i = 0; i < model->n_angles; i ++)
+			if(model->angle_scans[i] > 0)
+				n_angles ++;
+		printf("%u frames on %u threads, %u rejected, %u decoded, "
+			"%u scanned, %u/%u angles seen, %u rows\n", rp.n_frames, n_jobs,
+			n_rejected, n_valid, n_scanned, n_angles, model->n_angles,
+			model->n_vert_y);
+		printf("decode %.3fs, scan %.3fs, merge %.3fs: %.1f frames/s, "
+			"%.1fx real time at %d fps\n", t_decode, t_scan, t_merge,
+			rp.n_frames / MAX(t_decode + t_scan + t_merge, 1e-9),
+			rp.n_frames / (gdouble)MAX(opt_fps, 1) /
+				MAX(t_decode + t_scan + t_merge, 1e-9), opt_fps);
+		retval = model_save(model, opt_output, NULL, NULL);
+	}
+
+	for(i = 0; i < n_jobs; i ++)
+		model_cleanup(jobs[i].model);
+	g_free(jobs);
+	model_cleanup(model);
+	reprocess_cleanup(&rp);
+
+	return retval ? EXIT_SUCCESS : EXIT_FAILURE;
+}
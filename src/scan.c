@@ -11,6 +11,19 @@ static inline guint8 *get_pixel(GdkPixbuf *pixbuf, guint32 x, guint32 y)
 		x * gdk_pixbuf_get_n_channels(pixbuf);
 }
 
+/* pixel of the object region on scanline row, through the lens map if the
+ * camera is calibrated */
+static inline guint8 *get_row_pixel(Model *model, GdkPixbuf *pixbuf,
+	Region *region, guint32 row, guint32 x, guint32 y)
+{
+	guint16 *src;
+
+	if(model->lens_map == NULL)
+		return get_pixel(pixbuf, x + region->rect.x, y);
+	src = model->lens_map->rows + (row * model->lens_map->width + x) * 2;
+	return get_pixel(pixbuf, src[0], src[1]);
+}
+
 #define GRAY_VALUE_U8(r, g, b) \
 	(guint8)(0.299 * (gfloat)(r) + 0.587 * (gfloat)(g) + 0.114 * (gfloat)(b))
 
@@ -47,48 +60,103 @@ static inline void avg_pixel_9(GdkPixbuf *pixbuf, guint32 x, guint32 y,
 	newpixel[2] = sum_b / n_pix;
 }
 
+/* majority of a pixel and its four neighbours */
+static inline guint8 scan_black_5(GdkPixbuf *pixbuf, guint32 x, guint32 y)
+{
+	guint32 sum;
+
+	sum = black_pixel(get_pixel(pixbuf, x, y));
+	sum += black_pixel(get_pixel(pixbuf, x + 1, y));
+	sum += black_pixel(get_pixel(pixbuf, x - 1, y));
+	sum += black_pixel(get_pixel(pixbuf, x, y + 1));
+	sum += black_pixel(get_pixel(pixbuf, x, y - 1));
+	return (sum > 2) ? 1 : 0;
+}
+
+/* the [quality] gate every frame passes before it is decoded or scanned,
+ * with the regions of model */
+/* the lens map only fits frames of the calibrated size; frames of another
+ * size (a different capture mode) drop it for good, raw pixels are
+ * sampled from then on */
+static void scan_check_lens(Model *model, GdkPixbuf *pixbuf)
+{
+	if((model->lens_map == NULL) ||
+		((gdk_pixbuf_get_width(pixbuf) == model->lens.width) &&
+		(gdk_pixbuf_get_height(pixbuf) == model->lens.height)))
+		return;
+	g_warning("lens calibrated for %ux%u frames, not %dx%d, "
+		"not correcting distortion", model->lens.width, model->lens.height,
+		gdk_pixbuf_get_width(pixbuf), gdk_pixbuf_get_height(pixbuf));
+	lens_map_free(model->lens_map);
+	model->lens_map = NULL;
+	model->lens.width = model->lens.height = 0;
+	if(model->hull) {
+		g_free(model->hull->src);
+		model->hull->src = NULL;
+	}
+}
+
+QualityVerdict scan_check_frame(Model *model, GdkPixbuf *pixbuf)
+{
+	Region *graycode, *object;
+
+	graycode = g_slist_nth_data(model->regions, REGION_GRAYCODE);
+	object = g_slist_nth_data(model->regions, REGION_OBJECT);
+	if(!graycode || !object || !quality_enabled(&(model->quality)))
+		return QUALITY_OK;
+	return quality_check(&(model->quality), pixbuf, &(graycode->rect),
+		&(object->rect));
+}
+
 gboolean scan_update_bits(Model *model, GdkPixbuf *pixbuf)
 {
-	guint32 sum, cx, cy;
+	guint32 cx, cy, guard, x0, x1;
 	gint32 i;
 	Region *region;
-	gfloat sh;
 
 	model->valid_dir = FALSE;
+	scan_check_lens(model, pixbuf);
 
 	region = g_slist_nth_data(model->regions, REGION_GRAYCODE);
 	if(region == NULL)
 		return FALSE;
-	if((region->rect.width < 1) || (region->rect.height < model->n_bits * 3))
+	if(!gray_code_fits(model->code, &(region->rect)))
 		return FALSE;
 
-	sh = (gfloat)region->rect.height / model->n_bits;
-	cx = region->rect.x + region->rect.width / 2;
-
+	guard = gray_code_guard(model->code, &(region->rect));
 	for(i = 0; i < model->n_bits; i ++) {
-		cy = region->rect.y + i * sh + sh / 2;
-		sum = black_pixel(get_pixel(pixbuf, cx, cy));
-		sum += black_pixel(get_pixel(pixbuf, cx + 1, cy));
-		sum += black_pixel(get_pixel(pixbuf, cx - 1, cy));
-		sum += black_pixel(get_pixel(pixbuf, cx, cy + 1));
-		sum += black_pixel(get_pixel(pixbuf, cx, cy - 1));
-		model->bits[model->n_bits - i - 1] = (sum > 2) ? 1 : 0;
+		gray_code_point(model->code, &(region->rect), i, &cx, &cy);
+		if(model->lens_map) {
+			cx = model->lens_map->gray[i * 2];
+			cy = model->lens_map->gray[i * 2 + 1];
+		}
+		model->bits[i] = scan_black_5(pixbuf, cx, cy);
+		if(guard == 0)
+			continue;
+		/* a cell edge close to any point gives a window of neither step */
+		x0 = MAX(cx, guard + 1) - guard;
+		x1 = MIN(cx + guard, gdk_pixbuf_get_width(pixbuf) - 2);
+		if((scan_black_5(pixbuf, x0, cy) != model->bits[i]) ||
+			(scan_black_5(pixbuf, x1, cy) != model->bits[i]))
+			return FALSE;
 	}
 
 	model->valid_dir = TRUE;
 	return TRUE;
 }
 
-gboolean scan_binarize_object_region(Model *model, GdkPixbuf *pixbuf)
+/* rect of pixbuf becomes white where it looks like the background sampled
+ * at its left edge, black elsewhere */
+gboolean scan_binarize(GdkPixbuf *pixbuf, GdkRectangle *rect,
+	gfloat bg_tolerance, guint32 bg_offset)
 {
-	Region *region = g_slist_nth_data(model->regions, REGION_OBJECT);
 	guint8 *new, *pixels, *pix, bg_gv, gv;
 	gint32 x, y, i;
 	guint32 nc, rs, sum_r = 0, sum_g = 0, sum_b = 0, n_pix = 0, w;
 	gfloat bg_div[3], div[3];
 	gboolean is_bg;
 
-	if(!region || (region->rect.width < 10) || (region->rect.height < 10))
+	if((rect->width < 10) || (rect->height < 10))
 		return FALSE;
 
 	pixels = gdk_pixbuf_get_pixels(pixbuf);
@@ -96,105 +164,337 @@ gboolean scan_binarize_object_region(Model *model, GdkPixbuf *pixbuf)
 	nc = gdk_pixbuf_get_n_channels(pixbuf);
 
 	/* get background color */
-	w = MIN(10, region->rect.width / 10);
-	for(y = 0; y < region->rect.height; y ++)
+	w = MIN(10, rect->width / 10);
+	for(y = 0; y < rect->height; y ++)
 		for(x = 0; x < w; x ++) {
-			pix = pixels + (y + region->rect.y) * rs +
-				(x + region->rect.x) * nc;
+			pix = pixels + (y + rect->y) * rs + (x + rect->x) * nc;
 			sum_r += pix[0];
 			sum_g += pix[1];
 			sum_b += pix[2];
 		}
-	n_pix = region->rect.height * w;
+	n_pix = rect->height * w;
 	bg_div[0] = (gfloat)(sum_r / n_pix) / (gfloat)(sum_g / n_pix + 0.01);
 	bg_div[1] = (gfloat)(sum_r / n_pix) / (gfloat)(sum_b / n_pix + 0.01);
 	bg_div[2] = (gfloat)(sum_g / n_pix) / (gfloat)(sum_b / n_pix + 0.01);
 	bg_gv = GRAY_VALUE_U8(sum_r / n_pix, sum_g / n_pix, sum_b / n_pix);
 
-	new = g_new0(guint8, region->rect.width * region->rect.height * 3);
+	new = g_new0(guint8, rect->width * rect->height * 3);
 
-	for(y = 0; y < region->rect.height; y ++) {
-		for(x = 0; x < region->rect.width; x ++) {
-			pix = new + y * region->rect.width * 3 + x * 3;
-			avg_pixel_9(pixbuf, x + region->rect.x, y + region->rect.y, pix);
+	for(y = 0; y < rect->height; y ++) {
+		for(x = 0; x < rect->width; x ++) {
+			pix = new + y * rect->width * 3 + x * 3;
+			avg_pixel_9(pixbuf, x + rect->x, y + rect->y, pix);
 			div[0] = (gfloat)pix[0] / (gfloat)(pix[1] + 0.01);
 			div[1] = (gfloat)pix[0] / (gfloat)(pix[2] + 0.01);
 			div[2] = (gfloat)pix[1] / (gfloat)(pix[2] + 0.01);
 			gv = GRAY_VALUE_U8(pix[0], pix[1], pix[2]);
 			is_bg = TRUE;
 			for(i = 0; i < 3; i ++)
-				if(fabs(div[i] - bg_div[i]) > 0.8)
+				if(fabs(div[i] - bg_div[i]) > bg_tolerance)
 					is_bg = FALSE;
-			if((gv - bg_gv) > 32)
+			if((gv - bg_gv) > (gint32)bg_offset)
 				is_bg = FALSE;
 			memset(pix, is_bg ? 0xFF : 0x00, 3);
 		}
 	}
-	for(y = 0; y < region->rect.height; y ++)
-		for(x = 0; x < region->rect.width; x ++)
+	for(y = 0; y < rect->height; y ++)
+		for(x = 0; x < rect->width; x ++)
 			memcpy(
-				pixels + (y + region->rect.y) * rs + (x + region->rect.x) * nc,
-				new + y * region->rect.width * 3 + x * 3, 3);
+				pixels + (y + rect->y) * rs + (x + rect->x) * nc,
+				new + y * rect->width * 3 + x * 3, 3);
 
 	g_free(new);
 
 	return TRUE;
 }
 
+gboolean scan_binarize_object_region(Model *model, GdkPixbuf *pixbuf)
+{
+	Region *region = g_slist_nth_data(model->regions, REGION_OBJECT);
+
+	if(!region || (region->rect.width < 10) || (region->rect.height < 10))
+		return FALSE;
+	return scan_binarize(pixbuf, &(region->rect), model->bg_tolerance,
+		model->bg_offset);
+}
+
+/* unfiltered pixels for the texture strip; the band covers the surface
+ * between the neighbouring angles, and image x runs against the angle */
+static void scan_texture(Model *model, GdkPixbuf *pixbuf, Region *region,
+	guint32 angle)
+{
+	guint8 *texel;
+	guint16 *src;
+	gint32 x, x0, y, i, k;
+	gfloat sh;
+
+	sh = (gfloat)region->rect.height / model->tex_rows;
+	x0 = region->rect.x + region->rect.width / 2 + model->tex_band / 2 - 1;
+	texel = model->texture + angle * model->tex_rows * model->tex_band * 3;
+	for(i = 0; i < model->tex_rows; i ++) {
+		y = region->rect.y + (gint32)(i * sh + sh / 2);
+		for(k = 0; k < model->tex_band; k ++) {
+			if(model->lens_map) {
+				src = model->lens_map->tex +
+					(i * model->tex_band + k) * 2;
+				memcpy(texel, get_pixel(pixbuf, src[0], src[1]), 3);
+			} else {
+				x = CLAMP(x0 - k, 0, gdk_pixbuf_get_width(pixbuf) - 1);
+				memcpy(texel, get_pixel(pixbuf, x, y), 3);
+			}
+			texel += 3;
+		}
+	}
+}
+
 gboolean scan_colors(Model *model, GdkPixbuf *pixbuf, guint32 angle)
 {
 	Region *region;
 	guint8 col[3];
+	guint16 *src;
 	guint32 x, y;
 	gint32 i;
 	gfloat sh;
 
 	region = g_slist_nth_data(model->regions, REGION_OBJECT);
 	g_return_val_if_fail(region != NULL, FALSE);
-	g_return_val_if_fail(angle < (1 << model->n_bits), FALSE);
+	g_return_val_if_fail(angle < model->n_angles, FALSE);
 
 	sh = (gfloat)region->rect.height / model->n_vert_y;
-	x = region->rect.x + region->rect.width / 2;
 	for(i = 0; i < model->n_vert_y; i ++) {
+		x = region->rect.x + region->rect.width / 2;
 		y = (region->rect.y + region->rect.height - 1) - i * sh - sh / 2;
+		if(model->lens_map) {
+			src = model->lens_map->rows +
+				(i * model->lens_map->width + region->rect.width / 2) * 2;
+			x = src[0];
+			y = src[1];
+		}
 		avg_pixel_9(pixbuf, x, y, col);
-		memcpy(model->angle_colors + (angle * model->n_vert_y + i) * 3,
-			col, 3);
+		model_set_color(model, angle, i, col);
+		if(model->obslog)
+			obslog_add(model->obslog, angle, i, OBSLOG_COLOR, 0, 0, col);
 	}
+	if(model->texture)
+		scan_texture(model, pixbuf, region, angle);
+	model->angle_dirty[angle] = 1;
 
 	return TRUE;
 }
 
-gboolean scan_angle(Model *model, GdkPixbuf *pixbuf, guint32 angle)
+static inline guint32 scan_row_y(Region *region, gfloat sh, guint32 row)
 {
-	Region *region;
+	return (region->rect.y + region->rect.height - 1) - row * sh - sh / 2;
+}
+
+/* the profile rows of the object region before binarization, one pixbuf
+ * row each (through the lens map if there is one); all the observation
+ * log samples, at a fraction of a copy of the frame */
+static GdkPixbuf *scan_raw_rows(Model *model, GdkPixbuf *pixbuf,
+	Region *region)
+{
+	GdkPixbuf *rows;
+	guint8 *line;
+	guint32 rs, y;
 	gint32 i, x;
-	guint8 *pix;
-	guint32 y;
-	gfloat *v, sh;
+	gfloat sh;
+
+	if((region->rect.width <= 0) || (region->rect.height <= 0))
+		return NULL;
+	rows = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, region->rect.width,
+		model->n_vert_y);
+	rs = gdk_pixbuf_get_rowstride(rows);
+	sh = (gfloat)region->rect.height / model->n_vert_y;
+	for(i = 0; i < model->n_vert_y; i ++) {
+		y = scan_row_y(region, sh, i);
+		line = gdk_pixbuf_get_pixels(rows) + i * rs;
+		for(x = 0; x < region->rect.width; x ++)
+			memcpy(line + x * 3,
+				get_row_pixel(model, pixbuf, region, i, x, y), 3);
+	}
+	return rows;
+}
+
+/* logs the edge at column x of the mask row, with the color just inside
+ * the silhouette and the gray value step across the edge in the raw rows
+ * of scan_raw_rows() (dir: towards the object) */
+static void scan_log_edge(Model *model, GdkPixbuf *raw, Region *region,
+	guint32 angle, guint32 row, guint32 side, gint32 x, gint32 dir,
+	gint32 r)
+{
+	guint8 *in, *out, rgb[3] = { 0, 0, 0 }, confidence = 0;
+	gint32 xi, xo;
+
+	if(raw) {
+		xi = CLAMP(x + dir, 0, region->rect.width - 1);
+		xo = CLAMP(x - dir * 2, 0, region->rect.width - 1);
+		in = get_pixel(raw, xi, row);
+		out = get_pixel(raw, xo, row);
+		memcpy(rgb, in, 3);
+		confidence = ABS(GRAY_VALUE_U8(in[0], in[1], in[2]) -
+			GRAY_VALUE_U8(out[0], out[1], out[2]));
+	}
+	obslog_add(model->obslog, angle, row, side, r, confidence, rgb);
+}
+
+/* column of the outermost object pixel in every profile row of the mask,
+ * searched from the left up to three quarters of the region (left) and
+ * from the right down to one quarter (right, may be NULL), -1 if there is
+ * none; one pass over the rows in memory order, which with a row per
+ * pixel row streams through the whole region once */
+static void scan_edges(Model *model, GdkPixbuf *mask, Region *region,
+	gint32 *left, gint32 *right)
+{
+	guint8 *line, *pixels;
+	guint32 rs, nc, y;
+	gint32 i, x, w = region->rect.width, x_left, x_right;
+	gfloat sh;
+
+	pixels = gdk_pixbuf_get_pixels(mask);
+	rs = gdk_pixbuf_get_rowstride(mask);
+	nc = gdk_pixbuf_get_n_channels(mask);
+	x_left = ceil(w * 0.75);
+	x_right = floor(w * 0.25);
+
+	sh = (gfloat)region->rect.height / model->n_vert_y;
+	for(i = model->n_vert_y - 1; i >= 0; i --) {
+		y = scan_row_y(region, sh, i);
+		if(model->lens_map) {
+			for(x = 0; (x < x_left) &&
+				get_row_pixel(model, mask, region, i, x, y)[0]; x ++);
+			left[i] = (x < x_left) ? x : -1;
+			if(right == NULL)
+				continue;
+			for(x = w - 1; (x > x_right) &&
+				get_row_pixel(model, mask, region, i, x, y)[0]; x --);
+			right[i] = (x > x_right) ? x : -1;
+			continue;
+		}
+
+		line = pixels + y * rs + region->rect.x * nc;
+		for(x = 0; (x < x_left) && line[x * nc]; x ++);
+		left[i] = (x < x_left) ? x : -1;
+		if(right == NULL)
+			continue;
+		for(x = w - 1; (x > x_right) && line[x * nc]; x --);
+		right[i] = (x > x_right) ? x : -1;
+	}
+}
+
+/* the left silhouette edge is the profile at angle, the right one the
+ * profile half a turn later; raw (may be NULL) holds the rows of the
+ * frame before binarization, for the observation log. without update the edges only go
+ * to the log, which takes all of them regardless of max_scans */
+static gboolean scan_angle_log(Model *model, GdkPixbuf *pixbuf,
+	GdkPixbuf *raw, guint32 angle, gboolean update)
+{
+	Region *region;
+	gint32 i, r, *left, *right;
+	guint32 opposite;
+	gboolean update_right;
+	gfloat v;
 
 	region = g_slist_nth_data(model->regions, REGION_OBJECT);
 	g_return_val_if_fail(region != NULL, FALSE);
-	g_return_val_if_fail(angle < (1 << model->n_bits), FALSE);
+	g_return_val_if_fail(angle < model->n_angles, FALSE);
+
+	opposite = (angle + model->n_angles / 2) % model->n_angles;
+	update_right = update && model->dual_edge &&
+		(model->angle_scans[opposite] < model->max_scans);
+	left = g_new(gint32, model->n_vert_y * 2);
+	right = NULL;
+	if(update_right || (model->dual_edge && model->obslog))
+		right = left + model->n_vert_y;
+	scan_edges(model, pixbuf, region, left, right);
 
-	sh = (gfloat)region->rect.height / model->n_vert_y;
 	for(i = 0; i < model->n_vert_y; i ++) {
-		y = (region->rect.y + region->rect.height - 1) - i * sh - sh / 2;
-		v = model->angle_verts + angle * model->n_vert_y + i;
-		for(x = 0; x < (region->rect.width * 0.75); x ++) {
-			pix = get_pixel(pixbuf, x + region->rect.x, y);
-			if(pix[0] == 0x00) {
-				if((*v == 0) || (*v > (region->rect.width / 2 - x)))
-					*v = region->rect.width / 2 - x;
-				break;
-			}
+		if(left[i] >= 0) {
+			r = region->rect.width / 2 - left[i];
+			v = model_get_radius(model, angle, i);
+			/* 0 is no silhouette, an edge on the axis cannot clear a row */
+			if(update && (r != 0) && ((v == 0) || (v > r)))
+				model_set_radius(model, angle, i, r);
+			if(model->obslog)
+				scan_log_edge(model, raw, region, angle, i, OBSLOG_LEFT,
+					left[i], 1, r);
+		}
+		if(right && (right[i] >= 0)) {
+			r = right[i] + 1 - region->rect.width / 2;
+			v = model_get_radius(model, opposite, i);
+			if(update_right && (r != 0) && ((v == 0) || (v > r)))
+				model_set_radius(model, opposite, i, r);
+			if(model->obslog)
+				scan_log_edge(model, raw, region, opposite, i, OBSLOG_RIGHT,
+					right[i], -1, r);
 		}
-#if 0
-		g_debug("0x%02X: %02d: %.2f", angle, i,
-			model->angle_verts[angle * model->n_vert_y + i]);
-#endif
 	}
-	model->angle_scans[angle] ++;
+	if(update) {
+		model->angle_scans[angle] ++;
+		model->angle_dirty[angle] = 1;
+	}
+	if(update_right) {
+		model->angle_scans[opposite] ++;
+		model->angle_dirty[opposite] = 1;
+	}
+	g_free(left);
 	return TRUE;
 }
 
+gboolean scan_angle(Model *model, GdkPixbuf *pixbuf, guint32 angle)
+{
+	return scan_angle_log(model, pixbuf, NULL, angle, TRUE);
+}
+
+/* the per-frame pipeline once the angle of a frame is known (angle < 0:
+ * unknown, only binarize); returns TRUE if a silhouette was added. colors
+ * come from pixbuf, the silhouette from mask, a copy of pixbuf already run
+ * through scan_binarize(); without a mask pixbuf itself is binarized after
+ * the colors were taken */
+gboolean scan_frame_mask(Model *model, GdkPixbuf *pixbuf, GdkPixbuf *mask,
+	gint32 angle)
+{
+	Region *region;
+	GdkPixbuf *raw = NULL;
+	guint32 n_angles = model->n_angles, target;
+	gboolean retval = FALSE;
+
+	scan_check_lens(model, pixbuf);
+	if(angle >= 0) {
+		/* scan colors of vertices a quarter rotation later; the scan count
+		 * of an angle also grows from the right edge, so it cannot tell
+		 * whether the angle was seen before */
+		target = (angle + n_angles * 3 / 4) % n_angles;
+		if(!model_has_colors(model, target))
+			scan_colors(model, pixbuf, target);
+	}
+	/* the observation log takes its colors from the raw frame */
+	region = g_slist_nth_data(model->regions, REGION_OBJECT);
+	if(model->obslog && (angle >= 0) && region)
+		raw = scan_raw_rows(model, pixbuf, region);
+	if(mask == NULL) {
+		scan_binarize_object_region(model, pixbuf);
+		mask = pixbuf;
+	}
+	if((angle >= 0) && (model->hull_depth > 0)) {
+		if((model->hull == NULL) && (region->rect.width > 0) &&
+			(region->rect.height > 0))
+			model->hull = hull_new(n_angles, &(region->rect),
+				model->hull_depth,
+				model->lens_map ? &(model->lens) : NULL);
+		if(model->hull)
+			hull_add_mask(model->hull, mask, angle);
+	}
+	if(angle >= 0) {
+		retval = (model->angle_scans[angle] < model->max_scans);
+		if(retval || model->obslog)
+			scan_angle_log(model, mask, raw, angle, retval);
+	}
+	if(raw)
+		gdk_pixbuf_unref(raw);
+	return retval;
+}
+
+gboolean scan_frame(Model *model, GdkPixbuf *pixbuf, gint32 angle)
+{
+	return scan_frame_mask(model, pixbuf, NULL, angle);
+}
@@ -3,9 +3,15 @@
 
 #include "model.h"
 
+QualityVerdict scan_check_frame(Model *model, GdkPixbuf *pixbuf);
 gboolean scan_update_bits(Model *model, GdkPixbuf *pixbuf);
+gboolean scan_binarize(GdkPixbuf *pixbuf, GdkRectangle *rect,
+	gfloat bg_tolerance, guint32 bg_offset);
 gboolean scan_binarize_object_region(Model *model, GdkPixbuf *pixbuf);
 gboolean scan_colors(Model *model, GdkPixbuf *pixbuf, guint32 angle);
 gboolean scan_angle(Model *model, GdkPixbuf *pixbuf, guint32 angle);
+gboolean scan_frame_mask(Model *model, GdkPixbuf *pixbuf, GdkPixbuf *mask,
+	gint32 angle);
+gboolean scan_frame(Model *model, GdkPixbuf *pixbuf, gint32 angle);
 
 #endif
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+
+#include "session.h"
+#include "region.h"
+
+static inline guint64 session_align(guint64 offset)
+{
+	return (offset + SESSION_ALIGN - 1) & ~(guint64)(SESSION_ALIGN - 1);
+}
+
+static Session *session_map(const gchar *filename, int fd, gsize size,
+	gboolean writable)
+{
+	Session *session;
+	void *map;
+
+	map = mmap(NULL, size, writable ? (PROT_READ | PROT_WRITE) : PROT_READ,
+		MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED) {
+		g_warning("mmapping session %s failed: %s (%d)", filename,
+			strerror(errno), errno);
+		close(fd);
+		return NULL;
+	}
+
+	session = g_new0(Session, 1);
+	session->filename = g_strdup(filename);
+	session->fd = fd;
+	session->map = map;
+	session->header = map;
+	session->writable = writable;
+	return session;
+}
+
+static Session *session_open_mode(const gchar *filename, gboolean writable)
+{
+	SessionHeader header;
+	struct stat st;
+	int fd;
+
+	fd = open(filename, writable ? O_RDWR : O_RDONLY);
+	if(fd < 0)
+		return NULL;
+
+	if((fstat(fd, &st) != 0) || (st.st_size < sizeof(SessionHeader)) ||
+		(read(fd, &header, sizeof(SessionHeader)) !=
+			sizeof(SessionHeader))) {
+		g_warning("session %s: short file", filename);
+		close(fd);
+		return NULL;
+	}
+
+	if(memcmp(header.magic, SESSION_MAGIC, 8) != 0) {
+		g_warning("session %s: bad magic", filename);
+		close(fd);
+		return NULL;
+	}
+	if((header.version != SESSION_VERSION) ||
+		(header.header_size != sizeof(SessionHeader))) {
+		g_warning("session %s: unsupported version %d", filename,
+			header.version);
+		close(fd);
+		return NULL;
+	}
+	if((header.n_bits == 0) || (header.n_bits > 16) ||
+		((header.n_bits + header.sub_bits) > 20) ||
+		(header.n_vert_y == 0) ||
+		(header.arena_offset < sizeof(SessionHeader)) ||
+		(header.arena_offset != session_align(header.arena_offset)) ||
+		(header.arena_offset > header.size) ||
+		(header.size != st.st_size)) {
+		g_warning("session %s: corrupt header", filename);
+		close(fd);
+		return NULL;
+	}
+
+	g_debug("session %s: resuming (%d+%d bits, %d rows)", filename,
+		header.n_bits, header.sub_bits, header.n_vert_y);
+
+	return session_map(filename, fd, header.size, writable);
+}
+
+Session *session_open(const gchar *filename)
+{
+	return session_open_mode(filename, TRUE);
+}
+
+Session *session_open_readonly(const gchar *filename)
+{
+	return session_open_mode(filename, FALSE);
+}
+
+Session *session_create(const gchar *filename, guint32 n_bits,
+	guint32 sub_bits, guint32 n_vert_y, guint32 tex_band, guint32 tex_rows,
+	gsize arena_size)
+{
+	SessionHeader header;
+	gchar *dirname;
+	int fd;
+
+	memset(&header, 0, sizeof(SessionHeader));
+	memcpy(header.magic, SESSION_MAGIC, 8);
+	header.version = SESSION_VERSION;
+	header.header_size = sizeof(SessionHeader);
+	header.n_bits = n_bits;
+	header.sub_bits = sub_bits;
+	header.n_vert_y = n_vert_y;
+	header.tex_band = tex_band;
+	header.tex_rows = tex_rows;
+
+	header.arena_offset = session_align(sizeof(SessionHeader));
+	header.size = session_align(header.arena_offset + arena_size);
+
+	dirname = g_path_get_dirname(filename);
+	g_mkdir(dirname, 0755);
+	g_free(dirname);
+
+	fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		g_warning("failed to create session %s: %s (%d)", filename,
+			strerror(errno), errno);
+		return NULL;
+	}
+
+	/* truncated file reads back as zeroes, so storage starts cleared */
+	if((ftruncate(fd, header.size) != 0) ||
+		(write(fd, &header, sizeof(SessionHeader)) !=
+			sizeof(SessionHeader))) {
+		g_warning("failed to write session %s: %s (%d)", filename,
+			strerror(errno), errno);
+		close(fd);
+		return NULL;
+	}
+
+	return session_map(filename, fd, header.size, TRUE);
+}
+
+void session_close(Session *session)
+{
+	session_sync(session);
+	munmap(session->map, session->header->size);
+	close(session->fd);
+	g_free(session->filename);
+	g_free(session);
+}
+
+void session_sync(Session *session)
+{
+	if(session->writable)
+		msync(session->map, session->header->size, MS_ASYNC);
+}
+
+void session_get_regions(Session *session, GSList *regions)
+{
+	Region *region;
+	gint32 i;
+
+	for(i = 0; i < NUM_REGIONS; i ++) {
+		region = g_slist_nth_data(regions, i);
+		if(region == NULL)
+			continue;
+		region->rect.x = session->header->regions[i][0];
+		region->rect.y = session->header->regions[i][1];
+		region->rect.width = session->header->regions[i][2];
+		region->rect.height = session->header->regions[i][3];
+	}
+}
+
+void session_set_regions(Session *session, GSList *regions)
+{
+	Region *region;
+	gint32 i;
+
+	for(i = 0; i < NUM_REGIONS; i ++) {
+		region = g_slist_nth_data(regions, i);
+		if(region == NULL)
+			continue;
+		session->header->regions[i][0] = region->rect.x;
+		session->header->regions[i][1] = region->rect.y;
+		session->header->regions[i][2] = region->rect.width;
+		session->header->regions[i][3] = region->rect.height;
+	}
+}
+
+guint8 *session_get_arena(Session *session)
+{
+	return session->map + session->header->arena_offset;
+}
@@ -0,0 +1,50 @@
+#ifndef _SESSION_H
+#define _SESSION_H
+
+#include <glib.h>
+
+#include "region.h"
+
+#define SESSION_MAGIC     "3DSCANSS"
+#define SESSION_VERSION   4
+#define SESSION_ALIGN     64
+
+/* on-disk header, stored in host byte order at offset 0 of the session
+ * file; the model storage arena (see model_layout()) follows at a
+ * SESSION_ALIGN-aligned offset */
+typedef struct {
+	gchar magic[8];
+	guint32 version;
+	guint32 header_size;
+	guint32 n_bits;
+	guint32 sub_bits;
+	guint32 n_vert_y;
+	guint32 tex_band;
+	guint32 tex_rows;
+	gint32 regions[NUM_REGIONS][4];
+	guint64 arena_offset;
+	guint64 size;
+} SessionHeader;
+
+typedef struct {
+	gchar *filename;
+	int fd;
+	guint8 *map;
+	SessionHeader *header;
+	gboolean writable;
+} Session;
+
+Session *session_open(const gchar *filename);
+Session *session_open_readonly(const gchar *filename);
+Session *session_create(const gchar *filename, guint32 n_bits,
+	guint32 sub_bits, guint32 n_vert_y, guint32 tex_band, guint32 tex_rows,
+	gsize arena_size);
+void session_close(Session *session);
+void session_sync(Session *session);
+
+void session_get_regions(Session *session, GSList *regions);
+void session_set_regions(Session *session, GSList *regions);
+
+guint8 *session_get_arena(Session *session);
+
+#endif
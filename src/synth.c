@@ -0,0 +1,202 @@
+#include <math.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "synth.h"
+#include "region.h"
+
+#define SYNTH_SAMPLES 128
+
+static void synth_layout_code(SynthScene *scene);
+
+SynthScene *synth_new(guint32 width, guint32 height, guint32 n_bits)
+{
+	SynthScene *scene;
+
+	scene = g_new0(SynthScene, 1);
+	scene->width = width & ~1UL;
+	scene->height = height;
+	scene->n_bits = n_bits;
+	scene->code = gray_code_new(GRAY_CODE_REFLECTED, n_bits);
+
+	/* ring strip in the lower left */
+	scene->ring_center = scene->width * 5 / 100 + (scene->width * 15 / 100) / 2;
+	scene->ring_radius = scene->width * 15 / 100;
+	synth_layout_code(scene);
+
+	/* object region centered on the turntable axis */
+	scene->object.x = scene->width * 30 / 100;
+	scene->object.y = height * 5 / 100;
+	scene->object.width = scene->width / 2;
+	scene->object.height = height * 85 / 100;
+	scene->max_radius = scene->object.width * 0.35;
+
+	scene->noise = 6;
+	scene->seed = 0x3D5CA17;
+	return scene;
+}
+
+void synth_free(SynthScene *scene)
+{
+	gray_code_free(scene->code);
+	g_free(scene);
+}
+
+/* strip region as the scan expects it for the code: the reflected code
+ * fills a tall band, the single track a thin row of n_bits cells with the
+ * step read by gray_code_decode() under the ring center */
+static void synth_layout_code(SynthScene *scene)
+{
+	gfloat cell;
+
+	if(scene->code->type == GRAY_CODE_DEBRUIJN) {
+		cell = G_PI * 2.0 * scene->ring_radius / scene->code->n_codes;
+		scene->graycode.x = scene->ring_center -
+			(scene->n_bits / 2 + 0.5) * cell + 0.5;
+		scene->graycode.width = cell * scene->n_bits + 0.5;
+		scene->graycode.height = MAX(scene->height / 40, 5);
+	} else {
+		scene->graycode.x = scene->width * 5 / 100;
+		scene->graycode.width = scene->width * 15 / 100;
+		scene->graycode.height = MAX(scene->height / 4, scene->n_bits * 4);
+	}
+	scene->graycode.y = scene->height * 95 / 100 - scene->graycode.height;
+}
+
+void synth_set_code(SynthScene *scene, GrayCodeType type)
+{
+	GrayCode *code;
+
+	code = gray_code_new(type, scene->n_bits);
+	g_return_if_fail(code != NULL);
+	gray_code_free(scene->code);
+	scene->code = code;
+	synth_layout_code(scene);
+}
+
+void synth_set_regions(SynthScene *scene, Model *model)
+{
+	model_set_region(model, REGION_GRAYCODE, &(scene->graycode));
+	model_set_region(model, REGION_OBJECT, &(scene->object));
+}
+
+/*****************************************************************************/
+
+/* polar profile of the object in its own frame, t runs top to bottom */
+static inline gfloat synth_profile(SynthScene *scene, gfloat theta, gfloat t)
+{
+	gfloat base;
+
+	if((t < 0.05) || (t > 0.95))
+		return 0.0;
+	base = scene->max_radius * (0.65 + 0.25 * sin(3.0 * G_PI * t));
+	return base * (1.0 + 0.15 * cos(theta) + 0.08 * cos(2.0 * theta)) / 1.23;
+}
+
+/* silhouette extent left and right of the axis at image row y */
+void synth_extent(SynthScene *scene, gfloat angle, gfloat y,
+	gfloat *left, gfloat *right)
+{
+	gfloat t, theta, r, x;
+	gint32 i;
+
+	*left = *right = 0.0;
+	t = (y - scene->object.y) / (gfloat)scene->object.height;
+	for(i = 0; i < SYNTH_SAMPLES; i ++) {
+		theta = G_PI * 2.0 * i / SYNTH_SAMPLES;
+		r = synth_profile(scene, theta, t);
+		x = r * cos(theta + angle);
+		if(-x > *left)
+			*left = -x;
+		if(x > *right)
+			*right = x;
+	}
+}
+
+static inline guint32 synth_random(SynthScene *scene)
+{
+	scene->seed = scene->seed * 1103515245 + 12345;
+	return (scene->seed >> 16) & 0x7FFF;
+}
+
+static void synth_pixel(SynthScene *scene, gfloat angle, gint32 x, gint32 y,
+	gfloat left, gfloat right, guint8 *rgb)
+{
+	gfloat axis, dx, pos, shade;
+	guint32 col, row;
+
+	/* code ring, top row is the most significant bit */
+	if((x >= scene->graycode.x) &&
+		(x < (scene->graycode.x + scene->graycode.width)) &&
+		(y >= scene->graycode.y) &&
+		(y < (scene->graycode.y + scene->graycode.height))) {
+		dx = x + 0.5 - scene->ring_center;
+		pos = (angle + asin(dx / scene->ring_radius)) / (G_PI * 2.0);
+		pos -= floor(pos);
+		col = (guint32)(pos * scene->code->n_codes) % scene->code->n_codes;
+		row = (y - scene->graycode.y) * scene->n_bits /
+			scene->graycode.height;
+		if(gray_code_black(scene->code, col, scene->n_bits - row - 1))
+			memset(rgb, 20, 3);
+		else
+			memset(rgb, 240, 3);
+		return;
+	}
+
+	axis = scene->object.x + scene->object.width / 2;
+	dx = x + 0.5 - axis;
+	if((dx >= -left) && (dx < right)) {
+		shade = (dx < 0) ? (-dx / left) : (dx / right);
+		shade = 0.6 + 0.4 * sqrt(MAX(0.0, 1.0 - shade * shade));
+		rgb[0] = 200 * shade;
+		rgb[1] = (50 + 40 * (0.5 + 0.5 * cos(angle + dx / scene->max_radius)))
+			* shade;
+		rgb[2] = (40 + 20.0 * (y - scene->object.y) / scene->object.height)
+			* shade;
+		return;
+	}
+
+	rgb[0] = 170;
+	rgb[1] = 180;
+	rgb[2] = 200;
+}
+
+static inline guint8 synth_clamp(gfloat v)
+{
+	return (guint8)CLAMP(v + 0.5, 0.0, 255.0);
+}
+
+/* inverse of the conversion in v4l2_convert_yuyv(), chroma shared per pair */
+guint8 *synth_render_yuyv(SynthScene *scene, gfloat angle)
+{
+	guint8 *buf, *p, rgb[2][3];
+	gfloat left, right, cy[2], cu, cv, noise;
+	gint32 x, y, i;
+
+	buf = g_new(guint8, scene->width * scene->height * 2);
+	for(y = 0; y < scene->height; y ++) {
+		synth_extent(scene, angle, y + 0.5, &left, &right);
+		for(x = 0; x < scene->width; x += 2) {
+			cu = cv = 0.0;
+			for(i = 0; i < 2; i ++) {
+				synth_pixel(scene, angle, x + i, y, left, right, rgb[i]);
+				cy[i] = 0.299 * rgb[i][0] + 0.587 * rgb[i][1] +
+					0.114 * rgb[i][2];
+				cu += (rgb[i][2] - cy[i]) / 1.732446 / 2.0;
+				cv += (rgb[i][0] - cy[i]) / 1.370705 / 2.0;
+				if(scene->noise) {
+					noise = (gfloat)(synth_random(scene) %
+						(scene->noise * 2 + 1)) - scene->noise;
+					cy[i] += noise;
+				}
+			}
+			p = buf + (y * scene->width + x) * 2;
+			p[0] = synth_clamp(cy[0]);
+			p[1] = synth_clamp(cu + 128);
+			p[2] = synth_clamp(cy[1]);
+			p[3] = synth_clamp(cv + 128);
+		}
+	}
+	return buf;
+}
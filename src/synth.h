@@ -0,0 +1,35 @@
+#ifndef _SYNTH_H
+#define _SYNTH_H
+
+#include <glib.h>
+
+#include "model.h"
+#include "gray.h"
+
+/* synthetic turntable scene: a rotating object of known profile in front
+ * of a plain background, with the gray-code ring from misc/gray.pl */
+typedef struct {
+	guint32 width;
+	guint32 height;
+	guint32 n_bits;
+	GrayCode *code;
+
+	GdkRectangle graycode;
+	GdkRectangle object;
+
+	gfloat ring_center;
+	gfloat ring_radius;
+	gfloat max_radius;
+	guint32 noise;
+	guint32 seed;
+} SynthScene;
+
+SynthScene *synth_new(guint32 width, guint32 height, guint32 n_bits);
+void synth_free(SynthScene *scene);
+void synth_set_code(SynthScene *scene, GrayCodeType type);
+void synth_set_regions(SynthScene *scene, Model *model);
+void synth_extent(SynthScene *scene, gfloat angle, gfloat y,
+	gfloat *left, gfloat *right);
+guint8 *synth_render_yuyv(SynthScene *scene, gfloat angle);
+
+#endif
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
@@ -31,6 +32,9 @@ struct _V4l2Data {
 
 	size_t n_buffers;
 	struct mmap_buffer *buffers;
+
+	/* raw frames appended for 3dscan-harness --input and 3dscan-reprocess */
+	FILE *record;
 };
 
 static gboolean v4l2_select_format(V4l2Data *data)
@@ -154,10 +158,15 @@ static gboolean v4l2_request_buffers(V4l2Data *data)
 }
 
 V4l2Data *v4l2_init(Config *config)
+{
+	return v4l2_init_section(config, "v4l2");
+}
+
+V4l2Data *v4l2_init_section(Config *config, const gchar *section)
 {
 	V4l2Data *data;
 	struct v4l2_capability cap;
-	gchar *devname;
+	gchar *devname, *recname;
 	int ret;
 
 	g_type_init();
@@ -165,7 +174,7 @@ V4l2Data *v4l2_init(Config *config)
 	data = g_new0(V4l2Data, 1);
 	data->config = config;
 
-	devname = config_get_string(config, "v4l2", "device", "/dev/video0");
+	devname = config_get_string(config, section, "device", "/dev/video0");
 
 	data->fd = open(devname, O_RDWR);
 	if(data->fd < 0) {
@@ -201,6 +210,19 @@ V4l2Data *v4l2_init(Config *config)
 		return NULL;
 	}
 
+	/* "record": every captured frame as raw YUYV, back to back */
+	recname = config_get_string(config, section, "record", "");
+	if(recname[0] != '\0') {
+		data->record = fopen(recname, "ab");
+		if(data->record == NULL)
+			g_warning("failed to open %s: %s (%d)", recname,
+				strerror(errno), errno);
+		else
+			g_debug("recording %dx%d frames to %s", (gint)data->width,
+				(gint)data->height, recname);
+	}
+	g_free(recname);
+
 	g_free(devname);
 	return data;
 }
@@ -219,18 +241,22 @@ void v4l2_cleanup(V4l2Data *data)
 			munmap(data->buffers[i].start, data->buffers[i].length);
 		}
 	}
+	if(data->record)
+		fclose(data->record);
 	g_free(data->buffers);
 	g_free(data);
 }
 
 GdkPixbuf *v4l2_get_pixbuf(V4l2Data *data)
+{
+	return v4l2_get_frame(data, NULL);
+}
+
+/* timestamp is the capture time in microseconds as reported by the driver */
+GdkPixbuf *v4l2_get_frame(V4l2Data *data, guint64 *timestamp)
 {
 	GdkPixbuf *pixbuf;
 	struct v4l2_buffer buffer;
-	gint32 x, y;
-	guint8 *buf, *pixels, *pixel;
-	guint32 rowstride, n_channels;
-	guint8 cy, cu, cv, r, g, b;
 
 	buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	buffer.memory = V4L2_MEMORY_MMAP;
@@ -238,20 +264,45 @@ GdkPixbuf *v4l2_get_pixbuf(V4l2Data *data)
 		g_warning("dequeuing buffer failed: %s (%d)", strerror(errno), errno);
 		return NULL;
 	}
-	buf = data->buffers[buffer.index].start;
+	if(timestamp)
+		*timestamp = (guint64)buffer.timestamp.tv_sec * G_USEC_PER_SEC +
+			buffer.timestamp.tv_usec;
 
-	pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8,
+	pixbuf = v4l2_convert_yuyv(data->buffers[buffer.index].start,
 		data->width, data->height);
+	if(data->record && (fwrite(data->buffers[buffer.index].start,
+		data->width * data->height * 2, 1, data->record) != 1)) {
+		g_warning("recording frame failed: %s (%d), stopped",
+			strerror(errno), errno);
+		fclose(data->record);
+		data->record = NULL;
+	}
+
+	if(ioctl(data->fd, VIDIOC_QBUF, &buffer) == -1) {
+		g_warning("queuing buffer failed: %s (%d)", strerror(errno), errno);
+	}
+	return pixbuf;
+}
+
+GdkPixbuf *v4l2_convert_yuyv(const guint8 *buf, gsize width, gsize height)
+{
+	GdkPixbuf *pixbuf;
+	gint32 x, y;
+	guint8 *pixels, *pixel;
+	guint32 rowstride, n_channels;
+	guint8 cy, cu, cv, r, g, b;
+
+	pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, width, height);
 	pixels = gdk_pixbuf_get_pixels(pixbuf);
 	rowstride = gdk_pixbuf_get_rowstride(pixbuf);
 	n_channels = gdk_pixbuf_get_n_channels(pixbuf);
 
-	for(y = 0; y < data->height; y ++) {
-		for(x = 0; x < data->width; x ++) {
+	for(y = 0; y < height; y ++) {
+		for(x = 0; x < width; x ++) {
 			pixel = pixels + rowstride * y + x * n_channels;
-			cy = buf[y * data->width * 2 + x * 2 + 0];
-			cu = buf[y * data->width * 2 + (x & ~1UL) * 2 + 1];
-			cv = buf[y * data->width * 2 + (x | 1) * 2 + 1];
+			cy = buf[y * width * 2 + x * 2 + 0];
+			cu = buf[y * width * 2 + (x & ~1UL) * 2 + 1];
+			cv = buf[y * width * 2 + (x | 1) * 2 + 1];
 
 #if 0
 			r = cy + 1.403 * cv;
@@ -267,9 +318,5 @@ GdkPixbuf *v4l2_get_pixbuf(V4l2Data *data)
 			pixel[2] = b;
 		}
 	}
-
-	if(ioctl(data->fd, VIDIOC_QBUF, &buffer) == -1) {
-		g_warning("queuing buffer failed: %s (%d)", strerror(errno), errno);
-	}
 	return pixbuf;
 }
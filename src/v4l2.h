@@ -8,7 +8,10 @@
 typedef struct _V4l2Data V4l2Data;
 
 V4l2Data *v4l2_init(Config *config);
+V4l2Data *v4l2_init_section(Config *config, const gchar *section);
 void v4l2_cleanup(V4l2Data *data);
 GdkPixbuf *v4l2_get_pixbuf(V4l2Data *data);
+GdkPixbuf *v4l2_get_frame(V4l2Data *data, guint64 *timestamp);
+GdkPixbuf *v4l2_convert_yuyv(const guint8 *buf, gsize width, gsize height);
 
 #endif /* _V4L2_H */